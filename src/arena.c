@@ -0,0 +1,144 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "arena.h"
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(16)));
+};
+
+struct arena {
+	/* Chunk being allocated from, followed by the full ones */
+	struct arena_chunk *chunks;
+	/* Size of the next chunk */
+	size_t next_size;
+	/* Bytes handed out, for the statistics */
+	size_t used;
+	uint32_t refcount;
+};
+
+static struct arena_stats arena_stats;
+
+#define ARENA_ALIGN(size) (((size) + 15) & ~((size_t) 15))
+
+struct arena *arena_new(void)
+{
+	struct arena *arena = (struct arena *) calloc(1, sizeof(struct arena));
+	assert(arena);
+
+	arena->next_size = ARENA_MIN_CHUNK;
+	__atomic_add_fetch(&arena_stats.arenas, 1, __ATOMIC_RELAXED);
+	return arena;
+}
+
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	if (size < arena->next_size)
+		size = arena->next_size;
+	else
+		size = ARENA_ALIGN(size);
+	if (arena->next_size < ARENA_MAX_CHUNK)
+		arena->next_size <<= 1;
+
+	chunk = (struct arena_chunk *) calloc(1, sizeof(struct arena_chunk) + size);
+	assert(chunk);
+	chunk->size = size;
+	__atomic_add_fetch(&arena_stats.chunks, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&arena_stats.bytes_reserved, size, __ATOMIC_RELAXED);
+	return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *ptr;
+
+	size = ARENA_ALIGN(size);
+	if (! chunk || chunk->size - chunk->used < size) {
+		chunk = arena_new_chunk(arena, size);
+		if (arena->chunks && chunk->size - size < arena->chunks->size - arena->chunks->used) {
+			/* Large allocation: keep using the current chunk, which has more room left */
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+	ptr = &chunk->data[chunk->used];
+	chunk->used += size;
+	arena->used += size;
+	__atomic_add_fetch(&arena_stats.bytes_used, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&arena_stats.allocations, 1, __ATOMIC_RELAXED);
+	return ptr;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = (char *) arena_alloc(arena, len);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void arena_get(struct arena *arena)
+{
+	__atomic_add_fetch(&arena->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void arena_put(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	if (__atomic_sub_fetch(&arena->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+	for (chunk=arena->chunks; chunk; chunk=next) {
+		next = chunk->next;
+		__atomic_sub_fetch(&arena_stats.chunks, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&arena_stats.bytes_reserved, chunk->size, __ATOMIC_RELAXED);
+		free(chunk);
+	}
+	__atomic_sub_fetch(&arena_stats.bytes_used, arena->used, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&arena_stats.arenas, 1, __ATOMIC_RELAXED);
+	free(arena);
+}
+
+void arena_get_stats(struct arena_stats *stats)
+{
+	stats->arenas = __atomic_load_n(&arena_stats.arenas, __ATOMIC_RELAXED);
+	stats->chunks = __atomic_load_n(&arena_stats.chunks, __ATOMIC_RELAXED);
+	stats->bytes_reserved = __atomic_load_n(&arena_stats.bytes_reserved, __ATOMIC_RELAXED);
+	stats->bytes_used = __atomic_load_n(&arena_stats.bytes_used, __ATOMIC_RELAXED);
+	stats->allocations = __atomic_load_n(&arena_stats.allocations, __ATOMIC_RELAXED);
+}
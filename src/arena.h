@@ -0,0 +1,59 @@
+#ifndef __arena_h
+#define __arena_h
+
+/* Size of the first chunk of an arena. Later chunks double up to ARENA_MAX_CHUNK */
+#define ARENA_MIN_CHUNK 2048
+#define ARENA_MAX_CHUNK 65536
+
+/**
+ * Bump allocator for the dentries of a table version. Memory is never released on
+ * its own: the whole arena goes away once the last dentry allocated from it has been
+ * released. Allocations aren't locked, so only the thread building a tree may
+ * allocate from its arena.
+ */
+struct arena;
+
+/* Allocator statistics, reported in the stats file */
+struct arena_stats {
+	/* Arenas and chunks alive */
+	uint64_t arenas;
+	uint64_t chunks;
+	/* Bytes in those chunks, and bytes handed out from them */
+	uint64_t bytes_reserved;
+	uint64_t bytes_used;
+	/* Allocations served since startup */
+	uint64_t allocations;
+};
+
+/**
+ * arena_new - Creates an empty arena. It is released by the arena_put() call which
+ * drops the last reference taken with arena_get().
+ */
+struct arena *arena_new(void);
+
+/**
+ * arena_alloc - Returns 'size' zeroed bytes from the arena.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * arena_strdup - Copies a string into the arena.
+ */
+char *arena_strdup(struct arena *arena, const char *str);
+
+/**
+ * arena_get - Takes a reference on behalf of an object allocated from the arena.
+ */
+void arena_get(struct arena *arena);
+
+/**
+ * arena_put - Drops a reference, releasing all the arena's memory with the last one.
+ */
+void arena_put(struct arena *arena);
+
+/**
+ * arena_get_stats - Reads the allocator statistics.
+ */
+void arena_get_stats(struct arena_stats *stats);
+
+#endif /* __arena_h */
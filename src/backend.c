@@ -2,6 +2,80 @@
 #include "backend.h"
 #include "filesrc.h"
 
+/**
+ * Allocate a packet vector.
+ * @param size maximum number of packets the vector can hold.
+ * @return the new vector or NULL on error.
+ */
+struct ts_packet_vec *backend_packet_vec_new(int size)
+{
+	struct ts_packet_vec *vec = (struct ts_packet_vec *) calloc(1, sizeof(struct ts_packet_vec));
+	if (! vec)
+		return NULL;
+	vec->size = size;
+	vec->headers = (struct ts_header *) calloc(size, sizeof(struct ts_header));
+	vec->payloads = (const char **) calloc(size, sizeof(char *));
+	vec->lengths = (uint32_t *) calloc(size, sizeof(uint32_t));
+	if (! vec->headers || ! vec->payloads || ! vec->lengths) {
+		backend_packet_vec_free(vec);
+		return NULL;
+	}
+	return vec;
+}
+
+/**
+ * Free a packet vector allocated by backend_packet_vec_new().
+ * @param vec the vector.
+ */
+void backend_packet_vec_free(struct ts_packet_vec *vec)
+{
+	if (vec) {
+		free(vec->headers);
+		free(vec->payloads);
+		free(vec->lengths);
+		free(vec->data);
+		free(vec);
+	}
+}
+
+/**
+ * Implement read_batch() on top of the single-packet read() and process() methods.
+ * Packets are copied into the vector's own storage, as the backend reuses its packet
+ * buffer on every read().
+ * @param vec vector to fill.
+ * @param priv private data.
+ * @return 0 on success or a negative value, as returned by read(), if no packets were read.
+ */
+static int backend_read_batch_fallback(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct backend_ops *ops = priv->backend;
+	uint8_t packet_size = priv->options.packet_size;
+	int max_packets = vec->size < BACKEND_FALLBACK_BATCH_PACKETS ? vec->size : BACKEND_FALLBACK_BATCH_PACKETS;
+	void *payload;
+	char *packet;
+	int ret;
+
+	if (! vec->data) {
+		vec->data = (char *) malloc(vec->size * packet_size);
+		if (! vec->data)
+			return -ENOMEM;
+	}
+
+	vec->count = 0;
+	while (vec->count < max_packets && ops->keep_alive(priv)) {
+		ret = ops->read(priv);
+		if (ret < 0)
+			return vec->count ? 0 : ret;
+		ret = ops->process(&vec->headers[vec->count], &payload, priv);
+		if (ret < 0)
+			continue;
+		packet = &vec->data[vec->count * packet_size];
+		memcpy(&packet[4], payload, packet_size - 4);
+		vec->payloads[vec->count++] = &packet[4];
+	}
+	return 0;
+}
+
 /**
  * Load the requested backend and return its backend_ops and its handle.
  * @param backend_name path to loadable backend.
@@ -10,7 +84,6 @@
  */
 struct backend_ops *backend_load(const char *backend_name, void **backend_handle)
 {
-	int i;
 	char backend[PATH_MAX];
 	struct stat statbuf;
 	struct backend_ops *ops;
@@ -52,13 +125,16 @@ struct backend_ops *backend_load(const char *backend_name, void **backend_handle
 	}
 
 	/* Verify that backend implements all required operations */
-	for (i=0; i<sizeof(struct backend_ops)/sizeof(void *); ++i) {
-		if (((void *) &(ops)[i]) == NULL) {
-			fprintf(stderr, "Backend doesn't implement all methods of struct backend_ops");
-			goto out_error;
-		}
+	if (! ops->create || ! ops->destroy || ! ops->set_frequency || ! ops->keep_alive || ! ops->usage ||
+		(! ops->read_batch && (! ops->read || ! ops->process))) {
+		fprintf(stderr, "Backend doesn't implement all methods of struct backend_ops\n");
+		goto out_error;
 	}
 
+	/* Emulate batched reads on backends which deliver a single packet at a time */
+	if (! ops->read_batch)
+		ops->read_batch = backend_read_batch_fallback;
+
 	return ops;
 
 out_error:
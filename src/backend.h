@@ -6,6 +6,35 @@
 #include <dirent.h>
 #include "ts.h"
 
+/* Maximum number of packets returned by a single read_batch() call */
+#define BACKEND_BATCH_PACKETS 16384
+
+/* Number of packets gathered at a time when read_batch() is emulated with read()+process() */
+#define BACKEND_FALLBACK_BATCH_PACKETS 64
+
+/**
+ * A batch of transport stream packets. headers[i] is the decoded header of the packet
+ * whose payload starts at payloads[i]. Payloads point into memory owned by the backend
+ * and remain valid until the next call to read_batch().
+ *
+ * Backends which filter sections in hardware set 'sections', in which case payloads[i]
+ * is a complete PSI section of lengths[i] bytes and headers[i] only carries its PID.
+ */
+struct ts_packet_vec {
+	/* Capacity of the headers and payloads arrays */
+	int size;
+	/* Number of packets delivered by the last read_batch() call */
+	int count;
+	struct ts_header *headers;
+	const char **payloads;
+	bool sections;
+	/* Set by backends whose payloads stay valid until they are destroyed, so queues needn't copy them */
+	bool stable;
+	uint32_t *lengths;
+	/* Packet storage used by backends which don't implement read_batch() */
+	char *data;
+};
+
 /* Backend operations */
 struct backend_ops {
     int (*create)(struct fuse_args *, struct demuxfs_data *);
@@ -15,10 +44,32 @@ struct backend_ops {
 	int (*process)(struct ts_header *, void **, struct demuxfs_data *);
     bool (*keep_alive)(struct demuxfs_data *);
 	void (*usage)(void);
+	/* Optional: fill the vector with as many packets as available. Emulated with read()+process() if NULL */
+	int (*read_batch)(struct ts_packet_vec *, struct demuxfs_data *);
+	/* Optional: start and stop routing a PID to the parser, for backends which can filter their input */
+	int (*add_pid)(uint16_t, struct demuxfs_data *);
+	int (*remove_pid)(uint16_t, struct demuxfs_data *);
 };
 
+/**
+ * backend_decode_header - Decodes the 4-byte header of the TS packet starting at 'packet'.
+ */
+static inline void backend_decode_header(struct ts_header *header, const char *packet)
+{
+	header->sync_byte                    =  packet[0];
+	header->transport_error_indicator    = (packet[1] >> 7) & 0x01;
+	header->payload_unit_start_indicator = (packet[1] >> 6) & 0x01;
+	header->transport_priority           = (packet[1] >> 5) & 0x01;
+	header->pid                          = (((packet[1] & 0xff) << 8) | (packet[2] & 0xff)) & 0x1fff;
+	header->transport_scrambling_control = (packet[3] >> 6) & 0x03;
+	header->adaptation_field             = (packet[3] >> 4) & 0x03;
+	header->continuity_counter           = (packet[3]) & 0x0f;
+}
+
 struct backend_ops *backend_load(const char *backend_name, void **backend_handle);
 void backend_unload(void *backend_handle);
 void backend_print_usage(void);
+struct ts_packet_vec *backend_packet_vec_new(int size);
+void backend_packet_vec_free(struct ts_packet_vec *vec);
 
 #endif /* __backend_h */
@@ -31,6 +31,7 @@
 #include "fsutils.h"
 #include "byteops.h"
 #include "backend.h"
+#include "resync.h"
 #include "ts.h"
 
 struct input_parser {
@@ -40,8 +41,27 @@ struct input_parser {
 	bool packet_valid;			/**< True if TS packet is valid, False if it's not */
 	uint8_t packet_size;		/**< Packet size (188, 204, 208 bytes) */
 	int fileloop;				/**< How many times to loop the file on EOF (cmdline option) */
+	char *batch;				/**< Buffer holding the packets returned by read_batch() */
+	size_t batch_packets;		/**< How many packets to read at once */
+	char *carry;				/**< Bytes read but not consumed by the last read_batch() call */
+	size_t carry_len;
+	struct resync_state resync;	/**< Recovery from sync byte loss */
+	int use_mmap;				/**< Map the file instead of reading it through stdio (cmdline option) */
+	char *map;					/**< File mapping, if use_mmap is set */
+	size_t map_size;			/**< Size of the mapping */
+	size_t map_start;			/**< Offset of the first packet in the mapping */
+	size_t map_offset;			/**< Offset of the next packet to be returned */
+	size_t map_dropped;			/**< Pages before this offset have been released with MADV_DONTNEED */
+	uint64_t bytes_read;		/**< Bytes delivered to the parser, for throughput reports */
+	struct timespec start_time;	/**< When the first packet was delivered */
 };
 
+/* FIFOs are read in smaller chunks so that fread() doesn't wait too long for data */
+#define FILESRC_FIFO_BATCH_PACKETS 64
+
+/* How much of the mapping may stay resident behind the cursor before it's released */
+#define FILESRC_MMAP_DONTNEED_SIZE (64 * 1024 * 1024)
+
 /**
  * Command line parsing routines.
  */
@@ -49,7 +69,8 @@ void filesrc_usage(void)
 {
 	fprintf(stderr, "\nFILESRC options:\n"
 			"    -o filesrc=FILE          transport stream input file\n"
-			"    -o fileloop=<count>      how many times to loop on EOF, -1 means infinite (default: 0)\n");
+			"    -o fileloop=<count>      how many times to loop on EOF, -1 means infinite (default: 0)\n"
+			"    -o filesrc_mmap=1|0      map the input file instead of reading it (regular files only, default: 0)\n");
 }
 
 #define FILESRC_OPT(templ,offset,value) { templ, offsetof(struct input_parser, offset), value }
@@ -57,6 +78,7 @@ void filesrc_usage(void)
 static struct fuse_opt filesrc_opts[] = {
 	FILESRC_OPT("filesrc=%s",   filesrc, 0),
 	FILESRC_OPT("fileloop=%d",  fileloop, 0),
+	FILESRC_OPT("filesrc_mmap=%d", use_mmap, 0),
 	FUSE_OPT_END
 };
 
@@ -104,6 +126,73 @@ static bool search_sync_byte(struct input_parser *p, uint8_t packet_size)
 	}
 }
 
+/**
+ * Map the input file and advise the kernel that it's going to be read sequentially.
+ */
+static int filesrc_map_file(struct input_parser *p)
+{
+	struct stat statbuf;
+
+	if (fstat(fileno(p->fp), &statbuf) < 0) {
+		perror(p->filesrc);
+		return -errno;
+	}
+	if (! S_ISREG(statbuf.st_mode)) {
+		fprintf(stderr, "Error: filesrc_mmap requires a regular file\n");
+		return -EINVAL;
+	}
+	if (statbuf.st_size == 0) {
+		fprintf(stderr, "Error: %s is empty\n", p->filesrc);
+		return -EINVAL;
+	}
+
+	p->map_size = statbuf.st_size;
+	p->map = mmap(NULL, p->map_size, PROT_READ, MAP_PRIVATE, fileno(p->fp), 0);
+	if (p->map == MAP_FAILED) {
+		perror("mmap");
+		p->map = NULL;
+		return -errno;
+	}
+	if (madvise(p->map, p->map_size, MADV_SEQUENTIAL) < 0)
+		perror("madvise");
+
+	p->map_start = p->map_offset = p->map_dropped = ftell(p->fp);
+	return 0;
+}
+
+/**
+ * Release the pages which are well behind the cursor, so that a multi-GB capture doesn't 
+ * push everything else out of the page cache. Pages holding the packets of the previous
+ * batches are kept, as the parser may still be looking at them. Batches queued for longer
+ * than that are faulted back in from the file.
+ */
+static void filesrc_release_pages(struct input_parser *p, size_t offset)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t end;
+
+	if (offset < p->map_dropped + FILESRC_MMAP_DONTNEED_SIZE)
+		return;
+	end = (offset - FILESRC_MMAP_DONTNEED_SIZE / 2) & ~(page_size - 1);
+	if (end > p->map_dropped) {
+		size_t start = p->map_dropped & ~(page_size - 1);
+		madvise(&p->map[start], end - start, MADV_DONTNEED);
+		p->map_dropped = end;
+	}
+}
+
+static void filesrc_report_throughput(struct input_parser *p)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - p->start_time.tv_sec) + (now.tv_nsec - p->start_time.tv_nsec) / 1e9;
+	if (p->bytes_read && elapsed > 0)
+		TS_INFO("filesrc: read %.1f MB in %.2f seconds (%.1f MB/s)", p->bytes_read / 1048576.0,
+				elapsed, p->bytes_read / 1048576.0 / elapsed);
+}
+
 /**
  * filesrc_create_parser: backend's create() method.
  */
@@ -147,6 +236,35 @@ int filesrc_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
 	}
 	p->packet = (char *) malloc(p->packet_size * sizeof(char));
 
+	if (p->use_mmap && filesrc_map_file(p) < 0) {
+		free(p->packet);
+		fclose(p->fp);
+		free(p);
+		return -1;
+	}
+
+	struct stat statbuf;
+	if (fstat(fileno(p->fp), &statbuf) == 0 && S_ISFIFO(statbuf.st_mode))
+		p->batch_packets = FILESRC_FIFO_BATCH_PACKETS;
+	else
+		p->batch_packets = BACKEND_BATCH_PACKETS;
+	/* Packets are handed straight out of the mapping when filesrc_mmap is set */
+	if (! p->map) {
+		p->batch = (char *) malloc(p->batch_packets * p->packet_size);
+		p->carry = (char *) malloc(RESYNC_CARRY_SIZE(p->packet_size));
+	}
+	if (! p->packet || (! p->map && (! p->batch || ! p->carry))) {
+		fprintf(stderr, "Error: not enough memory to allocate the packet buffers\n");
+		free(p->packet);
+		free(p->batch);
+		free(p->carry);
+		fclose(p->fp);
+		free(p);
+		return -1;
+	}
+
+	resync_init(&p->resync, p->packet_size);
+
 	/* Configure packet size */
 	priv->options.packet_size = p->packet_size;
 	priv->options.packet_error_correction_bytes = p->packet_size - 188;
@@ -160,7 +278,13 @@ int filesrc_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
  */
 int filesrc_destroy_parser(struct demuxfs_data *priv)
 {
+	filesrc_report_throughput(priv->parser);
+	resync_report(&priv->parser->resync, "filesrc");
+	if (priv->parser->map)
+		munmap(priv->parser->map, priv->parser->map_size);
 	free(priv->parser->packet);
+	free(priv->parser->batch);
+	free(priv->parser->carry);
 	fclose(priv->parser->fp);
     free(priv->parser);
 	return 0;
@@ -228,11 +352,89 @@ int filesrc_process_packet(struct ts_header *header, void **payload, struct demu
 	return 0;
 }
 
+/**
+ * filesrc_read_batch_mmap: read_batch() implementation for filesrc_mmap=1. Payloads point
+ * straight into the file mapping.
+ */
+static int filesrc_read_batch_mmap(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	size_t consumed, len = p->map_size - p->map_offset;
+
+	if (len > vec->size * p->packet_size)
+		len = vec->size * p->packet_size;
+
+	vec->count = 0;
+	vec->stable = true;
+	filesrc_release_pages(p, p->map_offset);
+	consumed = resync_decode(&p->resync, &p->map[p->map_offset], len, vec);
+	p->map_offset += consumed;
+	p->bytes_read += consumed;
+
+	if (consumed == 0) {
+		/* What's left at the end of the file can't hold a packet */
+		if (p->fileloop == -1 || p->fileloop--) {
+			dprintf("Rewinding TS file");
+			p->map_offset = p->map_dropped = p->map_start;
+		} else
+			return -ENODATA;
+	}
+	return 0;
+}
+
+/**
+ * filesrc_read_batch: backend's read_batch() method.
+ * @return 0 on success, a negative errno on error and -ENODATA if there's no more
+ *  data to be read.
+ */
+int filesrc_read_batch(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	size_t max_packets = vec->size < p->batch_packets ? vec->size : p->batch_packets;
+	size_t n, len, consumed, max_len = max_packets * p->packet_size;
+
+	if (! p->start_time.tv_sec)
+		clock_gettime(CLOCK_MONOTONIC, &p->start_time);
+	if (p->map)
+		return filesrc_read_batch_mmap(vec, priv);
+
+	/* Prepend the bytes left over by the previous call */
+	vec->count = 0;
+	if (p->carry_len)
+		memcpy(p->batch, p->carry, p->carry_len);
+	n = fread(&p->batch[p->carry_len], 1, max_len - p->carry_len, p->fp);
+	if (n < max_len - p->carry_len && ferror(p->fp)) {
+		perror("fread");
+		return -errno;
+	}
+	len = p->carry_len + n;
+	consumed = resync_decode(&p->resync, p->batch, len, vec);
+	p->bytes_read += n;
+
+	/* Save the trailing bytes elsewhere, as the payloads above must remain valid */
+	p->carry_len = len - consumed;
+	if (p->carry_len)
+		memcpy(p->carry, &p->batch[consumed], p->carry_len);
+
+	if (feof(p->fp)) {
+		/* What's left at the end of the file can't hold a packet */
+		p->carry_len = 0;
+		if (p->fileloop == -1 || p->fileloop--) {
+			dprintf("Rewinding TS file");
+			rewind(p->fp);
+		} else if (vec->count == 0)
+			return -ENODATA;
+	}
+	return 0;
+}
+
 /**
  * filesrc_keep_alive: backend's keep_alive() method.
  */
 bool filesrc_keep_alive(struct demuxfs_data *priv)
 {
+	if (priv->parser->map)
+		return true;
 	return !feof(priv->parser->fp);
 }
 
@@ -244,6 +446,7 @@ struct backend_ops filesrc_backend_ops = {
     .process = filesrc_process_packet,
     .keep_alive = filesrc_keep_alive,
 	.usage = filesrc_usage,
+	.read_batch = filesrc_read_batch,
 };
 
 struct backend_ops *backend_get_ops(void)
@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <getopt.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 
 #endif /* USE_FILESRC */
 
@@ -0,0 +1,565 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "iouring.h"
+#include "fsutils.h"
+#include "byteops.h"
+#include "backend.h"
+#include "resync.h"
+#include "ts.h"
+
+#define IOURING_DEFAULT_DEPTH        4
+#define IOURING_MAX_DEPTH            64
+#define IOURING_DEFAULT_BLOCK_SIZE   (2 * 1024 * 1024)
+
+/* Bytes read upfront from the input to detect the packet size */
+#define IOURING_PROBE_SIZE           (3 * 208)
+
+/* Bytes of a slot which can be left over for the next one: the probe or an unverified resync region */
+#define IOURING_CARRY_SIZE           (IOURING_PROBE_SIZE > RESYNC_CARRY_SIZE(208) ? \
+                                      IOURING_PROBE_SIZE : RESYNC_CARRY_SIZE(208))
+
+enum slot_state {
+	SLOT_IDLE,
+	SLOT_IN_FLIGHT,
+	SLOT_DONE,
+};
+
+/* A read request and the buffer it reads into */
+struct iouring_slot {
+	char *buf;
+	int state;
+	/* File offset and length of the read */
+	uint64_t offset;
+	size_t len;
+	/* Bytes read so far, as regular files may return short reads */
+	size_t done;
+	/* Result of the read: number of bytes read or a negative errno */
+	int result;
+	/* Discard partial packets once this slot is consumed, as the next one wraps to the start of the file */
+	bool last_in_loop;
+};
+
+struct input_parser {
+	char *filesrc;				/**< File source (cmdline option) */
+	int fileloop;				/**< How many times to loop the file on EOF (cmdline option) */
+	int depth;					/**< Number of reads kept in flight (cmdline option) */
+	int block_size;				/**< Size of each read (cmdline option) */
+	int fd;						/**< File source handle */
+	bool seekable;				/**< False for FIFOs, which are read one request at a time */
+	uint64_t file_size;			/**< Size of regular files and block devices */
+	uint64_t submit_offset;		/**< File offset of the next read to submit */
+	bool submit_eof;			/**< No more reads are to be submitted */
+	bool eof;					/**< All data has been consumed */
+	uint8_t packet_size;		/**< Packet size (188, 204, 208 bytes) */
+	struct io_uring ring;
+	struct iouring_slot *slots;
+	int next_submit;			/**< Slot to use for the next read */
+	int next_consume;			/**< Slot whose data is to be handed to the parser next */
+	int consumed;				/**< Slot handed to the parser on the last read_batch() call, or -1 */
+	int in_flight;				/**< Number of reads in flight */
+	char *carry;				/**< Trailing bytes of the last slot consumed */
+	size_t carry_len;
+	char *head;					/**< Packets stitched together from carry and the next slot */
+	struct resync_state resync;	/**< Recovery from sync byte loss */
+	/* Statistics */
+	uint64_t bytes_read;
+	uint64_t batches;
+	uint64_t in_flight_sum;		/**< Sum of in-flight reads seen at each read_batch(), for the average queue depth */
+	uint64_t stalls;			/**< How many times the parser had to wait for a read to complete */
+	struct timespec start_time;
+};
+
+/**
+ * Command line parsing routines.
+ */
+void iouring_usage(void)
+{
+	fprintf(stderr, "\nIOURING options:\n"
+			"    -o filesrc=FILE          transport stream input file, FIFO or block device\n"
+			"    -o fileloop=<count>      how many times to loop on EOF, -1 means infinite (default: 0)\n"
+			"    -o iouring_depth=N       number of reads kept in flight (default: %d)\n"
+			"    -o iouring_block_size=N  size in bytes of each read (default: %d)\n",
+			IOURING_DEFAULT_DEPTH, IOURING_DEFAULT_BLOCK_SIZE);
+}
+
+#define IOURING_OPT(templ,offset,value) { templ, offsetof(struct input_parser, offset), value }
+
+static struct fuse_opt iouring_opts[] = {
+	IOURING_OPT("filesrc=%s",            filesrc, 0),
+	IOURING_OPT("fileloop=%d",           fileloop, 0),
+	IOURING_OPT("iouring_depth=%d",      depth, 0),
+	IOURING_OPT("iouring_block_size=%d", block_size, 0),
+	FUSE_OPT_END
+};
+
+static int iouring_parse_opts(void *priv, const char *arg, int key, struct fuse_args *outargs)
+{
+	return 1;
+}
+
+/**
+ * Read the beginning of the input and find out the packet size. Non-seekable inputs
+ * can't be read again, so the probed bytes are kept in the carry buffer.
+ */
+static bool iouring_detect_packet_size(struct input_parser *p)
+{
+	uint8_t packet_size[] = { 188, 204, 208 };
+	char probe[IOURING_PROBE_SIZE];
+	ssize_t n, len = 0;
+	int i;
+
+	while (len < sizeof(probe)) {
+		if (p->seekable)
+			n = pread(p->fd, &probe[len], sizeof(probe) - len, len);
+		else
+			n = read(p->fd, &probe[len], sizeof(probe) - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			return false;
+		len += n;
+	}
+
+	for (i=0; i<sizeof(packet_size)/sizeof(uint8_t); ++i) {
+		uint8_t size = packet_size[i];
+		if (probe[0] == TS_SYNC_BYTE && probe[size] == TS_SYNC_BYTE && probe[size*2] == TS_SYNC_BYTE) {
+			p->packet_size = size;
+			if (! p->seekable) {
+				memcpy(p->carry, probe, len);
+				p->carry_len = len;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+static int iouring_submit_reads(struct input_parser *p)
+{
+	struct io_uring_sqe *sqe;
+	int submitted = 0;
+
+	while (! p->submit_eof && p->in_flight < p->depth) {
+		struct iouring_slot *slot = &p->slots[p->next_submit];
+		uint64_t offset = p->submit_offset;
+		size_t len = p->block_size;
+
+		/* FIFOs have no offsets: keep a single read in flight so that data arrives in order */
+		if (! p->seekable && p->in_flight > 0)
+			break;
+		if (slot->state != SLOT_IDLE)
+			break;
+
+		sqe = io_uring_get_sqe(&p->ring);
+		if (! sqe)
+			break;
+
+		slot->last_in_loop = false;
+		if (p->seekable) {
+			if (offset + len >= p->file_size) {
+				len = p->file_size - offset;
+				if (p->fileloop == -1 || p->fileloop--) {
+					slot->last_in_loop = true;
+					p->submit_offset = 0;
+				} else
+					p->submit_eof = true;
+			} else
+				p->submit_offset += len;
+		}
+
+		slot->offset = p->seekable ? offset : (uint64_t) -1;
+		slot->len = len;
+		slot->done = 0;
+		io_uring_prep_read(sqe, p->fd, slot->buf, len, slot->offset);
+		io_uring_sqe_set_data(sqe, slot);
+		slot->state = SLOT_IN_FLIGHT;
+		p->next_submit = (p->next_submit + 1) % p->depth;
+		p->in_flight++;
+		submitted++;
+	}
+
+	if (submitted) {
+		int ret = io_uring_submit(&p->ring);
+		if (ret < 0) {
+			fprintf(stderr, "io_uring_submit: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Record the result of a completed read. Interrupted reads are retried, and so are short 
+ * reads on seekable inputs, as the following block has already been requested.
+ */
+static int iouring_handle_completion(struct input_parser *p, struct io_uring_cqe *cqe)
+{
+	struct iouring_slot *slot = (struct iouring_slot *) io_uring_cqe_get_data(cqe);
+	struct io_uring_sqe *sqe;
+	int res = cqe->res;
+
+	io_uring_cqe_seen(&p->ring, cqe);
+	p->in_flight--;
+
+	if (res == -EINTR || res == -EAGAIN || (p->seekable && res > 0 && slot->done + res < slot->len)) {
+		if (res > 0)
+			slot->done += res;
+		sqe = io_uring_get_sqe(&p->ring);
+		if (sqe) {
+			io_uring_prep_read(sqe, p->fd, &slot->buf[slot->done], slot->len - slot->done,
+				p->seekable ? slot->offset + slot->done : (uint64_t) -1);
+			io_uring_sqe_set_data(sqe, slot);
+			p->in_flight++;
+			return io_uring_submit(&p->ring);
+		}
+		res = -EBUSY;
+	}
+
+	slot->result = res < 0 ? res : slot->done + res;
+	slot->state = SLOT_DONE;
+	return 0;
+}
+
+/**
+ * Wait until the slot to be consumed next has completed, reaping other completions on the way.
+ */
+static int iouring_wait_slot(struct input_parser *p, struct iouring_slot *slot)
+{
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	while (io_uring_peek_cqe(&p->ring, &cqe) == 0) {
+		ret = iouring_handle_completion(p, cqe);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (slot->state != SLOT_DONE)
+		p->stalls++;
+
+	while (slot->state == SLOT_IN_FLIGHT) {
+		ret = io_uring_wait_cqe(&p->ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		else if (ret < 0) {
+			fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+			return ret;
+		}
+		ret = iouring_handle_completion(p, cqe);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static void iouring_report_statistics(struct input_parser *p)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - p->start_time.tv_sec) + (now.tv_nsec - p->start_time.tv_nsec) / 1e9;
+	if (! p->batches || elapsed <= 0)
+		return;
+	TS_INFO("iouring: read %.1f MB in %.2f seconds (%.1f MB/s)", p->bytes_read / 1048576.0,
+			elapsed, p->bytes_read / 1048576.0 / elapsed);
+	TS_INFO("iouring: queue depth %d, %.2f reads in flight on average, %llu stalls in %llu batches",
+			p->depth, (double) p->in_flight_sum / p->batches,
+			(unsigned long long) p->stalls, (unsigned long long) p->batches);
+}
+
+/**
+ * iouring_create_parser: backend's create() method.
+ */
+int iouring_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
+{
+	struct stat statbuf;
+	int i, ret;
+	struct input_parser *p = calloc(1, sizeof(struct input_parser));
+	assert(p);
+
+	p->fd = -1;
+	ret = fuse_opt_parse(args, p, iouring_opts, iouring_parse_opts);
+	if (ret < 0) {
+		free(p);
+		return -1;
+	}
+	if (! p->filesrc) {
+		fprintf(stderr, "Error: missing '-o filesrc=FILE' option\n");
+		free(p);
+		return -1;
+	}
+	if (! p->depth)
+		p->depth = IOURING_DEFAULT_DEPTH;
+	if (! p->block_size)
+		p->block_size = IOURING_DEFAULT_BLOCK_SIZE;
+	if (p->depth < 2 || p->depth > IOURING_MAX_DEPTH) {
+		fprintf(stderr, "Invalid value '%d' for iouring_depth\n", p->depth);
+		free(p);
+		return -1;
+	}
+
+	p->fd = open(p->filesrc, O_RDONLY);
+	if (p->fd < 0 || fstat(p->fd, &statbuf) < 0) {
+		perror(p->filesrc);
+		goto out_free;
+	}
+	if (S_ISREG(statbuf.st_mode)) {
+		p->seekable = true;
+		p->file_size = statbuf.st_size;
+	} else if (S_ISBLK(statbuf.st_mode)) {
+		p->seekable = true;
+		if (ioctl(p->fd, BLKGETSIZE64, &p->file_size) < 0) {
+			perror("BLKGETSIZE64");
+			goto out_free;
+		}
+	} else if (! S_ISFIFO(statbuf.st_mode)) {
+		fprintf(stderr, "Error: %s is not a regular file, a FIFO or a block device\n", p->filesrc);
+		goto out_free;
+	}
+
+	p->carry = (char *) malloc(IOURING_CARRY_SIZE);
+	p->head = (char *) malloc(IOURING_CARRY_SIZE + RESYNC_CARRY_SIZE(208));
+	if (! p->carry || ! p->head)
+		goto out_free;
+
+	if (! iouring_detect_packet_size(p)) {
+		fprintf(stderr, "Error: %s doesn't seem to be a valid transport stream.\n", p->filesrc);
+		goto out_free;
+	}
+	resync_init(&p->resync, p->packet_size);
+
+	/* Read whole packets, leaving room in the packet vector for the ones stitched from the carry buffer */
+	p->block_size -= p->block_size % p->packet_size;
+	if (p->block_size + IOURING_CARRY_SIZE > BACKEND_BATCH_PACKETS * p->packet_size)
+		p->block_size = BACKEND_BATCH_PACKETS * p->packet_size - IOURING_CARRY_SIZE;
+	p->block_size -= p->block_size % p->packet_size;
+	if (p->block_size <= 0) {
+		fprintf(stderr, "Invalid value for iouring_block_size\n");
+		goto out_free;
+	}
+
+	p->slots = (struct iouring_slot *) calloc(p->depth, sizeof(struct iouring_slot));
+	if (! p->slots)
+		goto out_free;
+	for (i=0; i<p->depth; ++i) {
+		p->slots[i].buf = (char *) malloc(p->block_size);
+		if (! p->slots[i].buf)
+			goto out_free;
+	}
+
+	ret = io_uring_queue_init(p->depth, &p->ring, 0);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+		goto out_free;
+	}
+	p->consumed = -1;
+
+	/* Configure packet size */
+	priv->options.packet_size = p->packet_size;
+	priv->options.packet_error_correction_bytes = p->packet_size - 188;
+
+	priv->parser = p;
+	return 0;
+
+out_free:
+	if (p->slots) {
+		for (i=0; i<p->depth; ++i)
+			free(p->slots[i].buf);
+		free(p->slots);
+	}
+	if (p->fd >= 0)
+		close(p->fd);
+	free(p->carry);
+	free(p->head);
+	free(p);
+	return -1;
+}
+
+/**
+ * iouring_destroy_parser: backend's destroy() method.
+ */
+int iouring_destroy_parser(struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	struct io_uring_cqe *cqe;
+	int i;
+
+	/* Reap outstanding reads before their buffers go away */
+	while (p->in_flight > 0 && io_uring_wait_cqe(&p->ring, &cqe) == 0)
+		iouring_handle_completion(p, cqe);
+
+	iouring_report_statistics(p);
+	resync_report(&p->resync, "iouring");
+	io_uring_queue_exit(&p->ring);
+	for (i=0; i<p->depth; ++i)
+		free(p->slots[i].buf);
+	free(p->slots);
+	free(p->carry);
+	free(p->head);
+	close(p->fd);
+	free(p);
+	return 0;
+}
+
+/**
+ * iouring_set_frequency: no-op.
+ */
+int iouring_set_frequency(uint32_t frequency, struct demuxfs_data *priv)
+{
+	(void) frequency;
+	(void) priv;
+	return -ENOSYS;
+}
+
+/**
+ * Hand the packets of a completed read over to the parser. Bytes which straddle two
+ * reads are stitched together in the head buffer.
+ */
+static void iouring_consume_slot(struct input_parser *p, struct iouring_slot *slot, 
+		struct ts_packet_vec *vec)
+{
+	const char *data = slot->buf;
+	size_t consumed, len = slot->result;
+
+	/* Taking RESYNC_CARRY_SIZE bytes from the slot is enough for the carry to be consumed, unless the slot is shorter */
+	if (p->carry_len) {
+		size_t take = RESYNC_CARRY_SIZE(p->packet_size) < len ? RESYNC_CARRY_SIZE(p->packet_size) : len;
+		size_t head_len = p->carry_len + take;
+
+		memcpy(p->head, p->carry, p->carry_len);
+		memcpy(&p->head[p->carry_len], data, take);
+		consumed = resync_decode(&p->resync, p->head, head_len, vec);
+		if (consumed >= p->carry_len) {
+			/* Decoding can go on straight from the slot buffer */
+			data += consumed - p->carry_len;
+			len -= consumed - p->carry_len;
+			p->carry_len = 0;
+		} else {
+			/* This read was too short to complete the packet or the resync scan */
+			p->carry_len = head_len - consumed;
+			memcpy(p->carry, &p->head[consumed], p->carry_len);
+			len = 0;
+		}
+	}
+
+	if (! p->carry_len) {
+		consumed = resync_decode(&p->resync, data, len, vec);
+		p->carry_len = len - consumed;
+		if (p->carry_len)
+			memcpy(p->carry, &data[consumed], p->carry_len);
+	}
+	/* Only holds as long as the vector had room for every packet, see iouring_read_batch() */
+	assert(p->carry_len <= IOURING_CARRY_SIZE);
+	if (slot->last_in_loop) {
+		dprintf("Rewinding TS file");
+		p->carry_len = 0;
+	}
+}
+
+/**
+ * iouring_read_batch: backend's read_batch() method. The vector must hold all packets of
+ * a slot and of the carry buffer: what doesn't fit would be left over in the carry buffer,
+ * and the slot is recycled on the next call.
+ * @return 0 on success, a negative errno on error and -ENODATA if there's no more
+ *  data to be read.
+ */
+int iouring_read_batch(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	struct iouring_slot *slot;
+	int ret;
+
+	assert(vec->size * p->packet_size >= p->block_size + IOURING_CARRY_SIZE);
+	if (! p->start_time.tv_sec)
+		clock_gettime(CLOCK_MONOTONIC, &p->start_time);
+
+	/* The packets handed out on the previous call have been parsed: recycle their buffer */
+	if (p->consumed >= 0) {
+		p->slots[p->consumed].state = SLOT_IDLE;
+		p->consumed = -1;
+	}
+
+	vec->count = 0;
+	ret = iouring_submit_reads(p);
+	if (ret < 0)
+		return ret;
+
+	slot = &p->slots[p->next_consume];
+	if (slot->state == SLOT_IDLE) {
+		/* Nothing left in flight */
+		p->eof = true;
+		return -ENODATA;
+	}
+
+	p->batches++;
+	p->in_flight_sum += p->in_flight;
+	ret = iouring_wait_slot(p, slot);
+	if (ret < 0)
+		return ret;
+
+	p->next_consume = (p->next_consume + 1) % p->depth;
+	p->consumed = slot - p->slots;
+
+	if (slot->result < 0) {
+		fprintf(stderr, "read: %s\n", strerror(-slot->result));
+		return slot->result;
+	} else if (slot->result == 0) {
+		/* FIFO writer went away */
+		p->submit_eof = true;
+		return 0;
+	}
+
+	p->bytes_read += slot->result;
+	iouring_consume_slot(p, slot, vec);
+	return 0;
+}
+
+/**
+ * iouring_keep_alive: backend's keep_alive() method.
+ */
+bool iouring_keep_alive(struct demuxfs_data *priv)
+{
+	return ! priv->parser->eof;
+}
+
+struct backend_ops iouring_backend_ops = {
+	.create        = iouring_create_parser,
+	.destroy       = iouring_destroy_parser,
+	.set_frequency = iouring_set_frequency,
+	.keep_alive    = iouring_keep_alive,
+	.usage         = iouring_usage,
+	.read_batch    = iouring_read_batch,
+};
+
+struct backend_ops *backend_get_ops(void)
+{
+	return &iouring_backend_ops;
+}
@@ -0,0 +1,19 @@
+#ifndef __iouring_h
+#define __iouring_h
+
+#ifdef USE_IOURING
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <liburing.h>
+
+#endif /* USE_IOURING */
+
+#endif /* __iouring_h */
@@ -31,7 +31,9 @@
 #include "fsutils.h"
 #include "byteops.h"
 #include "backend.h"
+#include "resync.h"
 #include "buffer.h"
+#include "stats.h"
 #include "ts.h"
 
 #define LINUXDVB_DEFAULT_FRONTEND_DEVICE  "/dev/dvb/adapter0/frontend0"
@@ -41,6 +43,9 @@
 #define LINUXDVB_DEFAULT_SYMBOL_RATE      0
 #define LINUXDVB_DEFAULT_QPSK_VOLTAGE     13
 #define LINUXDVB_DEFAULT_QPSK_TONE        0
+#define LINUXDVB_DEFAULT_PID_FILTER       1
+#define LINUXDVB_DEFAULT_SECTION_FILTERS  0
+#define LINUXDVB_DEFAULT_BUFFER_SIZE      (4 * 1024 * 1024)
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3,0,0)
 #undef  DVB_API_VERSION
@@ -55,14 +60,51 @@ struct input_parser {
 	int qpsk_voltage;
 	int symbol_rate;
 	int qpsk_tone;
+	int pid_filter;
+	int section_filters;
+	int buffer_size;
 	int frontend_fd;
 	int demux_fd;
 	int dvr_fd;
+	int input_fd;
+	int epoll_fd;
+	int *section_fds;
+	/* Section filters removed by the parsers, which the reader closes between batches */
+	pthread_mutex_t filter_lock;
+	int *closing_fds;
+	int closing_count;
+	int closing_size;
+	uint64_t overflows;
 	char *packet;
 	bool packet_valid;
 	uint8_t packet_size;
+	char *batch;
+	size_t batch_size;
+	char *carry;
+	size_t carry_len;
+	struct resync_state resync;
 };
 
+/* Size of the buffer used by read_batch(). The DVR device returns whatever it has queued */
+#define LINUXDVB_BATCH_SIZE (BACKEND_BATCH_PACKETS * 188)
+
+/* Largest private section. Section filters return one section per read() */
+#define LINUXDVB_MAX_SECTION_SIZE 4096
+
+/* Kernel buffer of each section filter: room for 16 sections of the largest size */
+#define LINUXDVB_SECTION_BUFFER_SIZE (16 * LINUXDVB_MAX_SECTION_SIZE)
+
+/* How many section filters are serviced per epoll_wait(), and for how long to wait (in ms) */
+#define LINUXDVB_MAX_EVENTS       64
+#define LINUXDVB_POLL_TIMEOUT     500
+
+/* 
+ * Batches smaller than this make read_batch() wait LINUXDVB_BATCH_LATENCY ms for more
+ * packets to be queued by the kernel, rather than waking up the parser for a handful.
+ */
+#define LINUXDVB_MIN_BATCH_SIZE   (256 * 188)
+#define LINUXDVB_BATCH_LATENCY    10
+
 static int linuxdvb_set_frequency_v3(uint32_t frequency, struct demuxfs_data *priv);
 static int linuxdvb_set_frequency_v5(uint32_t frequency, struct demuxfs_data *priv);
 
@@ -78,14 +120,20 @@ void linuxdvb_usage(void)
 			"    -o frequency=FREQ        Frequency (default=%d -- do not configure frontend)\n"
 			"    -o symbol_rate=RATE      Symbol rate (default=%d)\n"
 			"    -o qpsk_voltage=<13|18>  QPSK voltage (default=%d)\n"
-			"    -o qpsk_tone=<1|0>       QPSK tone (default=%d)\n",
+			"    -o qpsk_tone=<1|0>       QPSK tone (default=%d)\n"
+			"    -o pid_filter=<1|0>      only route the PIDs which have a parser (default=%d)\n"
+			"    -o section_filters=<1|0> read PSI sections filtered by the kernel, requires parse_pes=0 (default=%d)\n"
+			"    -o buffer_size=BYTES     kernel buffer for the packets not read yet, 0 keeps the driver's default (default=%d)\n",
 			LINUXDVB_DEFAULT_FRONTEND_DEVICE,
 			LINUXDVB_DEFAULT_DEMUX_DEVICE,
 			LINUXDVB_DEFAULT_DVR_DEVICE,
 			LINUXDVB_DEFAULT_FREQUENCY,
 			LINUXDVB_DEFAULT_SYMBOL_RATE,
 			LINUXDVB_DEFAULT_QPSK_VOLTAGE,
-			LINUXDVB_DEFAULT_QPSK_TONE
+			LINUXDVB_DEFAULT_QPSK_TONE,
+			LINUXDVB_DEFAULT_PID_FILTER,
+			LINUXDVB_DEFAULT_SECTION_FILTERS,
+			LINUXDVB_DEFAULT_BUFFER_SIZE
 			);
 }
 
@@ -99,6 +147,9 @@ static struct fuse_opt linuxdvb_opts[] = {
 	LINUXDVB_OPT("symbol_rate=%d", symbol_rate, 0),
 	LINUXDVB_OPT("qpsk_voltage=%d", qpsk_voltage, 0),
 	LINUXDVB_OPT("qpsk_tone=%d", qpsk_tone, 0),
+	LINUXDVB_OPT("pid_filter=%d", pid_filter, 0),
+	LINUXDVB_OPT("section_filters=%d", section_filters, 0),
+	LINUXDVB_OPT("buffer_size=%d", buffer_size, 0),
 	FUSE_OPT_END
 };
 
@@ -166,6 +217,80 @@ static void linuxdvb_get_frontend_status(int status, char *buf, size_t size)
 		ptr[strlen(ptr)-1] = '\0';
 }
 
+/**
+ * Route the transport stream to the DVR device, or to the demux device if pid_filter is set.
+ */
+static int linuxdvb_open_ts_filter(struct input_parser *p)
+{
+	/* Configure the DVR device to read raw TS packets */
+	if (! p->pid_filter) {
+		p->dvr_fd = open(p->dvr_device, O_RDONLY|O_NONBLOCK);
+		if (p->dvr_fd < 0) {
+			perror(p->dvr_device);
+			return -errno;
+		}
+	} else
+		p->dvr_fd = -1;
+
+	/* 
+	 * Configure the Demux device to route packets from the frontend to the DVR. With pid_filter
+	 * we start with the PAT alone and the packets are read from the demux handle, as that's the
+	 * only output which can carry more than one PID. The SI and the PIDs announced by the PAT
+	 * and PMTs are added by linuxdvb_add_pid() as parsers get registered.
+	 */
+	p->demux_fd = open(p->demux_device, O_RDWR|O_NONBLOCK);
+	if (p->demux_fd < 0) {
+		perror(p->demux_device);
+		return -errno;
+	}
+	p->input_fd = p->pid_filter ? p->demux_fd : p->dvr_fd;
+
+	/* The buffer must be resized before the filter is started */
+	if (p->buffer_size && ioctl(p->input_fd, DMX_SET_BUFFER_SIZE, p->buffer_size) < 0)
+		perror("DMX_SET_BUFFER_SIZE");
+
+	struct dmx_pes_filter_params pes_filter;
+	memset(&pes_filter, 0, sizeof(pes_filter));
+	pes_filter.pid      = p->pid_filter ? TS_PAT_PID : 0x2000;
+	pes_filter.input    = DMX_IN_FRONTEND;
+#ifdef DMX_ADD_PID
+	pes_filter.output   = p->pid_filter ? DMX_OUT_TSDEMUX_TAP : DMX_OUT_TS_TAP;
+#else
+	pes_filter.output   = DMX_OUT_TS_TAP;
+#endif
+	pes_filter.pes_type = DMX_PES_OTHER;
+	pes_filter.flags    = DMX_IMMEDIATE_START;
+
+	if (ioctl(p->demux_fd, DMX_SET_PES_FILTER, &pes_filter) < 0) {
+		perror("DMX_SET_PES_FILTER");
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Prepare the epoll instance which watches the section filters. The filters themselves
+ * are opened by linuxdvb_add_pid(), one demux handle per PID.
+ */
+static int linuxdvb_open_section_filters(struct input_parser *p)
+{
+	int pid;
+
+	p->section_fds = (int *) malloc(TS_MAX_PIDS * sizeof(int));
+	if (! p->section_fds)
+		return -ENOMEM;
+	for (pid=0; pid<TS_MAX_PIDS; ++pid)
+		p->section_fds[pid] = -1;
+	pthread_mutex_init(&p->filter_lock, NULL);
+
+	p->epoll_fd = epoll_create1(0);
+	if (p->epoll_fd < 0) {
+		perror("epoll_create1");
+		return -errno;
+	}
+	return 0;
+}
+
 /**
  * linuxdvb_create_parser: backend's create() method.
  */
@@ -174,6 +299,9 @@ int linuxdvb_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
 	struct input_parser *p = calloc(1, sizeof(struct input_parser));
 	assert(p);
 
+	p->pid_filter = LINUXDVB_DEFAULT_PID_FILTER;
+	p->buffer_size = LINUXDVB_DEFAULT_BUFFER_SIZE;
+	p->frontend_fd = p->demux_fd = p->dvr_fd = p->input_fd = p->epoll_fd = -1;
 	int ret = fuse_opt_parse(args, p, linuxdvb_opts, linuxdvb_parse_opts);
 	if (ret < 0) {
 		free(p);
@@ -211,6 +339,37 @@ int linuxdvb_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
 		goto out_free;
 	}
 
+	if (p->pid_filter != 0 && p->pid_filter != 1) {
+		fprintf(stderr, "Invalid value '%d' for pid_filter\n", p->pid_filter);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (p->section_filters != 0 && p->section_filters != 1) {
+		fprintf(stderr, "Invalid value '%d' for section_filters\n", p->section_filters);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (p->buffer_size < 0) {
+		fprintf(stderr, "Invalid value '%d' for buffer_size\n", p->buffer_size);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (p->section_filters && priv->options.parse_pes) {
+		fprintf(stderr, "section_filters cannot be used together with parse_pes\n");
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+#ifndef DMX_ADD_PID
+	/* This kernel can't route more than one PID through a demux handle */
+	if (p->pid_filter && ! p->section_filters)
+		fprintf(stderr, "linuxdvb: DMX_ADD_PID is not supported, pid_filter disabled: reading the full transport stream\n");
+	p->pid_filter = 0;
+#endif
+
 	if (p->frequency < 1000000)
 		p->frequency *=1000;
 
@@ -225,39 +384,28 @@ int linuxdvb_create_parser(struct fuse_args *args, struct demuxfs_data *priv)
 	} else
 		p->frontend_fd = -1;
 
-	/* Configure the DVR device to read raw TS packets */
-	p->dvr_fd = open(p->dvr_device, O_RDONLY);
-	if (p->dvr_fd < 0) {
-		perror(p->dvr_device);
-		ret = -errno;
-		goto out_free;
-	}
-
-	/* Configure the Demux device to route packets from the frontend to the DVR */
-	p->demux_fd = open(p->demux_device, O_RDWR|O_NONBLOCK);
-	if (p->demux_fd < 0) {
-		perror(p->demux_device);
-		ret = -errno;
+	if (p->section_filters)
+		ret = linuxdvb_open_section_filters(p);
+	else
+		ret = linuxdvb_open_ts_filter(p);
+	if (ret < 0)
 		goto out_free;
-	}
 
-	struct dmx_pes_filter_params pes_filter;
-	memset(&pes_filter, 0, sizeof(pes_filter));
-	pes_filter.pid      = 0x2000;
-	pes_filter.input    = DMX_IN_FRONTEND;
-	pes_filter.output   = DMX_OUT_TS_TAP;
-	pes_filter.pes_type = DMX_PES_OTHER;
-	pes_filter.flags    = DMX_IMMEDIATE_START;
-
-	ret = ioctl(p->demux_fd, DMX_SET_PES_FILTER, &pes_filter);
-	if (ret < 0) {
-		perror("DMX_SET_PES_FILTER");
-		goto out_free;
-	}
-	
 	/* Configure the packet size */
 	p->packet_size = 188;
 	p->packet = (char *) malloc(p->packet_size);
+	p->batch_size = LINUXDVB_BATCH_SIZE;
+	p->batch = (char *) malloc(p->batch_size);
+	p->carry = (char *) malloc(RESYNC_CARRY_SIZE(p->packet_size));
+	if (! p->packet || ! p->batch || ! p->carry) {
+		fprintf(stderr, "Not enough memory to allocate the packet buffers\n");
+		free(p->packet);
+		free(p->batch);
+		free(p->carry);
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	resync_init(&p->resync, p->packet_size);
 
 	/* Propagate user options back to the caller */
 	priv->options.packet_size = p->packet_size;
@@ -275,26 +423,63 @@ out_free:
 			close(p->demux_fd);
 		if (p->dvr_fd >= 0)
 			close(p->dvr_fd);
+		if (p->epoll_fd >= 0)
+			close(p->epoll_fd);
+		free(p->section_fds);
 		free(p);
 	}
 	return ret;
 }
 
+/**
+ * Close the section filters removed since the previous batch. Called by the reader
+ * thread only, once it can no longer be reading from them.
+ */
+static void linuxdvb_close_removed_filters(struct input_parser *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->filter_lock);
+	for (i=0; i<p->closing_count; ++i)
+		close(p->closing_fds[i]);
+	p->closing_count = 0;
+	pthread_mutex_unlock(&p->filter_lock);
+}
+
 /**
  * linuxdvb_destroy_parser: backend's destroy() method.
  */
 int linuxdvb_destroy_parser(struct demuxfs_data *priv)
 {
 	struct input_parser *p = priv->parser;
-	int ret;
+	int pid, ret;
 
-	ret = ioctl(p->demux_fd, DMX_STOP);
-	if (ret < 0)
-		perror("DMX_STOP");
+	if (p->demux_fd >= 0) {
+		ret = ioctl(p->demux_fd, DMX_STOP);
+		if (ret < 0)
+			perror("DMX_STOP");
+		close(p->demux_fd);
+	}
+	if (p->section_fds) {
+		for (pid=0; pid<TS_MAX_PIDS; ++pid)
+			if (p->section_fds[pid] >= 0)
+				close(p->section_fds[pid]);
+		free(p->section_fds);
+		linuxdvb_close_removed_filters(p);
+		free(p->closing_fds);
+		pthread_mutex_destroy(&p->filter_lock);
+		close(p->epoll_fd);
+	}
+	if (p->overflows)
+		TS_INFO("linuxdvb: the kernel buffer overflowed %llu times", 
+				(unsigned long long) p->overflows);
 
-	close(p->demux_fd);
-	close(p->dvr_fd);
+	resync_report(&p->resync, "linuxdvb");
+	if (p->dvr_fd >= 0)
+		close(p->dvr_fd);
 	free(p->packet);
+	free(p->batch);
+	free(p->carry);
 	free(p);
 	return 0;
 }
@@ -584,7 +769,7 @@ static int linuxdvb_set_frequency_v5(uint32_t frequency, struct demuxfs_data *pr
 int linuxdvb_read_packet(struct demuxfs_data *priv)
 {
 	struct input_parser *p = priv->parser;
-	ssize_t n = read(p->dvr_fd, p->packet, p->packet_size);
+	ssize_t n = read(p->input_fd, p->packet, p->packet_size);
 	if (n <= 0) {
 		p->packet_valid = false;
 		return 0;
@@ -618,6 +803,259 @@ int linuxdvb_process_packet(struct ts_header *header, void **payload, struct dem
 	return 0;
 }
 
+static void linuxdvb_count_overflow(struct demuxfs_data *priv)
+{
+	priv->parser->overflows++;
+	priv->stats->input_overflows++;
+}
+
+/**
+ * Read from the input until it has no more data queued or until max_size bytes
+ * are in the batch buffer.
+ */
+static int linuxdvb_drain_input(struct demuxfs_data *priv, size_t *len, size_t max_size)
+{
+	struct input_parser *p = priv->parser;
+
+	while (*len < max_size) {
+		ssize_t ret = read(p->input_fd, &p->batch[*len], max_size - *len);
+		if (ret > 0)
+			*len += ret;
+		else if (ret < 0 && errno == EOVERFLOW)
+			/* The kernel buffer has been flushed. Resync takes care of the gap */
+			linuxdvb_count_overflow(priv);
+		else if (ret < 0 && errno == EINTR)
+			continue;
+		else if (ret == 0 || errno == EAGAIN)
+			break;
+		else {
+			perror("read");
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Drain the section filters which have data. The kernel has reassembled the sections
+ * and verified their CRC already, so they're handed to the parser as they are.
+ */
+static int linuxdvb_read_sections(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	struct epoll_event events[LINUXDVB_MAX_EVENTS];
+	size_t offset = 0;
+	int i, n;
+
+	vec->count = 0;
+	vec->sections = true;
+	linuxdvb_close_removed_filters(p);
+	n = epoll_wait(p->epoll_fd, events, LINUXDVB_MAX_EVENTS, LINUXDVB_POLL_TIMEOUT);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i=0; i<n; ++i) {
+		uint16_t pid = events[i].data.u32;
+		int fd = __atomic_load_n(&p->section_fds[pid], __ATOMIC_ACQUIRE);
+
+		while (fd >= 0 && vec->count < vec->size && offset + LINUXDVB_MAX_SECTION_SIZE <= p->batch_size) {
+			struct ts_header *header = &vec->headers[vec->count];
+			ssize_t ret = read(fd, &p->batch[offset], LINUXDVB_MAX_SECTION_SIZE);
+			if (ret < 0 && errno == EOVERFLOW) {
+				/* The filter's buffer has overflowed and sections have been lost */
+				linuxdvb_count_overflow(priv);
+				continue;
+			} else if (ret <= 0)
+				break;
+
+			memset(header, 0, sizeof(*header));
+			header->sync_byte = TS_SYNC_BYTE;
+			header->payload_unit_start_indicator = 1;
+			header->pid = pid;
+			vec->payloads[vec->count] = &p->batch[offset];
+			vec->lengths[vec->count++] = ret;
+			offset += ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * linuxdvb_read_batch: backend's read_batch() method.
+ */
+int linuxdvb_read_batch(struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+	size_t len, consumed, max_size = vec->size * p->packet_size;
+	struct pollfd pfd = { .fd = p->input_fd, .events = POLLIN };
+	int ret;
+
+	if (p->section_filters)
+		return linuxdvb_read_sections(vec, priv);
+	if (max_size > p->batch_size)
+		max_size = p->batch_size;
+
+	/* Prepend the bytes left over by the previous call */
+	vec->count = 0;
+	vec->sections = false;
+	if (p->carry_len)
+		memcpy(p->batch, p->carry, p->carry_len);
+	ret = poll(&pfd, 1, LINUXDVB_POLL_TIMEOUT);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+	else if (ret == 0)
+		return 0;
+
+	len = p->carry_len;
+	ret = linuxdvb_drain_input(priv, &len, max_size);
+	if (ret == 0 && len < LINUXDVB_MIN_BATCH_SIZE && len < max_size) {
+		usleep(LINUXDVB_BATCH_LATENCY * 1000);
+		ret = linuxdvb_drain_input(priv, &len, max_size);
+	}
+	if (ret < 0)
+		return ret;
+
+	consumed = resync_decode(&p->resync, p->batch, len, vec);
+
+	/* Save the trailing bytes elsewhere, as the payloads above must remain valid */
+	p->carry_len = len - consumed;
+	if (p->carry_len)
+		memcpy(p->carry, &p->batch[consumed], p->carry_len);
+	return 0;
+}
+
+/**
+ * Take a PID's section filter away from the reader. The reader may still be reading
+ * from it in the current batch, so closing it is left to linuxdvb_close_removed_filters().
+ * Called with filter_lock held.
+ */
+static void linuxdvb_close_section_filter(struct input_parser *p, uint16_t pid)
+{
+	int fd = __atomic_exchange_n(&p->section_fds[pid], -1, __ATOMIC_ACQ_REL);
+
+	if (fd < 0)
+		return;
+	if (epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != ENOENT)
+		perror("epoll_ctl");
+	if (p->closing_count == p->closing_size) {
+		int size = p->closing_size ? p->closing_size * 2 : 16;
+		int *fds = (int *) realloc(p->closing_fds, size * sizeof(int));
+		assert(fds);
+		p->closing_fds = fds;
+		p->closing_size = size;
+	}
+	p->closing_fds[p->closing_count++] = fd;
+}
+
+/**
+ * Open a section filter for all tables carried on a PID. The descriptor is published
+ * before it joins the epoll set, so the reader never gets an event it can't resolve.
+ * Called with filter_lock held.
+ */
+static int linuxdvb_open_section_filter(struct input_parser *p, uint16_t pid)
+{
+	struct dmx_sct_filter_params filter;
+	struct epoll_event event;
+	int fd, ret;
+
+	if (p->section_fds[pid] >= 0)
+		return 0;
+	fd = open(p->demux_device, O_RDWR|O_NONBLOCK);
+	if (fd < 0) {
+		perror(p->demux_device);
+		return -errno;
+	}
+
+	memset(&filter, 0, sizeof(filter));
+	filter.pid   = pid;
+	filter.flags = DMX_CHECK_CRC | DMX_IMMEDIATE_START;
+	if (ioctl(fd, DMX_SET_BUFFER_SIZE, LINUXDVB_SECTION_BUFFER_SIZE) < 0)
+		perror("DMX_SET_BUFFER_SIZE");
+	if (ioctl(fd, DMX_SET_FILTER, &filter) < 0) {
+		ret = -errno;
+		fprintf(stderr, "DMX_SET_FILTER %#x: %s\n", pid, strerror(-ret));
+		close(fd);
+		return ret;
+	}
+
+	__atomic_store_n(&p->section_fds[pid], fd, __ATOMIC_RELEASE);
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = pid;
+	if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		ret = -errno;
+		perror("epoll_ctl");
+		/* The reader may have loaded the descriptor already, so let it close it */
+		linuxdvb_close_section_filter(p, pid);
+		return ret;
+	}
+	dprintf("Filtering sections on pid %#x", pid);
+	return 0;
+}
+
+/**
+ * linuxdvb_add_pid: backend's add_pid() method.
+ */
+int linuxdvb_add_pid(uint16_t pid, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+
+	if (p->section_filters) {
+		int ret;
+
+		pthread_mutex_lock(&p->filter_lock);
+		ret = linuxdvb_open_section_filter(p, pid);
+		pthread_mutex_unlock(&p->filter_lock);
+		return ret;
+	}
+#ifdef DMX_ADD_PID
+	int ret;
+
+	/* Without pid_filter the whole mux is routed already. The PAT is set up by create() */
+	if (! p->pid_filter || pid == TS_PAT_PID)
+		return 0;
+	ret = ioctl(p->demux_fd, DMX_ADD_PID, &pid);
+	if (ret < 0) {
+		fprintf(stderr, "DMX_ADD_PID %#x: %s\n", pid, strerror(errno));
+		return -errno;
+	}
+	dprintf("Routing pid %#x", pid);
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/**
+ * linuxdvb_remove_pid: backend's remove_pid() method.
+ */
+int linuxdvb_remove_pid(uint16_t pid, struct demuxfs_data *priv)
+{
+	struct input_parser *p = priv->parser;
+
+	if (p->section_filters) {
+		pthread_mutex_lock(&p->filter_lock);
+		linuxdvb_close_section_filter(p, pid);
+		pthread_mutex_unlock(&p->filter_lock);
+		return 0;
+	}
+#ifdef DMX_REMOVE_PID
+	int ret;
+
+	if (! p->pid_filter || pid == TS_PAT_PID)
+		return 0;
+	ret = ioctl(p->demux_fd, DMX_REMOVE_PID, &pid);
+	if (ret < 0) {
+		fprintf(stderr, "DMX_REMOVE_PID %#x: %s\n", pid, strerror(errno));
+		return -errno;
+	}
+	dprintf("No longer routing pid %#x", pid);
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
 /**
  * linuxdvb_keep_alive: backend's keep_alive() method.
  */
@@ -634,6 +1072,9 @@ struct backend_ops linuxdvb_backend_ops = {
 	.process       = linuxdvb_process_packet,
 	.keep_alive    = linuxdvb_keep_alive,
 	.usage         = linuxdvb_usage,
+	.read_batch    = linuxdvb_read_batch,
+	.add_pid       = linuxdvb_add_pid,
+	.remove_pid    = linuxdvb_remove_pid,
 };
 
 struct backend_ops *backend_get_ops(void)
@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <getopt.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <linux/dvb/frontend.h>
@@ -0,0 +1,114 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "backend.h"
+#include "resync.h"
+#include "ts.h"
+
+void resync_init(struct resync_state *state, uint8_t packet_size)
+{
+	memset(state, 0, sizeof(*state));
+	state->packet_size = packet_size;
+	state->in_sync = true;
+}
+
+/**
+ * Look for RESYNC_LOCK_PACKETS sync bytes in a row at the packet_size stride.
+ * @param buf data to scan.
+ * @param len length of buf.
+ * @param found set to true if a new alignment was found.
+ * @return the offset of the new alignment if found is true. Otherwise, the offset of the
+ *  first byte which could not be verified for lack of data: everything before it is garbage.
+ */
+static size_t resync_scan(struct resync_state *state, const char *buf, size_t len, bool *found)
+{
+	size_t span = (RESYNC_LOCK_PACKETS - 1) * state->packet_size;
+	const char *ptr = buf, *end;
+	int i;
+
+	*found = false;
+	if (len <= span)
+		return 0;
+
+	end = buf + len - span;
+	while ((ptr = memchr(ptr, TS_SYNC_BYTE, end - ptr)) != NULL) {
+		for (i=1; i<RESYNC_LOCK_PACKETS; ++i)
+			if (ptr[i * state->packet_size] != TS_SYNC_BYTE)
+				break;
+		if (i == RESYNC_LOCK_PACKETS) {
+			*found = true;
+			return ptr - buf;
+		}
+		ptr++;
+	}
+	return len - span;
+}
+
+size_t resync_decode(struct resync_state *state, const char *buf, size_t len, struct ts_packet_vec *vec)
+{
+	uint8_t packet_size = state->packet_size;
+	size_t offset = 0;
+
+	while (offset + packet_size <= len && vec->count < vec->size) {
+		const char *packet = &buf[offset];
+
+		if (packet[0] != TS_SYNC_BYTE || ! state->in_sync) {
+			bool found;
+			size_t skip = resync_scan(state, packet, len - offset, &found);
+
+			if (state->in_sync) {
+				state->in_sync = false;
+				state->resyncs++;
+			}
+			state->bytes_skipped += skip;
+			offset += skip;
+			if (! found)
+				/* The remaining bytes are too few to tell where the next packet starts */
+				break;
+
+			TS_WARNING("lost sync: realigned after skipping %llu bytes",
+					(unsigned long long) state->bytes_skipped - state->last_bytes_skipped);
+			state->last_bytes_skipped = state->bytes_skipped;
+			state->in_sync = true;
+			continue;
+		}
+
+		backend_decode_header(&vec->headers[vec->count], packet);
+		vec->payloads[vec->count++] = &packet[4];
+		offset += packet_size;
+	}
+	return offset;
+}
+
+void resync_report(struct resync_state *state, const char *backend_name)
+{
+	if (state->resyncs)
+		TS_INFO("%s: lost sync %llu times, %llu bytes skipped", backend_name,
+				(unsigned long long) state->resyncs, (unsigned long long) state->bytes_skipped);
+}
@@ -0,0 +1,55 @@
+#ifndef __resync_h
+#define __resync_h
+
+/* Number of sync bytes in a row, at the packet size stride, needed to trust a new alignment */
+#define RESYNC_LOCK_PACKETS 3
+
+/* Largest amount of data resync_decode() may leave unconsumed */
+#define RESYNC_CARRY_SIZE(packet_size) (RESYNC_LOCK_PACKETS * (packet_size))
+
+struct resync_state {
+	uint8_t packet_size;
+	/* False while looking for a new alignment */
+	bool in_sync;
+	/* Number of times sync was lost */
+	uint64_t resyncs;
+	/* Bytes discarded while looking for a new alignment */
+	uint64_t bytes_skipped;
+	uint64_t last_bytes_skipped;
+};
+
+/**
+ * resync_init - Initializes the synchronization state of a backend.
+ *
+ * @state: the state.
+ * @packet_size: size of the TS packets (188, 204 or 208 bytes).
+ */
+void resync_init(struct resync_state *state, uint8_t packet_size);
+
+/**
+ * resync_decode - Appends the packets found in a buffer to a packet vector.
+ *
+ * When a packet doesn't start with a sync byte, the data is scanned once for 
+ * RESYNC_LOCK_PACKETS sync bytes at the packet size stride and decoding resumes
+ * at the new alignment.
+ *
+ * @state: synchronization state of the backend.
+ * @buf: data read from the input.
+ * @len: length of buf.
+ * @vec: vector to append packets to. Payloads point into buf.
+ *
+ * Returns the number of bytes consumed. The remaining bytes, fewer than
+ * RESYNC_CARRY_SIZE() unless the vector is full, must be presented again with
+ * the data that follows them.
+ */
+size_t resync_decode(struct resync_state *state, const char *buf, size_t len, struct ts_packet_vec *vec);
+
+/**
+ * resync_report - Prints how many times sync was lost, if ever.
+ *
+ * @state: synchronization state of the backend.
+ * @backend_name: prefix of the message.
+ */
+void resync_report(struct resync_state *state, const char *backend_name);
+
+#endif /* __resync_h */
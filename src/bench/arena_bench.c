@@ -0,0 +1,231 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "fsutils.h"
+#include "xattr.h"
+#include "arena.h"
+#include "bench.h"
+#include <malloc.h>
+
+#define ARENA_BENCH_SECONDS  1.0
+#define ARENA_BENCH_STREAMS  16
+/* Versions alive at a time: the current one and the one being built */
+#define ARENA_BENCH_LIVE     2
+#define ARENA_CHECK_ALLOCS   2000
+#define ARENA_CHECK_VERSIONS 64
+
+/* Fields of a PMT-like table, which is what most versions look like */
+struct arena_bench_table {
+	uint8_t table_id;
+	uint8_t section_syntax_indicator;
+	uint16_t section_length;
+	uint16_t program_number;
+	uint8_t version_number;
+	uint8_t current_next_indicator;
+	uint8_t section_number;
+	uint8_t last_section_number;
+	uint16_t pcr_pid;
+	uint8_t stream_type;
+	uint16_t elementary_stream_pid;
+	uint16_t es_information_length;
+	uint8_t component_tag;
+	uint8_t descriptor_tag;
+	uint8_t descriptor_length;
+	char language[4];
+	char *language_code;
+	char descriptor[32];
+};
+
+/* Live heap bytes, or 0 if the C library can't tell */
+static uint64_t arena_bench_heap_bytes(void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * arena_bench_build - Fills a version directory with about 170 dentries, the way the
+ * PMT parser does.
+ */
+static void arena_bench_build(struct dentry *version, struct arena_bench_table *table)
+{
+	CREATE_FILE_NUMBER(version, table, table_id);
+	CREATE_FILE_NUMBER(version, table, section_syntax_indicator);
+	CREATE_FILE_NUMBER(version, table, section_length);
+	CREATE_FILE_NUMBER(version, table, program_number);
+	CREATE_FILE_NUMBER(version, table, version_number);
+	CREATE_FILE_NUMBER(version, table, current_next_indicator);
+	CREATE_FILE_NUMBER(version, table, section_number);
+	CREATE_FILE_NUMBER(version, table, last_section_number);
+	CREATE_FILE_NUMBER(version, table, pcr_pid);
+
+	for (int i=0; i<ARENA_BENCH_STREAMS; ++i) {
+		struct dentry *stream = CREATE_DIRECTORY(version, "%#04x", 0x100 + i);
+		table->elementary_stream_pid = 0x100 + i;
+		CREATE_FILE_NUMBER(stream, table, stream_type);
+		CREATE_FILE_NUMBER(stream, table, elementary_stream_pid);
+		CREATE_FILE_NUMBER(stream, table, es_information_length);
+		CREATE_FILE_NUMBER(stream, table, component_tag);
+		CREATE_FILE_NUMBER(stream, table, descriptor_tag);
+		CREATE_FILE_NUMBER(stream, table, descriptor_length);
+		CREATE_FILE_STRING(stream, table, language_code, XATTR_FORMAT_STRING);
+		CREATE_FILE_BIN(stream, table, descriptor, sizeof(table->descriptor));
+	}
+}
+
+/**
+ * arena_bench_churn - Builds 'count' versions, or as many as fit in the time budget if
+ * 'count' is 0, keeping ARENA_BENCH_LIVE of them alive. Version directories come from
+ * their own arena, or from the heap like the rest of the tree with 'use_arena' unset.
+ * Returns the number of versions built; 'heap' gets the bytes in use with the last
+ * versions alive.
+ */
+static uint64_t arena_bench_churn(bool use_arena, uint64_t count, double *elapsed, uint64_t *heap)
+{
+	struct arena_bench_table table = { .table_id = 0x02, .language_code = "por" };
+	struct dentry *root = (struct dentry *) calloc(1, sizeof(struct dentry));
+	struct dentry *versions[ARENA_BENCH_LIVE] = { NULL };
+	uint64_t built = 0, heap_before;
+	struct dentry *dir;
+	double start;
+
+	assert(root);
+	root->name = strdup("/");
+	root->mode = S_IFDIR | 0555;
+	root->obj_type = OBJ_TYPE_DIR;
+	INITIALIZE_DENTRY_UNLINKED(root);
+	INIT_LIST_HEAD(&root->list);
+	dir = CREATE_DIRECTORY(root, FS_PMT_NAME);
+	heap_before = arena_bench_heap_bytes();
+
+	start = bench_now();
+	while (count ? built < count : bench_now() - start < ARENA_BENCH_SECONDS) {
+		struct dentry **slot = &versions[built % ARENA_BENCH_LIVE];
+		if (*slot)
+			fsutils_dispose_tree(*slot);
+		table.version_number = built & 0x1f;
+		if (use_arena)
+			*slot = fsutils_create_version_dir(dir, built);
+		else
+			*slot = CREATE_DIRECTORY(dir, "Version_%llu", (unsigned long long) built);
+		arena_bench_build(*slot, &table);
+		epoch_reclaim();
+		built++;
+	}
+	*elapsed = bench_now() - start;
+	*heap = arena_bench_heap_bytes() - heap_before;
+
+	fsutils_dispose_tree(root);
+	epoch_reclaim();
+	return built;
+}
+
+/**
+ * arena_bench_check_alloc - Allocations must be aligned, zeroed and must not overlap,
+ * including the ones larger than a chunk.
+ */
+static int arena_bench_check_alloc(void)
+{
+	struct arena *arena = arena_new();
+	uint8_t **ptrs = (uint8_t **) calloc(ARENA_CHECK_ALLOCS, sizeof(uint8_t *));
+	size_t *sizes = (size_t *) calloc(ARENA_CHECK_ALLOCS, sizeof(size_t));
+	int ret = 0;
+
+	assert(ptrs && sizes);
+	arena_get(arena);
+	for (int i=0; i<ARENA_CHECK_ALLOCS && ret == 0; ++i) {
+		sizes[i] = i % 97 ? bench_random() % 256 : bench_random() % (2 * ARENA_MAX_CHUNK);
+		ptrs[i] = (uint8_t *) arena_alloc(arena, sizes[i]);
+		if ((uintptr_t) ptrs[i] & 15)
+			ret = -1;
+		for (size_t j=0; j<sizes[i] && ret == 0; ++j)
+			if (ptrs[i][j])
+				ret = -1;
+		memset(ptrs[i], i & 0xff, sizes[i]);
+	}
+	for (int i=0; i<ARENA_CHECK_ALLOCS && ret == 0; ++i)
+		for (size_t j=0; j<sizes[i] && ret == 0; ++j)
+			if (ptrs[i][j] != (i & 0xff))
+				ret = -1;
+	if (ret < 0)
+		fprintf(stderr, "arena: allocation is misaligned, not zeroed or overlapping\n");
+
+	arena_put(arena);
+	free(ptrs);
+	free(sizes);
+	return ret;
+}
+
+/**
+ * arena_bench_check - Checks the allocator, then churns through versions and verifies
+ * that each arena goes away with the last dentry allocated from it.
+ */
+static int arena_bench_check(void)
+{
+	struct arena_stats before, after;
+	uint64_t heap;
+	double elapsed;
+
+	if (arena_bench_check_alloc() < 0)
+		return -1;
+
+	arena_get_stats(&before);
+	arena_bench_churn(true, ARENA_CHECK_VERSIONS, &elapsed, &heap);
+	arena_get_stats(&after);
+	if (after.arenas != before.arenas || after.bytes_reserved != before.bytes_reserved) {
+		fprintf(stderr, "arena: %llu arenas and %llu bytes leaked\n",
+			(unsigned long long) (after.arenas - before.arenas),
+			(unsigned long long) (after.bytes_reserved - before.bytes_reserved));
+		return -1;
+	}
+	return 0;
+}
+
+int arena_bench(bool check_only)
+{
+	uint64_t versions, heap;
+	double elapsed;
+
+	if (arena_bench_check() < 0)
+		return -1;
+	if (check_only)
+		return 0;
+
+	versions = arena_bench_churn(false, 0, &elapsed, &heap);
+	bench_report("arena", "heap/version", versions, 0, elapsed);
+	bench_report_bytes("arena", "heap/live", heap);
+
+	versions = arena_bench_churn(true, 0, &elapsed, &heap);
+	bench_report("arena", "arena/version", versions, 0, elapsed);
+	bench_report_bytes("arena", "arena/live", heap);
+	return 0;
+}
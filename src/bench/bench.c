@@ -0,0 +1,135 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "bench.h"
+#include <time.h>
+
+static struct bench_scenario scenarios[] = {
+	{ "crc32",  crc32_bench },
+	{ "hash",   hash_bench },
+	{ "dir",    dir_bench },
+	{ "arena",  arena_bench },
+	{ "number", number_bench },
+	{ NULL, NULL }
+};
+
+static uint32_t bench_seed = 0x2545f491;
+
+double bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+uint32_t bench_random(void)
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+	return bench_seed;
+}
+
+void bench_report(const char *scenario, const char *variant, uint64_t ops, 
+		uint64_t bytes, double seconds)
+{
+	printf("%-8s %-32s %12.1f ns/op", scenario, variant, seconds * 1e9 / ops);
+	if (bytes)
+		printf(" %10.1f MB/s", bytes / seconds / (1024 * 1024));
+	printf("\n");
+}
+
+void bench_report_bytes(const char *scenario, const char *variant, uint64_t bytes)
+{
+	if (bytes)
+		printf("%-8s %-32s %12llu bytes\n", scenario, variant, (unsigned long long) bytes);
+	else
+		printf("%-8s %-32s not measured\n", scenario, variant);
+}
+
+/* The bench doesn't link main.c, which provides the FUSE init and destroy callbacks */
+void demuxfs_init(void *data, struct fuse_conn_info *conn)
+{
+}
+
+void demuxfs_destroy(void *data)
+{
+}
+
+static void usage(const char *progname)
+{
+	struct bench_scenario *scenario;
+
+	fprintf(stderr, "Usage: %s [--check] [scenario...]\n\n", progname);
+	fprintf(stderr, "  --check    only verify that the variants of each scenario agree\n\n");
+	fprintf(stderr, "Scenarios:");
+	for (scenario=scenarios; scenario->name; ++scenario)
+		fprintf(stderr, " %s", scenario->name);
+	fprintf(stderr, "\n");
+}
+
+static bool selected(const char *name, int argc, char **argv, int first)
+{
+	if (first == argc)
+		return true;
+	for (int i=first; i<argc; ++i)
+		if (! strcmp(argv[i], name))
+			return true;
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_scenario *scenario;
+	bool check_only = false;
+	int i, failed = 0;
+
+	/* Show each result as soon as it's measured, even when redirected */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (i=1; i<argc && argv[i][0] == '-'; ++i) {
+		if (! strcmp(argv[i], "--check"))
+			check_only = true;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (scenario=scenarios; scenario->name; ++scenario) {
+		if (! selected(scenario->name, argc, argv, i))
+			continue;
+		if (scenario->run(check_only) < 0) {
+			fprintf(stderr, "%s: check failed\n", scenario->name);
+			failed++;
+		} else if (check_only)
+			printf("%-8s ok\n", scenario->name);
+	}
+	return failed ? 1 : 0;
+}
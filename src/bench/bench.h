@@ -0,0 +1,44 @@
+#ifndef __bench_h
+#define __bench_h
+
+/**
+ * Microbenchmarks for the hot paths of the filesystem. Each scenario either measures
+ * its variants or, in check mode, only verifies that they agree with each other.
+ * Scenarios return 0 on success and -1 when a check fails.
+ */
+struct bench_scenario {
+	const char *name;
+	int (*run)(bool check_only);
+};
+
+/**
+ * bench_now - Returns a monotonic timestamp, in seconds.
+ */
+double bench_now(void);
+
+/**
+ * bench_random - Returns the next number of a deterministic pseudo-random sequence, so
+ * that runs are comparable with each other.
+ */
+uint32_t bench_random(void);
+
+/**
+ * bench_report - Prints the cost of a variant. Throughput is only printed when 'bytes'
+ * is not zero.
+ */
+void bench_report(const char *scenario, const char *variant, uint64_t ops, 
+		uint64_t bytes, double seconds);
+
+/**
+ * bench_report_bytes - Prints a memory footprint. A zero footprint is reported as not
+ * measured.
+ */
+void bench_report_bytes(const char *scenario, const char *variant, uint64_t bytes);
+
+int crc32_bench(bool check_only);
+int hash_bench(bool check_only);
+int dir_bench(bool check_only);
+int arena_bench(bool check_only);
+int number_bench(bool check_only);
+
+#endif /* __bench_h */
@@ -0,0 +1,126 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "crc32.h"
+#include "bench.h"
+
+/* Sections are at most 4096 bytes long; PSI sections are limited to 1024 bytes */
+#define CRC32_BENCH_MAX_LEN   4096
+#define CRC32_BENCH_MAX_ALIGN 16
+#define CRC32_CHECK_ROUNDS    4096
+#define CRC32_BENCH_BYTES     (64 * 1024 * 1024)
+
+static const struct {
+	enum crc32_kernel kernel;
+	const char *name;
+} crc32_kernels[] = {
+	{ CRC32_BITWISE,  "bitwise" },
+	{ CRC32_BYTEWISE, "bytewise" },
+	{ CRC32_SLICE8,   "slice-by-8" },
+	{ CRC32_CLMUL,    "pclmul" },
+};
+
+#define CRC32_KERNELS (sizeof(crc32_kernels) / sizeof(crc32_kernels[0]))
+
+/**
+ * crc32_bench_check - Compares every supported kernel against the bitwise reference on
+ * random lengths and alignments.
+ */
+static int crc32_bench_check(const char *buf)
+{
+	uint32_t expected, remainder;
+
+	/* CRC-32/MPEG-2 check value, with no final XOR */
+	crc32_compute(CRC32_BITWISE, "123456789", 9, &expected);
+	if (expected != 0x0376e6e7) {
+		fprintf(stderr, "crc32: bitwise reference returned %#x\n", expected);
+		return -1;
+	}
+
+	for (int round=0; round<CRC32_CHECK_ROUNDS; ++round) {
+		uint32_t offset = bench_random() % CRC32_BENCH_MAX_ALIGN;
+		/* Favour short lengths, which exercise the tails of the wide kernels */
+		uint32_t len = bench_random() % (round & 1 ? CRC32_BENCH_MAX_LEN : 256);
+
+		crc32_compute(CRC32_BITWISE, buf + offset, len, &expected);
+		for (size_t i=1; i<CRC32_KERNELS; ++i) {
+			if (! crc32_compute(crc32_kernels[i].kernel, buf + offset, len, &remainder))
+				continue;
+			if (remainder != expected) {
+				fprintf(stderr, "crc32: %s returned %#x instead of %#x (offset=%u, len=%u)\n",
+					crc32_kernels[i].name, remainder, expected, offset, len);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int crc32_bench(bool check_only)
+{
+	static const uint32_t lengths[] = { 188, 1024, 4096 };
+	char *buf = malloc(CRC32_BENCH_MAX_LEN + CRC32_BENCH_MAX_ALIGN);
+	volatile uint32_t sink = 0;
+	int ret;
+
+	assert(buf);
+	crc32_init();
+	for (uint32_t i=0; i<CRC32_BENCH_MAX_LEN + CRC32_BENCH_MAX_ALIGN; ++i)
+		buf[i] = bench_random();
+
+	ret = crc32_bench_check(buf);
+	if (ret < 0 || check_only) {
+		free(buf);
+		return ret;
+	}
+
+	for (size_t i=0; i<CRC32_KERNELS; ++i) {
+		for (size_t j=0; j<sizeof(lengths)/sizeof(lengths[0]); ++j) {
+			uint32_t remainder, len = lengths[j];
+			/* The bitwise kernel is too slow to be given the same amount of work */
+			uint64_t ops = CRC32_BENCH_BYTES / len / (crc32_kernels[i].kernel == CRC32_BITWISE ? 16 : 1);
+			char variant[64];
+			double start;
+
+			if (! crc32_compute(crc32_kernels[i].kernel, buf, len, &remainder)) {
+				printf("%-8s %-32s unsupported\n", "crc32", crc32_kernels[i].name);
+				break;
+			}
+			start = bench_now();
+			for (uint64_t n=0; n<ops; ++n) {
+				crc32_compute(crc32_kernels[i].kernel, buf, len, &remainder);
+				sink += remainder;
+			}
+			snprintf(variant, sizeof(variant), "%s/%u", crc32_kernels[i].name, len);
+			bench_report("crc32", variant, ops, ops * len, bench_now() - start);
+		}
+	}
+	free(buf);
+	return 0;
+}
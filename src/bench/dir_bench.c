@@ -0,0 +1,219 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "fsutils.h"
+#include "bench.h"
+
+#define DIR_BENCH_SECONDS 0.5
+
+/* Names in the style of DDB blocks, which make up the widest directories */
+static void dir_bench_name(char *buf, size_t size, uint32_t i)
+{
+	snprintf(buf, size, "block_%05u", i);
+}
+
+static struct dentry *dir_bench_root(void)
+{
+	struct dentry *root = (struct dentry *) calloc(1, sizeof(struct dentry));
+	assert(root);
+	root->name = strdup("/");
+	root->mode = S_IFDIR | 0555;
+	root->obj_type = OBJ_TYPE_DIR;
+	INITIALIZE_DENTRY_UNLINKED(root);
+	INIT_LIST_HEAD(&root->list);
+	return root;
+}
+
+/* Adds a file the way the CREATE_FILE_* macros do, looking it up first */
+static struct dentry *dir_bench_create(struct dentry *parent, const char *name)
+{
+	struct dentry *dentry = fsutils_get_child(parent, name);
+	if (! dentry) {
+		dentry = fsutils_new_dentry(parent);
+		dentry->name = fsutils_strdup(dentry, name);
+		dentry->mode = S_IFREG | 0444;
+		dentry->obj_type = OBJ_TYPE_FILE;
+		CREATE_COMMON(parent, dentry);
+	}
+	return dentry;
+}
+
+/* What fsutils_get_child() did before directories were indexed */
+static struct dentry *dir_bench_scan(struct dentry *parent, const char *name)
+{
+	struct dentry *ptr;
+	list_for_each_entry(ptr, &parent->children, list)
+		if (! strcmp(ptr->name, name))
+			return ptr;
+	return NULL;
+}
+
+static void dir_bench_destroy(struct dentry *root)
+{
+	fsutils_dispose_tree(root);
+	epoch_reclaim();
+}
+
+/* Every name in [0, n) must resolve to the same dentry through the index and the list */
+static int dir_bench_compare(struct dentry *dir, uint32_t n)
+{
+	char name[32];
+
+	for (uint32_t i=0; i<n; ++i) {
+		dir_bench_name(name, sizeof(name), i);
+		if (fsutils_get_child(dir, name) != dir_bench_scan(dir, name)) {
+			fprintf(stderr, "dir: lookup of '%s' disagrees with the children list "
+				"(%u children)\n", name, dir->num_children);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * dir_bench_check - Grows a directory past the index threshold, renames and removes 
+ * random children and empties it, comparing lookups against the children list.
+ */
+static int dir_bench_check(void)
+{
+	const uint32_t n = 1024;
+	struct dentry *root = dir_bench_root();
+	struct dentry *dir = CREATE_DIRECTORY(root, "dir");
+	char name[32];
+	int ret = 0;
+
+	for (uint32_t i=0; i<n && ret == 0; ++i) {
+		dir_bench_name(name, sizeof(name), i);
+		dir_bench_create(dir, name);
+		if (i % 31 == 0)
+			ret = dir_bench_compare(dir, n);
+	}
+	for (uint32_t round=0; round<4*n && ret == 0; ++round) {
+		struct dentry *dentry;
+		dir_bench_name(name, sizeof(name), bench_random() % n);
+		dentry = fsutils_get_child(dir, name);
+		if (! dentry)
+			continue;
+		if (round & 1) {
+			fsutils_dispose_node(dentry);
+		} else {
+			dir_bench_name(name, sizeof(name), bench_random() % n);
+			if (! fsutils_get_child(dir, name))
+				fsutils_rename_dentry(dentry, name);
+		}
+		if (round % 31 == 0)
+			ret = dir_bench_compare(dir, n);
+		epoch_reclaim();
+	}
+	/* Empty the directory, which drops the index along the way */
+	for (uint32_t i=0; i<n && ret == 0; ++i) {
+		struct dentry *dentry;
+		dir_bench_name(name, sizeof(name), i);
+		if ((dentry = fsutils_get_child(dir, name)))
+			fsutils_dispose_node(dentry);
+		if (dir->num_children < 64 || i % 31 == 0)
+			ret = dir_bench_compare(dir, n);
+		epoch_reclaim();
+	}
+	if (ret == 0 && (dir->num_children || dir->index)) {
+		fprintf(stderr, "dir: %u children left behind\n", dir->num_children);
+		ret = -1;
+	}
+
+	dir_bench_destroy(root);
+	return ret;
+}
+
+static void dir_bench_run(uint32_t n)
+{
+	double build = 0, hit = 0, miss = 0, scan_hit = 0, scan_miss = 0, start;
+	volatile uintptr_t sink = 0;
+	uint64_t rounds = 0;
+	char (*names)[32] = malloc(2 * n * sizeof(*names));
+	char variant[64];
+
+	assert(names);
+	for (uint32_t i=0; i<2*n; ++i)
+		dir_bench_name(names[i], sizeof(names[i]), i);
+
+	while (build + hit + miss + scan_hit + scan_miss < DIR_BENCH_SECONDS) {
+		struct dentry *root = dir_bench_root();
+		struct dentry *dir = CREATE_DIRECTORY(root, "dir");
+
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			dir_bench_create(dir, names[i]);
+		build += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			sink += (uintptr_t) fsutils_get_child(dir, names[(i * 7919) % n]);
+		hit += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=n; i<2*n; ++i)
+			sink += (uintptr_t) fsutils_get_child(dir, names[i]);
+		miss += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			sink += (uintptr_t) dir_bench_scan(dir, names[(i * 7919) % n]);
+		scan_hit += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=n; i<2*n; ++i)
+			sink += (uintptr_t) dir_bench_scan(dir, names[i]);
+		scan_miss += bench_now() - start;
+
+		dir_bench_destroy(root);
+		rounds++;
+	}
+	free(names);
+
+	snprintf(variant, sizeof(variant), "%u/create", n);
+	bench_report("dir", variant, rounds * n, 0, build);
+	snprintf(variant, sizeof(variant), "%u/get_child/hit", n);
+	bench_report("dir", variant, rounds * n, 0, hit);
+	snprintf(variant, sizeof(variant), "%u/get_child/miss", n);
+	bench_report("dir", variant, rounds * n, 0, miss);
+	snprintf(variant, sizeof(variant), "%u/list/hit", n);
+	bench_report("dir", variant, rounds * n, 0, scan_hit);
+	snprintf(variant, sizeof(variant), "%u/list/miss", n);
+	bench_report("dir", variant, rounds * n, 0, scan_miss);
+}
+
+int dir_bench(bool check_only)
+{
+	static const uint32_t sizes[] = { 16, 64, 1024, 4096 };
+
+	if (dir_bench_check() < 0)
+		return -1;
+	if (check_only)
+		return 0;
+
+	for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i)
+		dir_bench_run(sizes[i]);
+	return 0;
+}
@@ -0,0 +1,288 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "hash.h"
+#include "bench.h"
+
+#define HASH_CHECK_KEYS    2048
+#define HASH_CHECK_ROUNDS  200000
+#define HASH_BENCH_SECONDS 0.5
+
+/**
+ * The table this one replaced: a fixed number of slots holding pointers to items
+ * allocated one at a time, indexed by the key modulo the table size. Kept here as
+ * the baseline of the measurements. Its deletions cut probe chains short instead of
+ * repairing them, so they are cheaper than they should be.
+ */
+struct legacy_table {
+	int size;
+	struct hash_item **items;
+};
+
+/* The legacy table doesn't grow: give it the load factor the new one ends up with */
+static void *legacy_new(uint32_t n)
+{
+	struct legacy_table *table = (struct legacy_table *) calloc(1, sizeof(struct legacy_table));
+	assert(table);
+	table->size = n * 2;
+	table->items = (struct hash_item **) calloc(table->size, sizeof(struct hash_item *));
+	assert(table->items);
+	return table;
+}
+
+static void legacy_destroy(void *ptr)
+{
+	struct legacy_table *table = (struct legacy_table *) ptr;
+	for (int i=0; i<table->size; ++i)
+		free(table->items[i]);
+	free(table->items);
+	free(table);
+}
+
+static void *legacy_get(void *ptr, ino_t key)
+{
+	struct legacy_table *table = (struct legacy_table *) ptr;
+	int index = key % table->size;
+	struct hash_item *item = table->items[index];
+	struct hash_item *start = item;
+	do {
+		if (! item)
+			return NULL;
+		else if (item->key == key)
+			return item->data;
+		index = (index+1) % table->size;
+		item = table->items[index];
+	} while (item != start);
+	return NULL;
+}
+
+static void legacy_add(void *ptr, ino_t key, void *data)
+{
+	struct legacy_table *table = (struct legacy_table *) ptr;
+	int index = key % table->size;
+	struct hash_item *item = table->items[index];
+	struct hash_item *start = item;
+	do {
+		if (item == NULL) {
+			item = (struct hash_item *) calloc(1, sizeof(struct hash_item));
+			assert(item);
+			item->key = key;
+			item->data = data;
+			table->items[index] = item;
+			return;
+		} else if (item->key == key) {
+			item->data = data;
+			return;
+		}
+		index = (index+1) % table->size;
+		item = table->items[index];
+	} while (item != start);
+}
+
+static void legacy_del(void *ptr, ino_t key)
+{
+	struct legacy_table *table = (struct legacy_table *) ptr;
+	int index = key % table->size;
+	struct hash_item *item = table->items[index];
+	struct hash_item *start = item;
+	do {
+		if (! item)
+			return;
+		else if (item->key == key) {
+			free(item);
+			table->items[index] = NULL;
+			return;
+		}
+		index = (index+1) % table->size;
+		item = table->items[index];
+	} while (item != start);
+}
+
+/* Keys of the section cache: PID, table id, table id extension and section number */
+static ino_t section_key(uint32_t i)
+{
+	return ((ino_t) (i % 8191) << 32) | ((ino_t) (0x40 + i % 3) << 24) | ((i / 8191) << 8) | (i & 0x7);
+}
+
+/* Keys of the inode index: dentry addresses */
+static ino_t inode_key(uint32_t i)
+{
+	return 0x7f3a00000000ULL + (ino_t) i * sizeof(struct dentry);
+}
+
+/**
+ * hash_bench_check - Runs random insertions, lookups and deletions against a plain 
+ * array of the keys which should be present.
+ */
+static int hash_bench_check(ino_t (*key_of)(uint32_t))
+{
+	struct hash_table *table = hashtable_new(16);
+	void **expected = (void **) calloc(HASH_CHECK_KEYS, sizeof(void *));
+	int present = 0, ret = 0;
+
+	assert(expected);
+	for (int round=0; round<HASH_CHECK_ROUNDS && ret == 0; ++round) {
+		uint32_t i = bench_random() % HASH_CHECK_KEYS;
+		ino_t key = key_of(i);
+		void *data;
+
+		switch (bench_random() % 3) {
+			case 0:
+				/* Overwriting is legal but logged: only add missing keys */
+				if (expected[i])
+					break;
+				data = (void *) (uintptr_t) (round + 1);
+				if (! hashtable_add(table, key, data, NULL))
+					ret = -1;
+				present++;
+				expected[i] = data;
+				break;
+			case 1:
+				if (! hashtable_del(table, key))
+					ret = -1;
+				present -= expected[i] ? 1 : 0;
+				expected[i] = NULL;
+				break;
+			default:
+				if (hashtable_get(table, key) != expected[i])
+					ret = -1;
+				break;
+		}
+		if (table->count != present)
+			ret = -1;
+	}
+	for (uint32_t i=0; i<HASH_CHECK_KEYS && ret == 0; ++i)
+		if (hashtable_get(table, key_of(i)) != expected[i])
+			ret = -1;
+
+	hashtable_destroy(table, NULL);
+	free(expected);
+	return ret;
+}
+
+/* Both tables, behind the same interface */
+struct hash_bench_ops {
+	const char *name;
+	void *(*new)(uint32_t n);
+	void (*add)(void *table, ino_t key, void *data);
+	void *(*get)(void *table, ino_t key);
+	void (*del)(void *table, ino_t key);
+	void (*destroy)(void *table);
+};
+
+static void *open_new(uint32_t n)
+{
+	return hashtable_new(16);
+}
+
+static void open_add(void *table, ino_t key, void *data)
+{
+	hashtable_add((struct hash_table *) table, key, data, NULL);
+}
+
+static void *open_get(void *table, ino_t key)
+{
+	return hashtable_get((struct hash_table *) table, key);
+}
+
+static void open_del(void *table, ino_t key)
+{
+	hashtable_del((struct hash_table *) table, key);
+}
+
+static void open_destroy(void *table)
+{
+	hashtable_destroy((struct hash_table *) table, NULL);
+}
+
+static const struct hash_bench_ops hash_bench_tables[] = {
+	{ "open", open_new, open_add, open_get, open_del, open_destroy },
+	{ "legacy", legacy_new, legacy_add, legacy_get, legacy_del, legacy_destroy },
+};
+
+/**
+ * hash_bench_run - Fills a table with 'n' keys, looks each of them up, looks up 'n'
+ * missing keys and deletes the keys again. Rounds are repeated for HASH_BENCH_SECONDS,
+ * as the legacy table degrades quadratically with some key patterns.
+ */
+static void hash_bench_run(const struct hash_bench_ops *ops, const char *keys, 
+		ino_t (*key_of)(uint32_t), uint32_t n)
+{
+	static const char *phases[] = { "insert", "hit", "miss", "delete" };
+	double elapsed[4] = { 0, 0, 0, 0 }, start, total = 0;
+	volatile uintptr_t sink = 0;
+	uint64_t rounds = 0;
+	char variant[64];
+
+	while (total < HASH_BENCH_SECONDS) {
+		void *table = ops->new(n);
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			ops->add(table, key_of(i), (void *) (uintptr_t) (i + 1));
+		elapsed[0] += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			sink += (uintptr_t) ops->get(table, key_of(i));
+		elapsed[1] += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=n; i<2*n; ++i)
+			sink += (uintptr_t) ops->get(table, key_of(i));
+		elapsed[2] += bench_now() - start;
+		start = bench_now();
+		for (uint32_t i=0; i<n; ++i)
+			ops->del(table, key_of(i));
+		elapsed[3] += bench_now() - start;
+		ops->destroy(table);
+
+		total = elapsed[0] + elapsed[1] + elapsed[2] + elapsed[3];
+		rounds++;
+	}
+	for (int i=0; i<4; ++i) {
+		snprintf(variant, sizeof(variant), "%s/%s/%u/%s", ops->name, keys, n, phases[i]);
+		bench_report("hash", variant, rounds * n, 0, elapsed[i]);
+	}
+}
+
+int hash_bench(bool check_only)
+{
+	static const uint32_t sizes[] = { 64, 1024, 8192 };
+
+	if (hash_bench_check(section_key) < 0 || hash_bench_check(inode_key) < 0)
+		return -1;
+	if (check_only)
+		return 0;
+
+	for (size_t i=0; i<sizeof(hash_bench_tables)/sizeof(hash_bench_tables[0]); ++i) {
+		for (size_t j=0; j<sizeof(sizes)/sizeof(sizes[0]); ++j) {
+			hash_bench_run(&hash_bench_tables[i], "section", section_key, sizes[j]);
+			hash_bench_run(&hash_bench_tables[i], "inode", inode_key, sizes[j]);
+		}
+	}
+	return 0;
+}
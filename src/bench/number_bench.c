@@ -0,0 +1,201 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "fsutils.h"
+#include "arena.h"
+#include "bench.h"
+
+#define NUMBER_BENCH_SECONDS 0.5
+#define NUMBER_BENCH_FILES   64
+#define NUMBER_CHECK_FILES   256
+
+/* File names must outlive the numeric files, which only point to them */
+static char number_bench_names[NUMBER_BENCH_FILES][16];
+static uint64_t number_bench_values[NUMBER_BENCH_FILES];
+
+static struct dentry *number_bench_root(void)
+{
+	struct dentry *root = (struct dentry *) calloc(1, sizeof(struct dentry));
+
+	assert(root);
+	root->name = strdup("/");
+	root->mode = S_IFDIR | 0555;
+	root->obj_type = OBJ_TYPE_DIR;
+	INITIALIZE_DENTRY_UNLINKED(root);
+	INIT_LIST_HEAD(&root->list);
+	return root;
+}
+
+/* A numeric file as a full dentry, which is how they used to be stored */
+static struct dentry *number_bench_create_full(struct dentry *parent, const char *name,
+		uint64_t value)
+{
+	struct dentry *dentry = fsutils_new_dentry(parent);
+
+	dentry->name = (char *) name;
+	dentry->size = snprintf(NULL, 0, "%#04llx", (unsigned long long) value);
+	dentry->mode = S_IFREG | 0444;
+	dentry->obj_type = OBJ_TYPE_FILE;
+	CREATE_COMMON(parent, dentry);
+	return dentry;
+}
+
+/**
+ * number_bench_fill - Builds version directories of NUMBER_BENCH_FILES numeric files
+ * until the time budget runs out, with compact nodes or with full dentries.
+ * Returns the number of files built; 'bytes' gets the arena bytes each one takes.
+ */
+static uint64_t number_bench_fill(bool compact, double *elapsed, uint64_t *bytes)
+{
+	struct dentry *root = number_bench_root();
+	struct dentry *dir = CREATE_DIRECTORY(root, FS_PMT_NAME);
+	struct arena_stats before, after;
+	uint64_t files = 0;
+	double start;
+
+	start = bench_now();
+	while (bench_now() - start < NUMBER_BENCH_SECONDS) {
+		struct dentry *version = fsutils_create_version_dir(dir, files / NUMBER_BENCH_FILES);
+
+		arena_get_stats(&before);
+		for (int i=0; i<NUMBER_BENCH_FILES; ++i) {
+			if (compact)
+				fsutils_create_number(version, number_bench_names[i], number_bench_values[i]);
+			else
+				number_bench_create_full(version, number_bench_names[i], number_bench_values[i]);
+		}
+		arena_get_stats(&after);
+		*bytes = (after.bytes_used - before.bytes_used) / NUMBER_BENCH_FILES;
+		fsutils_dispose_tree(version);
+		epoch_reclaim();
+		files += NUMBER_BENCH_FILES;
+	}
+	*elapsed = bench_now() - start;
+
+	fsutils_dispose_tree(root);
+	epoch_reclaim();
+	return files;
+}
+
+/* The directory size is the sum of the text sizes of its numeric files */
+static int number_bench_check_size(struct dentry *dir, uint64_t *values, int count)
+{
+	char buf[32];
+	ssize_t size = 0;
+
+	for (int i=0; i<count; ++i)
+		size += snprintf(buf, sizeof(buf), "%#04llx", (unsigned long long) values[i]);
+	if (dir->size != size) {
+		fprintf(stderr, "number: directory size is %zd, expected %zd\n", dir->size, size);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * number_bench_check - Numeric files must be found by name, read back as the text of
+ * their value, keep their parent's size up to date and release their arena.
+ */
+static int number_bench_check(void)
+{
+	struct dentry *root = number_bench_root();
+	struct dentry *dir = CREATE_DIRECTORY(root, FS_PMT_NAME);
+	struct dentry *version = fsutils_create_version_dir(dir, 0);
+	char names[NUMBER_CHECK_FILES][16], buf[32], expected[32];
+	uint64_t values[NUMBER_CHECK_FILES];
+	struct arena_stats before, after;
+	int ret = 0;
+
+	arena_get_stats(&before);
+	for (int i=0; i<NUMBER_CHECK_FILES; ++i) {
+		snprintf(names[i], sizeof(names[i]), "field_%d", i);
+		values[i] = bench_random() >> (i % 32);
+		fsutils_create_number(version, names[i], values[i]);
+	}
+	ret = number_bench_check_size(version, values, NUMBER_CHECK_FILES);
+
+	for (int round=0; round<4 && ret == 0; ++round) {
+		for (int i=0; i<NUMBER_CHECK_FILES && ret == 0; ++i) {
+			struct dentry *dentry = fsutils_get_child(version, names[i]);
+
+			if (! dentry || ! DEMUXFS_IS_NUMBER(dentry) || fsutils_get_child(dentry, "x")) {
+				fprintf(stderr, "number: '%s' not found or not a numeric file\n", names[i]);
+				ret = -1;
+				break;
+			}
+			snprintf(expected, sizeof(expected), "%#04llx", (unsigned long long) values[i]);
+			if (fsutils_format_number(dentry, buf, sizeof(buf)) != (int) strlen(expected) ||
+				strcmp(buf, expected) || fsutils_get_size(dentry) != (ssize_t) strlen(expected)) {
+				fprintf(stderr, "number: '%s' reads '%s', expected '%s'\n", names[i], buf, expected);
+				ret = -1;
+				break;
+			}
+			values[i] = (uint64_t) bench_random() << (bench_random() % 32);
+			fsutils_update_number(dentry, values[i]);
+		}
+		if (ret == 0)
+			ret = number_bench_check_size(version, values, NUMBER_CHECK_FILES);
+	}
+
+	fsutils_dispose_tree(root);
+	epoch_reclaim();
+	arena_get_stats(&after);
+	if (ret == 0 && after.arenas != before.arenas - 1) {
+		fprintf(stderr, "number: the version's arena was not released\n");
+		ret = -1;
+	}
+	return ret;
+}
+
+int number_bench(bool check_only)
+{
+	uint64_t files, bytes;
+	double elapsed;
+
+	if (number_bench_check() < 0)
+		return -1;
+	if (check_only)
+		return 0;
+
+	for (int i=0; i<NUMBER_BENCH_FILES; ++i) {
+		snprintf(number_bench_names[i], sizeof(number_bench_names[i]), "field_%d", i);
+		number_bench_values[i] = bench_random() >> (i % 32);
+	}
+
+	bench_report_bytes("number", "dentry/sizeof", sizeof(struct dentry));
+	files = number_bench_fill(false, &elapsed, &bytes);
+	bench_report("number", "dentry/create", files, 0, elapsed);
+	bench_report_bytes("number", "dentry/file", bytes);
+
+	bench_report_bytes("number", "compact/sizeof", sizeof(struct dentry_number));
+	files = number_bench_fill(true, &elapsed, &bytes);
+	bench_report("number", "compact/create", files, 0, elapsed);
+	bench_report_bytes("number", "compact/file", bytes);
+	return 0;
+}
@@ -63,7 +63,6 @@ struct buffer *buffer_create(uint16_t pid, size_t size, bool pes_data)
 	buffer->pid = pid;
 	buffer->max_size = size;
 	buffer->current_size = 0;
-	buffer->continuity_counter = 0;
 	buffer->holds_pes_data = pes_data;
 	return buffer;
 }
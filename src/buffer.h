@@ -9,7 +9,6 @@ struct buffer {
 	uint16_t pid;
 	size_t max_size;
 	size_t current_size;
-	uint8_t continuity_counter;
 	bool holds_pes_data;
 	bool pes_unbounded_data;
 };
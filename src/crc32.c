@@ -30,45 +30,241 @@
 #include "buffer.h"
 #include "crc32.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_HAVE_CLMUL
+#endif
+
 #define WIDTH 32
-#define TOPBIT (1<<(WIDTH-1))
+#define TOPBIT (1U<<(WIDTH-1))
 #define POLYNOMIAL 0x04C11DB7
 #define INITIAL_REMAINDER 0xFFFFFFFF
 
 #define TABLE_SIZE 256
-static uint32_t crc32_table[TABLE_SIZE];
+#define TABLE_SLICES 8
+
+/* crc32_table[0] is the classic byte-wise table. Slice n advances a byte n positions further */
+static uint32_t crc32_table[TABLE_SLICES][TABLE_SIZE];
+
+typedef uint32_t (*crc32_function_t)(uint32_t remainder, const uint8_t *buf, uint32_t len);
+static crc32_function_t crc32_update;
 
 static void crc32_init_table()
 {
 	uint16_t dividend;
 	uint32_t remainder;
+	int slice;
 
 	for (dividend=0; dividend<TABLE_SIZE; ++dividend) {
-		remainder = dividend << (WIDTH - 8);
+		remainder = (uint32_t) dividend << (WIDTH - 8);
 		for (uint8_t bit=8; bit>0; --bit) {
 			if (remainder & TOPBIT)
 				remainder = (remainder << 1) ^ POLYNOMIAL;
 			else
 				remainder = (remainder << 1);
 		}
-		crc32_table[dividend] = remainder;
+		crc32_table[0][dividend] = remainder;
+	}
+
+	for (slice=1; slice<TABLE_SLICES; ++slice) {
+		for (dividend=0; dividend<TABLE_SIZE; ++dividend) {
+			remainder = crc32_table[slice-1][dividend];
+			crc32_table[slice][dividend] = (remainder << 8) ^ crc32_table[0][remainder >> (WIDTH - 8)];
+		}
 	}
 }
 
-bool crc32_check(const char *buf, uint32_t len)
+/**
+ * crc32_update_bitwise - Reference implementation, one bit at a time and without tables.
+ */
+static uint32_t crc32_update_bitwise(uint32_t remainder, const uint8_t *buf, uint32_t len)
+{
+	while (len--) {
+		remainder ^= (uint32_t) *buf++ << (WIDTH - 8);
+		for (uint8_t bit=8; bit>0; --bit) {
+			if (remainder & TOPBIT)
+				remainder = (remainder << 1) ^ POLYNOMIAL;
+			else
+				remainder = (remainder << 1);
+		}
+	}
+	return remainder;
+}
+
+/**
+ * crc32_update_bytewise - Classic table-driven implementation, one byte per iteration.
+ */
+static uint32_t crc32_update_bytewise(uint32_t remainder, const uint8_t *buf, uint32_t len)
+{
+	while (len--) {
+		uint8_t table_idx = *buf++ ^ (remainder >> (WIDTH - 8));
+		remainder = crc32_table[0][table_idx] ^ (remainder << 8);
+	}
+	return remainder;
+}
+
+/**
+ * crc32_update_slice8 - Portable implementation, consuming 8 bytes per iteration.
+ */
+static uint32_t crc32_update_slice8(uint32_t remainder, const uint8_t *buf, uint32_t len)
+{
+	while (len >= 8) {
+		uint32_t word = remainder ^ 
+			(((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+		remainder = 
+			crc32_table[7][word >> 24] ^
+			crc32_table[6][(word >> 16) & 0xff] ^
+			crc32_table[5][(word >> 8) & 0xff] ^
+			crc32_table[4][word & 0xff] ^
+			crc32_table[3][buf[4]] ^
+			crc32_table[2][buf[5]] ^
+			crc32_table[1][buf[6]] ^
+			crc32_table[0][buf[7]];
+		buf += 8;
+		len -= 8;
+	}
+	return crc32_update_bytewise(remainder, buf, len);
+}
+
+#ifdef CRC32_HAVE_CLMUL
+/* x^n mod P(x) for the folding distances used below */
+static uint64_t crc32_k128, crc32_k192, crc32_k512, crc32_k576;
+static bool crc32_clmul_supported;
+
+static uint64_t crc32_xpow_mod(int n)
 {
-	uint32_t i, remainder = INITIAL_REMAINDER;
-	static bool table_initialized = false;
+	uint64_t remainder = 1;
+	while (n--) {
+		remainder <<= 1;
+		if (remainder & (1ULL << WIDTH))
+			remainder ^= (1ULL << WIDTH) | POLYNOMIAL;
+	}
+	return remainder;
+}
+
+/* Loads 16 bytes so that the first byte of the stream lands on the most significant bits */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_load_be(const uint8_t *buf)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) buf), bswap);
+}
+
+/* Computes x^(n+64) mod P * hi(acc) + x^n mod P * lo(acc), which is congruent to acc * x^n */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_fold(__m128i acc, __m128i k)
+{
+	__m128i hi = _mm_clmulepi64_si128(acc, k, 0x01);
+	__m128i lo = _mm_clmulepi64_si128(acc, k, 0x10);
+	return _mm_xor_si128(hi, lo);
+}
 
-	if (! table_initialized) {
-		crc32_init_table();
-		table_initialized = true;
+/**
+ * crc32_update_clmul - Carry-less multiplication implementation. The stream is folded into 
+ * 128-bit accumulators, four at a time while at least 64 bytes remain; the remaining 
+ * bytes are handled by the table-driven code.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_update_clmul(uint32_t remainder, const uint8_t *buf, uint32_t len)
+{
+	uint8_t folded[16];
+	__m128i x0, x1, x2, x3, k;
+
+	if (len < 64)
+		return crc32_update_slice8(remainder, buf, len);
+
+	/* The running remainder is equivalent to XORing it into the first 4 bytes of the stream */
+	x0 = _mm_xor_si128(crc32_load_be(buf), _mm_set_epi32(remainder, 0, 0, 0));
+	x1 = crc32_load_be(buf + 16);
+	x2 = crc32_load_be(buf + 32);
+	x3 = crc32_load_be(buf + 48);
+	buf += 64;
+	len -= 64;
+
+	k = _mm_set_epi64x(crc32_k512, crc32_k576);
+	while (len >= 64) {
+		x0 = _mm_xor_si128(crc32_fold(x0, k), crc32_load_be(buf));
+		x1 = _mm_xor_si128(crc32_fold(x1, k), crc32_load_be(buf + 16));
+		x2 = _mm_xor_si128(crc32_fold(x2, k), crc32_load_be(buf + 32));
+		x3 = _mm_xor_si128(crc32_fold(x3, k), crc32_load_be(buf + 48));
+		buf += 64;
+		len -= 64;
 	}
 
-	for (i=0; i<len; ++i) {
-		uint8_t table_idx = buf[i] ^ (remainder >> (WIDTH - 8));
-		remainder = crc32_table[table_idx] ^ (remainder << 8);
+	k = _mm_set_epi64x(crc32_k128, crc32_k192);
+	x1 = _mm_xor_si128(crc32_fold(x0, k), x1);
+	x2 = _mm_xor_si128(crc32_fold(x1, k), x2);
+	x0 = _mm_xor_si128(crc32_fold(x2, k), x3);
+	while (len >= 16) {
+		x0 = _mm_xor_si128(crc32_fold(x0, k), crc32_load_be(buf));
+		buf += 16;
+		len -= 16;
 	}
 
+	/* The remainder of the 128-bit accumulator is the CRC of its big-endian bytes */
+	_mm_storeu_si128((__m128i *) folded, crc32_load_be((const uint8_t *) &x0));
+	remainder = crc32_update_slice8(0, folded, sizeof(folded));
+	return crc32_update_slice8(remainder, buf, len);
+}
+
+static bool crc32_cpu_has_clmul()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (! __get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+#endif /* CRC32_HAVE_CLMUL */
+
+void crc32_init()
+{
+	crc32_init_table();
+	crc32_update = crc32_update_slice8;
+
+#ifdef CRC32_HAVE_CLMUL
+	crc32_k128 = crc32_xpow_mod(128);
+	crc32_k192 = crc32_xpow_mod(192);
+	crc32_k512 = crc32_xpow_mod(512);
+	crc32_k576 = crc32_xpow_mod(576);
+	crc32_clmul_supported = crc32_cpu_has_clmul();
+	if (crc32_clmul_supported)
+		crc32_update = crc32_update_clmul;
+#endif
+}
+
+bool crc32_compute(enum crc32_kernel kernel, const char *buf, uint32_t len, uint32_t *remainder)
+{
+	crc32_function_t update;
+
+	switch (kernel) {
+		case CRC32_BITWISE:
+			update = crc32_update_bitwise;
+			break;
+		case CRC32_BYTEWISE:
+			update = crc32_update_bytewise;
+			break;
+		case CRC32_SLICE8:
+			update = crc32_update_slice8;
+			break;
+#ifdef CRC32_HAVE_CLMUL
+		case CRC32_CLMUL:
+			if (! crc32_clmul_supported)
+				return false;
+			update = crc32_update_clmul;
+			break;
+#endif
+		default:
+			return false;
+	}
+	*remainder = update(INITIAL_REMAINDER, (const uint8_t *) buf, len);
+	return true;
+}
+
+bool crc32_check(const char *buf, uint32_t len)
+{
+	uint32_t remainder = crc32_update(INITIAL_REMAINDER, (const uint8_t *) buf, len);
 	return remainder ? false : true;
 }
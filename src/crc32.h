@@ -1,6 +1,31 @@
 #ifndef _crc32_h
 #define _crc32_h
 
+/**
+ * crc32_init - Builds the lookup tables and selects the fastest implementation
+ * supported by the CPU. Must be called before crc32_check().
+ */
+void crc32_init();
+
 bool crc32_check(const char *buf, uint32_t len);
 
+/* The CRC32 implementations, exposed so that they can be benchmarked and cross-checked */
+enum crc32_kernel {
+	CRC32_BITWISE,
+	CRC32_BYTEWISE,
+	CRC32_SLICE8,
+	CRC32_CLMUL,
+};
+
+/**
+ * crc32_compute - Computes the CRC32 remainder of a buffer with the given implementation.
+ * @kernel: implementation to use
+ * @buf: input buffer
+ * @len: buffer length
+ * @remainder: output remainder
+ *
+ * Returns false if the implementation is not supported by this build or CPU.
+ */
+bool crc32_compute(enum crc32_kernel kernel, const char *buf, uint32_t len, uint32_t *remainder);
+
 #endif /* _crc32_h */
@@ -33,6 +33,7 @@
 #include "hash.h"
 #include "fifo.h"
 #include "ts.h"
+#include "stats.h"
 #include "snapshot.h"
 #include "tables/descriptors/descriptors.h"
 #include "dsm-cc/descriptors/descriptors.h"
@@ -41,85 +42,227 @@
 #include "backends/filesrc.h"
 
 /* FUSE methods implemented in main.c */
-extern void * demuxfs_init(struct fuse_conn_info *conn);
+extern void demuxfs_init(void *data, struct fuse_conn_info *conn);
 extern void demuxfs_destroy(void *data);
 
-static int do_getattr(struct dentry *dentry, struct stat *stbuf)
+/* 
+ * How long the kernel may cache names and attributes, in seconds. Entries under
+ * Version_N directories don't change once published, and the parser tells the
+ * kernel when they are replaced or disposed, so they can be kept for much longer.
+ */
+#define DEMUXFS_ENTRY_TIMEOUT    1.0
+#define DEMUXFS_ATTR_TIMEOUT     1.0
+#define DEMUXFS_VERSION_TIMEOUT  3600.0
+
+/* Channel used to send invalidation notices, or NULL when not mounted */
+static struct fuse_chan *notify_chan;
+
+/* Directory listing, built on the first readdir call and served from memory afterwards */
+struct dir_handle {
+	struct dentry *dentry;
+	char *buf;
+	size_t size;
+	size_t capacity;
+};
+
+static struct dentry *demuxfs_get_dentry(fuse_req_t req, fuse_ino_t ino)
+{
+	struct demuxfs_data *priv = fuse_req_userdata(req);
+	return ino == FUSE_ROOT_ID ? priv->root : INODE_TO_DENTRY(ino);
+}
+
+static fuse_ino_t demuxfs_get_inode(fuse_req_t req, struct dentry *dentry)
+{
+	struct demuxfs_data *priv = fuse_req_userdata(req);
+	return dentry == priv->root ? FUSE_ROOT_ID : DENTRY_TO_INODE(dentry);
+}
+
+static fuse_ino_t demuxfs_notify_inode(struct dentry *dentry)
+{
+	return dentry->parent ? DENTRY_TO_INODE(dentry) : FUSE_ROOT_ID;
+}
+
+/* Hard links are other names of their target. Numeric files are never linked */
+static struct dentry *demuxfs_link_target(struct dentry *dentry)
+{
+	return DEMUXFS_IS_NUMBER(dentry) || ! dentry->hardlink ? dentry : dentry->hardlink;
+}
+
+void demuxfs_set_notify_channel(struct fuse_chan *ch)
+{
+	__atomic_store_n(&notify_chan, ch, __ATOMIC_RELEASE);
+}
+
+/**
+ * Tell the kernel to drop its cached name for a dentry which is being removed or
+ * replaced. Nothing is sent for dentries the kernel doesn't know about.
+ * @dentry: dentry, still linked to its parent
+ */
+void demuxfs_invalidate_entry(struct dentry *dentry)
+{
+	struct fuse_chan *ch = __atomic_load_n(&notify_chan, __ATOMIC_ACQUIRE);
+	struct dentry *target = demuxfs_link_target(dentry);
+
+	if (! ch || ! dentry->parent || ! __atomic_load_n(&target->nlookup, __ATOMIC_ACQUIRE))
+		return;
+	fuse_lowlevel_notify_inval_entry(ch, demuxfs_notify_inode(dentry->parent), 
+		dentry->name, strlen(dentry->name));
+}
+
+/**
+ * Tell the kernel to drop the cached attributes and pages of a dentry whose
+ * contents changed in place.
+ * @dentry: dentry
+ */
+void demuxfs_invalidate_inode(struct dentry *dentry)
+{
+	struct fuse_chan *ch = __atomic_load_n(&notify_chan, __ATOMIC_ACQUIRE);
+
+	if (! ch || ! __atomic_load_n(&dentry->nlookup, __ATOMIC_ACQUIRE))
+		return;
+	fuse_lowlevel_notify_inval_inode(ch, demuxfs_notify_inode(dentry), 0, 0);
+}
+
+/* Names under Version_N directories are stable. Directories may still gain entries. */
+static double demuxfs_entry_timeout(struct dentry *dentry)
+{
+	return dentry->versioned ? DEMUXFS_VERSION_TIMEOUT : DEMUXFS_ENTRY_TIMEOUT;
+}
+
+static double demuxfs_attr_timeout(struct dentry *dentry)
+{
+	return dentry->versioned && ! S_ISDIR(dentry->mode) ? DEMUXFS_VERSION_TIMEOUT : DEMUXFS_ATTR_TIMEOUT;
+}
+
+static void do_getattr(fuse_req_t req, struct dentry *dentry, struct stat *stbuf)
 {
 	memset(stbuf, 0, sizeof(struct stat));
-	stbuf->st_ino = dentry->inode;
+	stbuf->st_ino = demuxfs_get_inode(req, dentry);
 	stbuf->st_mode = dentry->mode;
-	stbuf->st_size = dentry->size;
-	stbuf->st_atime = dentry->atime ? dentry->ctime : time(NULL);
-	stbuf->st_ctime = dentry->ctime ? dentry->ctime : time(NULL);
-	stbuf->st_mtime = dentry->mtime ? dentry->mtime : time(NULL);
+	stbuf->st_size = fsutils_get_size(dentry);
+	if (DEMUXFS_IS_NUMBER(dentry)) {
+		stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime = time(NULL);
+	} else {
+		stbuf->st_atime = dentry->atime ? dentry->ctime : time(NULL);
+		stbuf->st_ctime = dentry->ctime ? dentry->ctime : time(NULL);
+		stbuf->st_mtime = dentry->mtime ? dentry->mtime : time(NULL);
+	}
 	stbuf->st_nlink = 1;
 	stbuf->st_blksize = 128;
 	stbuf->st_dev = DEMUXFS_SUPER_MAGIC;
 	stbuf->st_rdev = 0;
-	return 0;
 }
 
-static int demuxfs_getattr(const char *path, struct stat *stbuf)
+static void demuxfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
+	struct fuse_entry_param e;
+	struct dentry *dir = demuxfs_get_dentry(req, parent);
 	struct dentry *dentry;
 
-	dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
-	return do_getattr(dentry, stbuf);
+	/* The lookup count is raised before leaving the read-side section, so the dentry stays around until forget */
+	read_lock();
+	fsutils_lazy_get(dir);
+	dentry = fsutils_get_child(dir, name);
+	if (! dentry) {
+		fsutils_lazy_put(dir);
+		read_unlock();
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	dentry = demuxfs_link_target(dentry);
+	__atomic_add_fetch(&dentry->nlookup, 1, __ATOMIC_SEQ_CST);
+	fsutils_lazy_put(dir);
+	read_unlock();
+
+	memset(&e, 0, sizeof(e));
+	e.ino = demuxfs_get_inode(req, dentry);
+	e.attr_timeout = demuxfs_attr_timeout(dentry);
+	e.entry_timeout = demuxfs_entry_timeout(dentry);
+	do_getattr(req, dentry, &e.attr);
+	if (fuse_reply_entry(req, &e) != 0)
+		__atomic_sub_fetch(&dentry->nlookup, 1, __ATOMIC_RELEASE);
 }
 
-static int demuxfs_fgetattr(const char *path, struct stat *stbuf,
-		struct fuse_file_info *fi)
+static void demuxfs_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
 {
-	struct dentry *dentry = FILEHANDLE_TO_DENTRY(fi->fh);
-	return do_getattr(dentry, stbuf);
+	struct demuxfs_data *priv = fuse_req_userdata(req);
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+	/* Last access to the dentry: it may be released right after this */
+	if (ino != FUSE_ROOT_ID && __atomic_sub_fetch(&dentry->nlookup, nlookup, __ATOMIC_RELEASE) == 0)
+		fsutils_reclaim(priv);
+	fuse_reply_none(req);
 }
 
-static int demuxfs_open(const char *path, struct fuse_file_info *fi)
+static void demuxfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	int ret = 0;
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+	struct stat stbuf;
+
+	do_getattr(req, dentry, &stbuf);
+	fuse_reply_attr(req, &stbuf, demuxfs_attr_timeout(dentry));
+}
+
+static void demuxfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct demuxfs_data *priv = fuse_req_userdata(req);
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+
+	if (DEMUXFS_IS_STATS(dentry)) {
+		/* Statistics are rendered on open; their size is not known beforehand */
+		int ret = stats_update_dentry(dentry, priv);
+		if (ret < 0) {
+			fuse_reply_err(req, -ret);
+			return;
+		}
+		fi->direct_io = 1;
+	} else if (DEMUXFS_IS_NUMBER(dentry)) {
+		/* Numeric files have no refcount: the kernel keeps them looked up while they're open */
+		fi->keep_cache = dentry->versioned;
+		fi->fh = DENTRY_TO_FILEHANDLE(dentry);
+		fuse_reply_open(req, fi);
+		return;
+	} else if (dentry->versioned && DEMUXFS_IS_FILE(dentry)) {
+		/* Contents are final, so the page cache survives between opens */
+		fi->keep_cache = 1;
+	}
 
 	pthread_mutex_lock(&dentry->mutex);
-	dentry->refcount++;
+	__atomic_add_fetch(&dentry->refcount, 1, __ATOMIC_RELEASE);
 	fi->fh = DENTRY_TO_FILEHANDLE(dentry);
 	pthread_mutex_unlock(&dentry->mutex);
-	return ret;
+	if (fuse_reply_open(req, fi) != 0)
+		__atomic_sub_fetch(&dentry->refcount, 1, __ATOMIC_RELEASE);
 }
 
-static int demuxfs_flush(const char *path, struct fuse_file_info *fi)
+static void demuxfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	return 0;
+	fuse_reply_err(req, 0);
 }
 
-static int demuxfs_release(const char *path, struct fuse_file_info *fi)
+static void demuxfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	struct dentry *dentry = FILEHANDLE_TO_DENTRY(fi->fh);
+	if (DEMUXFS_IS_NUMBER(dentry)) {
+		fuse_reply_err(req, 0);
+		return;
+	}
 	pthread_mutex_lock(&dentry->mutex);
-	dentry->refcount--;
 	if (DEMUXFS_IS_SNAPSHOT(dentry))
 		snapshot_destroy_video_context(dentry);
 	pthread_mutex_unlock(&dentry->mutex);
-	return 0;
+	if (__atomic_sub_fetch(&dentry->refcount, 1, __ATOMIC_RELEASE) == 0)
+		fsutils_reclaim(fuse_req_userdata(req));
+	fuse_reply_err(req, 0);
 }
 
-static int demuxfs_read(const char *path, char *buf, size_t size, off_t offset, 
+static void demuxfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, 
 		struct fuse_file_info *fi)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
+	struct demuxfs_data *priv = fuse_req_userdata(req);
 	struct dentry *dentry = FILEHANDLE_TO_DENTRY(fi->fh);
 	ssize_t read_size = 0;
 	int ret = 0;
 
-	if (! dentry)
-		return -ENOENT;
-
 	if (DEMUXFS_IS_SNAPSHOT(dentry)) {
 		pthread_mutex_lock(&dentry->mutex);
 		if (! dentry->contents) {
@@ -127,7 +270,8 @@ static int demuxfs_read(const char *path, char *buf, size_t size, off_t offset,
 			ret = snapshot_init_video_context(dentry);
 			if (ret < 0) {
 				pthread_mutex_unlock(&dentry->mutex);
-				return ret;
+				fuse_reply_err(req, -ret);
+				return;
 			}
 			/* Request FFmpeg to decode a video frame out of the ES dentry lended to us */
 			ret = snapshot_save_video_frame(dentry, priv);
@@ -135,165 +279,246 @@ static int demuxfs_read(const char *path, char *buf, size_t size, off_t offset,
 		if (ret == 0 && (ssize_t) offset < dentry->size) {
 			read_size = ((dentry->size - (ssize_t) offset) > (ssize_t) size)
 				? size : dentry->size - (ssize_t) offset;
-			memcpy(buf, &dentry->contents[offset], read_size);
-		}
+			fuse_reply_buf(req, &dentry->contents[offset], read_size);
+		} else
+			fuse_reply_buf(req, NULL, 0);
 		pthread_mutex_unlock(&dentry->mutex);
+	} else if (DEMUXFS_IS_NUMBER(dentry)) {
+		char buf[32];
+		read_size = fsutils_format_number(dentry, buf, sizeof(buf));
+		if (offset < read_size)
+			fuse_reply_buf(req, &buf[offset], 
+				(read_size - (ssize_t) offset) > (ssize_t) size ? size : read_size - (ssize_t) offset);
+		else
+			fuse_reply_buf(req, NULL, 0);
 	} else if (dentry->contents && dentry->size != 0xffffff) {
 		pthread_mutex_lock(&dentry->mutex);
 		if (offset < dentry->size) {
 			read_size = ((dentry->size - (ssize_t) offset) > (ssize_t) size)
 				? size : dentry->size - (ssize_t) offset;
-			memcpy(buf, &dentry->contents[offset], read_size);
-		}
+			fuse_reply_buf(req, &dentry->contents[offset], read_size);
+		} else
+			fuse_reply_buf(req, NULL, 0);
 		pthread_mutex_unlock(&dentry->mutex);
-	}
-	return read_size;
+	} else
+		fuse_reply_buf(req, NULL, 0);
 }
 
-static int demuxfs_opendir(const char *path, struct fuse_file_info *fi)
+static void demuxfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	return demuxfs_open(path, fi);
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+	struct dir_handle *dh = (struct dir_handle *) calloc(1, sizeof(struct dir_handle));
+
+	if (! dh) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	dh->dentry = dentry;
+	__atomic_add_fetch(&dentry->refcount, 1, __ATOMIC_RELEASE);
+	fi->fh = (uint64_t)(uintptr_t) dh;
+	if (fuse_reply_open(req, fi) != 0) {
+		__atomic_sub_fetch(&dentry->refcount, 1, __ATOMIC_RELEASE);
+		free(dh);
+	}
 }
 
-static int demuxfs_releasedir(const char *path, struct fuse_file_info *fi)
+static void demuxfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	return demuxfs_release(path, fi);
+	struct dir_handle *dh = (struct dir_handle *)(uintptr_t) fi->fh;
+	if (__atomic_sub_fetch(&dh->dentry->refcount, 1, __ATOMIC_RELEASE) == 0)
+		fsutils_reclaim(fuse_req_userdata(req));
+	if (dh->buf)
+		free(dh->buf);
+	free(dh);
+	fuse_reply_err(req, 0);
 }
 
-static int demuxfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, 
-		off_t offset, struct fuse_file_info *fi)
+static int dir_handle_add(fuse_req_t req, struct dir_handle *dh, const char *name, 
+		fuse_ino_t ino, mode_t mode)
 {
-	struct dentry *dentry = FILEHANDLE_TO_DENTRY(fi->fh);
+	struct stat stbuf;
+	size_t len = fuse_add_direntry(req, NULL, 0, name, NULL, 0);
+
+	if (dh->size + len > dh->capacity) {
+		size_t capacity = dh->capacity ? dh->capacity : 4096;
+		char *buf;
+		while (dh->size + len > capacity)
+			capacity <<= 1;
+		buf = (char *) realloc(dh->buf, capacity);
+		if (! buf)
+			return -ENOMEM;
+		dh->buf = buf;
+		dh->capacity = capacity;
+	}
+	memset(&stbuf, 0, sizeof(stbuf));
+	stbuf.st_ino = ino;
+	stbuf.st_mode = mode;
+	fuse_add_direntry(req, dh->buf + dh->size, len, name, &stbuf, dh->size + len);
+	dh->size += len;
+	return 0;
+}
 
-	if (filler(buf, ".",  NULL, 0))
-		return -ENOBUFS;
-	if (filler(buf, "..", NULL, 0))
-		return -ENOBUFS;
-	if (! dentry)
-		return -ENOENT;
+static void demuxfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, 
+		struct fuse_file_info *fi)
+{
+	struct dir_handle *dh = (struct dir_handle *)(uintptr_t) fi->fh;
+	struct dentry *dentry = dh->dentry, *entry;
+	int ret = 0;
 
-	struct dentry *entry;
-	list_for_each_entry(entry, &dentry->children, list)
-		if (filler(buf, entry->name, NULL, 0))
-			return -ENOBUFS;
+	/* Take a snapshot of the children when the listing starts over */
+	if (offset == 0) {
+		dh->size = 0;
+		ret = dir_handle_add(req, dh, ".", demuxfs_get_inode(req, dentry), S_IFDIR);
+		if (ret == 0)
+			ret = dir_handle_add(req, dh, "..", dentry->parent ? 
+				demuxfs_get_inode(req, dentry->parent) : FUSE_ROOT_ID, S_IFDIR);
+		read_lock();
+		fsutils_lazy_get(dentry);
+		list_for_each_entry_rcu(entry, &dentry->children, list) {
+			if (ret < 0)
+				break;
+			ret = dir_handle_add(req, dh, entry->name, 
+				demuxfs_get_inode(req, demuxfs_link_target(entry)), entry->mode);
+		}
+		fsutils_lazy_put(dentry);
+		read_unlock();
+		if (ret < 0) {
+			fuse_reply_err(req, -ret);
+			return;
+		}
+	}
 
-	return 0;
+	if ((size_t) offset < dh->size)
+		fuse_reply_buf(req, dh->buf + offset, 
+			dh->size - offset > size ? size : dh->size - offset);
+	else
+		fuse_reply_buf(req, NULL, 0);
 }
 
-static int demuxfs_readlink(const char *path, char *buf, size_t size)
+static void demuxfs_readlink(fuse_req_t req, fuse_ino_t ino)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
-	if (dentry->mode & S_IFLNK) {
-		snprintf(buf, size, "%s", dentry->contents);
-		return 0;
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+
+	if (! S_ISLNK(dentry->mode)) {
+		fuse_reply_err(req, EINVAL);
+		return;
 	}
-	return -EINVAL;
+	/* The target may be swapped and retired by the parser, so it's copied out within the section */
+	read_lock();
+	fuse_reply_readlink(req, __atomic_load_n(&dentry->contents, __ATOMIC_ACQUIRE));
+	read_unlock();
 }
 
-static int demuxfs_access(const char *path, int mode)
+static void demuxfs_access(fuse_req_t req, fuse_ino_t ino, int mode)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
-	else if (mode & W_OK)
-		return -EACCES;
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+	int ret = 0;
+
+	if (mode & W_OK)
+		ret = EACCES;
 	else if (mode & X_OK && !S_ISDIR(dentry->mode))
-		return -EACCES;
-	return 0;
+		ret = EACCES;
+	fuse_reply_err(req, ret);
 }
 
-static int demuxfs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+static void demuxfs_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, 
+		const char *value, size_t size, int flags)
 {
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
 	int ret;
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
-
-	if (strncmp(name, "user.", 5))
-		return -EPERM;
-	else if ((flags & XATTR_CREATE) && xattr_exists(dentry, name))
-		return -EEXIST;
-	else if ((flags & XATTR_REPLACE) && !xattr_exists(dentry, name))
-		return -ENOATTR;
 
+	if (strncmp(name, "user.", 5)) {
+		fuse_reply_err(req, EPERM);
+		return;
+	} else if (DEMUXFS_IS_NUMBER(dentry)) {
+		/* Numeric files have no attribute list of their own */
+		fuse_reply_err(req, ENOTSUP);
+		return;
+	}
+
+	read_lock();
 	pthread_mutex_lock(&dentry->mutex);
-	xattr_remove(dentry, name);
-	ret = xattr_add(dentry, name, value, size, true);
+	if ((flags & XATTR_CREATE) && xattr_exists(dentry, name))
+		ret = -EEXIST;
+	else if ((flags & XATTR_REPLACE) && !xattr_exists(dentry, name))
+		ret = -ENOATTR;
+	else {
+		xattr_remove(dentry, name);
+		ret = xattr_add(dentry, name, value, size, true);
+	}
 	pthread_mutex_unlock(&dentry->mutex);
-	return ret;
+	read_unlock();
+	fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
-static int demuxfs_getxattr(const char *path, const char *name, char *value, size_t size)
+static void demuxfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
 {
-	int ret;
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
 	struct xattr *xattr;
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
 
+	/* Xattrs may be removed concurrently, so the value is copied out within the section */
 	read_lock();
 	xattr = xattr_get(dentry, name);
-	if (! xattr) {
-		ret = -ENOATTR;
-		goto out;
-	}
-	if (size == 0) {
-		ret = xattr->size;
-		goto out;
-	} else if (size < xattr->size) {
-		ret = -ERANGE;
-		goto out;
-	}
-	memcpy(value, xattr->value, xattr->size);
-	ret = xattr->size;
-out:
+	if (! xattr)
+		fuse_reply_err(req, ENOATTR);
+	else if (size == 0)
+		fuse_reply_xattr(req, xattr->size);
+	else if (size < xattr->size)
+		fuse_reply_err(req, ERANGE);
+	else
+		fuse_reply_buf(req, xattr->value, xattr->size);
 	read_unlock();
-	return ret;
 }
 
-static int demuxfs_listxattr(const char *path, char *list, size_t size)
+static void demuxfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 {
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
+	char *list = NULL;
 	int ret;
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
 	
+	if (size && ! (list = (char *) malloc(size))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
 	read_lock();
 	ret = xattr_list(dentry, list, size);
 	read_unlock();
 
-	return ret;
+	if (ret < 0)
+		fuse_reply_err(req, -ret);
+	else if (size == 0)
+		fuse_reply_xattr(req, ret);
+	else
+		fuse_reply_buf(req, list, ret);
+	if (list)
+		free(list);
 }
 
-static int demuxfs_removexattr(const char *path, const char *name)
+static void demuxfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
 {
+	struct dentry *dentry = demuxfs_get_dentry(req, ino);
 	int ret;
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
-	struct dentry *dentry = fsutils_get_dentry(priv->root, path);
-	if (! dentry)
-		return -ENOENT;
 
-	write_lock();
+	if (DEMUXFS_IS_NUMBER(dentry)) {
+		fuse_reply_err(req, ENOATTR);
+		return;
+	}
+	read_lock();
+	pthread_mutex_lock(&dentry->mutex);
 	ret = xattr_remove(dentry, name);
-	write_unlock();
-
-	return ret;
+	pthread_mutex_unlock(&dentry->mutex);
+	read_unlock();
+	fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
-struct fuse_operations demuxfs_ops = {
+struct fuse_lowlevel_ops demuxfs_ops = {
 	/* Implemented in main.c */
 	.init        = demuxfs_init,
 	.destroy     = demuxfs_destroy,
 	/* Implemented in this file */
+	.lookup      = demuxfs_lookup,
+	.forget      = demuxfs_forget,
 	.getattr     = demuxfs_getattr,
-	.fgetattr    = demuxfs_fgetattr,
 	.open        = demuxfs_open,
 	.flush       = demuxfs_flush,
 	.release     = demuxfs_release,
@@ -309,15 +534,12 @@ struct fuse_operations demuxfs_ops = {
 	.removexattr = demuxfs_removexattr,
 	.statfs      = NULL,
 	/* Not implemented on DemuxFS */
+	.setattr     = NULL,
 	.fsync       = NULL,
-	.utimens     = NULL,
 	.symlink     = NULL,
 	.link        = NULL,
-	.chmod       = NULL,
-	.chown       = NULL,
+	.mknod       = NULL,
 	.create      = NULL,
-	.truncate    = NULL,
-	.ftruncate   = NULL,
 	.unlink      = NULL,
 	.rename      = NULL,
 	.mkdir       = NULL,
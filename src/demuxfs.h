@@ -24,6 +24,7 @@
 #include "list.h"
 #include "priv.h"
 #include "colors.h"
+#include "epoch.h"
 
 #define dprintf(x...) do { \
         fprintf(stderr, x); \
@@ -33,10 +34,12 @@
 
 #define DEMUXFS_SUPER_MAGIC 0xaa55
 
-#define read_lock() do { } while(0)
-#define read_unlock() do { } while(0)
-#define write_lock() do { } while(0)
-#define write_unlock() do { } while(0)
+/* 
+ * Read-side sections for lockless walks of the filesystem tree. Writers never wait
+ * for readers: they unlink what they replace and epoch.c releases it later on.
+ */
+#define read_lock() epoch_read_lock()
+#define read_unlock() epoch_read_unlock()
 
 struct input_parser;
 
@@ -48,6 +51,8 @@ struct xattr {
 	ssize_t size;
 	/* Should name+value be freed, putname is set to true */
 	bool putname;
+	/* Allocated from the dentry's arena, so released along with it */
+	bool arena;
 	/* Private */
 	struct list_head list;
 };
@@ -60,6 +65,13 @@ enum {
 	OBJ_TYPE_AUDIO_FIFO  = (1 << 4) | OBJ_TYPE_FIFO,
 	OBJ_TYPE_VIDEO_FIFO  = (1 << 5) | OBJ_TYPE_FIFO,
 	OBJ_TYPE_SNAPSHOT    = (1 << 6),
+	OBJ_TYPE_STATS       = (1 << 7),
+	OBJ_TYPE_NUMBER      = (1 << 8),
+};
+
+/* How OBJ_TYPE_NUMBER dentries are rendered */
+enum number_format {
+	NUMBER_FORMAT_HEX,
 };
 
 #define DEMUXFS_IS_FILE(d)       (d->obj_type == OBJ_TYPE_FILE)
@@ -68,20 +80,47 @@ enum {
 #define DEMUXFS_IS_AUDIO_FIFO(d) (d->obj_type == OBJ_TYPE_AUDIO_FIFO)
 #define DEMUXFS_IS_VIDEO_FIFO(d) (d->obj_type == OBJ_TYPE_VIDEO_FIFO)
 #define DEMUXFS_IS_SNAPSHOT(d)   (d->obj_type == OBJ_TYPE_SNAPSHOT)
+#define DEMUXFS_IS_STATS(d)      (d->obj_type == OBJ_TYPE_STATS)
+#define DEMUXFS_IS_NUMBER(d)     (d->obj_type == OBJ_TYPE_NUMBER)
+
+struct dentry_index;
+struct dentry_lazy;
+struct dentry_version;
+struct arena;
+
+/*
+ * Fields shared by full dentries and the compact nodes of numeric files. They come first
+ * and in the same order in both structures, so that any child can be looked at through
+ * a struct dentry pointer as long as nothing past these fields is touched before
+ * checking DEMUXFS_IS_NUMBER().
+ */
+#define DENTRY_NODE_FIELDS \
+	/* List in which this dentry is linked in */ \
+	struct list_head list; \
+	/* Backpointer to parent */ \
+	struct dentry *parent; \
+	/* File name */ \
+	char *name; \
+	/* Arena the dentry and its name are allocated from, or NULL if from the heap */ \
+	struct arena *arena; \
+	/* Number of lookups the kernel hasn't forgotten yet */ \
+	uint64_t nlookup; \
+	/* UNIX mode (file, symlink, directory) */ \
+	mode_t mode; \
+	/* DemuxFS object type (FIFO, snapshot, regular file, directory) */ \
+	int obj_type; \
+	/* Lives under a Version_N directory, so the kernel may cache it for long */ \
+	bool versioned;
 
 struct dentry {
+	DENTRY_NODE_FIELDS
+
 	/* The inode number, generated from the transport stream PID and the table_id */
 	ino_t inode;
-	/* File name */
-	char *name;
-	/* UNIX mode (file, symlink, directory) */
-	mode_t mode;
 	/* Timestamps */
 	time_t atime;
 	time_t ctime;
 	time_t mtime;
-	/* DemuxFS object type (FIFO, snapshot, regular file, directory) */
-	int obj_type;
 	/* Reference count */
 	uint32_t refcount;
 	/* File contents */
@@ -92,17 +131,43 @@ struct dentry {
 	struct list_head xattrs;
 	/* Protection for concurrent access */
 	pthread_mutex_t mutex;
-	/* Backpointer to parent */
-	struct dentry *parent;
 	/* List of children dentries, if any */
 	struct list_head children;
-	/* List in which this dentry is linked in */
-	struct list_head list;
+	unsigned int num_children;
+	/* Hashed index of the children, built once the directory grows large */
+	struct dentry_index *index;
+	/* Raw sections the children are built from on demand, for lazy directories */
+	struct dentry_lazy *lazy;
+	/* Retention bookkeeping, for Version_N directories */
+	struct dentry_version *version;
+	/* Dentry this one is another name of, for hard links */
+	struct dentry *hardlink;
+	/* Number of hard links to this dentry */
+	uint32_t nlinks;
+	/* Next dentry with the same inode number in the global inode index */
+	struct dentry *inode_next;
+	bool inode_indexed;
 
 	/* Private data */
 	void *priv;
 };
 
+/*
+ * Node of an OBJ_TYPE_NUMBER file. Tables hold many of them, so they only keep their
+ * value: it is turned into text when read, and their name points to the member's name.
+ * They have no inode number, contents, attributes nor children, and stay around as long
+ * as the kernel knows about them.
+ */
+struct dentry_number {
+	DENTRY_NODE_FIELDS
+
+	enum number_format format;
+	uint64_t value;
+};
+
+#define DENTRY_TO_NUMBER(de) ((struct dentry_number *)(de))
+#define NUMBER_TO_DENTRY(nu) ((struct dentry *)(nu))
+
 #if (__WORDSIZE == 64)
 #define FILEHANDLE_TO_DENTRY(fh) ((struct dentry *)(uint64_t)(fh))
 #define DENTRY_TO_FILEHANDLE(de) ((uint64_t)(de))
@@ -111,9 +176,21 @@ struct dentry {
 #define DENTRY_TO_FILEHANDLE(de) ((uint64_t)(uint32_t)(de))
 #endif
 
+/* FUSE inode numbers are dentry addresses, except for the root which is FUSE_ROOT_ID */
+#define INODE_TO_DENTRY(ino) ((struct dentry *)(uintptr_t)(ino))
+#define DENTRY_TO_INODE(de)  ((fuse_ino_t)(uintptr_t)(de))
+
+/* Kernel cache invalidation, implemented in demuxfs.c */
+void demuxfs_set_notify_channel(struct fuse_chan *ch);
+void demuxfs_invalidate_entry(struct dentry *dentry);
+void demuxfs_invalidate_inode(struct dentry *dentry);
+
 /* This definition imposes the maximum size of the hash tables */
 #define DEMUXFS_MAX_PIDS 256
 
+/* Maximum number of PES parser threads */
+#define DEMUXFS_MAX_PES_WORKERS 16
+
 enum transmission_type {
 	SBTVD_STANDARD,
 	ATSC_STANDARD,
@@ -130,7 +207,11 @@ enum error_type {
 
 struct descriptor;
 struct dsmcc_descriptor;
+struct ts_pid_state;
+struct demuxfs_stats;
 struct backend_ops;
+struct packet_ring;
+struct pipeline;
 
 struct user_options {
 	bool parse_pes;
@@ -140,6 +221,20 @@ struct user_options {
 	uint32_t frequency;
 	char *tmpdir;
 	enum error_type verbose_mask;
+	/* Number of PES parser threads, or 0 to parse everything in a single thread */
+	int pes_workers;
+	/* CPUs the parser threads are bound to, or -1 */
+	int psi_cpu;
+	int dsmcc_cpu;
+	int pes_cpus[DEMUXFS_MAX_PES_WORKERS];
+	/* Build the contents of EIT versions on first access only */
+	bool lazy_tables;
+	/* Number of dentries built on demand which are kept around */
+	unsigned long lazy_budget;
+	/* Number of versions kept per table, counting the current one, or 0 to keep them all */
+	unsigned int keep_versions;
+	/* Bytes taken by all versions before the oldest non-current ones are dropped, or 0 for no limit */
+	size_t version_budget;
 };
 
 struct demuxfs_data {
@@ -149,16 +244,21 @@ struct demuxfs_data {
 	char *opt_tmpdir;
 	char *opt_backend;
 	char *opt_report;
+	int opt_ring_depth;
+	int opt_pes_workers;
+	int opt_psi_cpu;
+	int opt_dsmcc_cpu;
+	char *opt_pes_cpus;
+	int opt_lazy_tables;
+	int opt_lazy_budget;
+	int opt_keep_versions;
+	int opt_version_budget;
 	/* "psi_tables" holds PSI structures (ie: PAT, PMT, NIT..) */
 	struct hash_table *psi_tables;
 	/* "pes_tables" holds structures from PES packets that we're parsing */
 	struct hash_table *pes_tables;
-	/* "psi_parsers" holds pointers to parsers of known PSI PIDs */
-	struct hash_table *psi_parsers;
-	/* "pes_parsers" holds pointers to parsers of known PES PIDs */
-	struct hash_table *pes_parsers;
-	/* "packet_buffer" holds incomplete TS packets, which cannot be parsed yet */
-	struct hash_table *packet_buffer;
+	/* "pid_table" holds the parser and reassembly state of each PID, indexed by PID */
+	struct ts_pid_state *pid_table;
 	/* "ts_descriptors" holds descriptor tags and the tables that they're allowed to be in */
 	struct descriptor *ts_descriptors;
 	/* "dsmcc_descriptors" holds DSM-CC descriptor tags and their parsers */
@@ -173,10 +273,20 @@ struct demuxfs_data {
 	char *mount_point;
 	/* TS parser thread handle */
 	pthread_t ts_parser_id;
+	/* Input reader thread handle, if packets are queued through "ring" */
+	pthread_t ts_reader_id;
+	/* Packet batches read from the backend and waiting to be parsed */
+	struct packet_ring *ring;
+	/* Parser threads, if parsing is sharded by PID class */
+	struct pipeline *pipeline;
+	/* Serializes changes to the filesystem tree made by the table parsers */
+	pthread_mutex_t tree_lock;
 	/* User-defined options */
 	struct user_options options;
 	/* Backend implementation */
 	struct backend_ops *backend;
+	/* Runtime statistics */
+	struct demuxfs_stats *stats;
 };
 
 #endif /* __demuxfs_h */
@@ -627,19 +627,19 @@ static void ait_parse_descriptor(uint8_t tag, uint8_t len, const char *payload,
 }
 
 static void ait_create_directory(const struct ts_header *header, struct ait_table *ait,
-		struct dentry **version_dentry, struct demuxfs_data *priv)
+		struct dentry **ait_dentry, struct dentry **version_dentry, struct demuxfs_data *priv)
 {
-	struct dentry *dentry = fsutils_get_child(priv->root, "AIT");
-
-	if (dentry) {
-		INITIALIZE_DENTRY_UNLINKED(ait->dentry);
-	} else {
-		/* Create a new directory named "AIT" in the root filesystem */
-		ait->dentry->name = strdup(FS_AIT_NAME);
-		ait->dentry->mode = S_IFDIR | 0555;
-		CREATE_COMMON(priv->root, ait->dentry);
-		dentry = ait->dentry;
-	}
+	/* 
+	 * Create a directory named "AIT" in the root filesystem. All AIT tables share that
+	 * directory, so it's built off-line and merged into the published one later.
+	 */
+	struct dentry *dentry = (struct dentry *) calloc(1, sizeof(struct dentry));
+	assert(dentry);
+	dentry->name = strdup(FS_AIT_NAME);
+	dentry->mode = S_IFDIR | 0555;
+	CREATE_UNLINKED(priv->root, dentry);
+	INITIALIZE_DENTRY_UNLINKED(ait->dentry);
+	*ait_dentry = dentry;
 
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(dentry, ait->version_number);
@@ -678,8 +678,8 @@ int ait_parse(const struct ts_header *header, const char *payload, uint32_t payl
 			header->pid, ait->table_id, current_ait, ait->version_number, payload_len);
 
 	/* Parse AIT specific bits */
-	struct dentry *version_dentry = NULL;
-	ait_create_directory(header, ait, &version_dentry, priv);
+	struct dentry *ait_dentry = NULL, *version_dentry = NULL;
+	ait_create_directory(header, ait, &ait_dentry, &version_dentry, priv);
 
 	ait->reserved_4 = payload[8] >> 4;
 	ait->common_descriptors_length = CONVERT_TO_16(payload[8], payload[9]) & 0x0fff;
@@ -740,10 +740,10 @@ int ait_parse(const struct ts_header *header, const char *payload, uint32_t payl
 		}
 	}
 
-	if (current_ait) {
-		fsutils_migrate_children(current_ait->dentry, ait->dentry);
+	/* Make the new version visible at once */
+	fsutils_publish_dentry(ait_dentry, fsutils_get_child(priv->root, FS_AIT_NAME));
+	if (current_ait)
 		hashtable_del(priv->psi_tables, current_ait->dentry->inode);
-	}
 	hashtable_add(priv->psi_tables, ait->dentry->inode, ait, (hashtable_free_function_t) ait_free);
 
 	return 0;
@@ -724,7 +724,7 @@ void biop_reparent_orphaned_dentries(struct dentry *root, struct dentry *stepfat
 			fsutils_dispose_node(entry);
 			has_orphaned_entries = true;
 		} else {
-			list_move_tail(&entry->list, &real_parent->children);
+			fsutils_move_dentry(entry, real_parent);
 			free(entry->priv);
 			entry->priv = NULL;
 		}
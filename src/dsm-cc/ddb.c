@@ -89,7 +89,7 @@ static void ddb_create_directory(const struct ts_header *header, struct ddb_tabl
 	/* Create a directory named "<ddb_pid>" and populate it with files */
 	asprintf(&ddb->dentry->name, "%#04x", header->pid);
 	ddb->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(ddb_dir, ddb->dentry);
+	CREATE_UNLINKED(ddb_dir, ddb->dentry);
 	
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(ddb->dentry, ddb->version_number);
@@ -186,8 +186,10 @@ int ddb_parse(const struct ts_header *header, const char *payload, uint32_t payl
 	
 	if (current_ddb)
 		ddb_free(ddb);
-	else
+	else {
+		fsutils_publish_dentry(ddb->dentry, NULL);
 		hashtable_add(priv->psi_tables, ddb->dentry->inode, ddb, (hashtable_free_function_t) ddb_free);
+	}
 
 	return 0;
 }
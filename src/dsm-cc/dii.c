@@ -93,7 +93,7 @@ static void dii_create_directory(const struct ts_header *header, struct dii_tabl
 	/* Create a directory named "<dii_pid>" and populate it with files */
 	asprintf(&dii->dentry->name, "%#04x", header->pid);
 	dii->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(dii_dir, dii->dentry);
+	CREATE_UNLINKED(dii_dir, dii->dentry);
 
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(dii->dentry, dii->download_id);
@@ -212,7 +212,8 @@ int dii_create_filesystem(const struct ts_header *header, struct dii_table *dii,
 	struct demuxfs_data *priv)
 {
 	char buf[PATH_MAX], mod_dir[64], block_dir[64];
-	struct dentry *ddb_dentry, *dsmcc_dentry, *ait_dentry, *app_dentry = NULL;
+	struct dentry *ddb_dentry, *dsmcc_dentry, *ait_dentry, *app_dentry;
+	const char *app_name = FS_UNNAMED_APPLICATION_NAME;
 
 	dprintf("*** Creating filesystem for PID %#x ***", header->pid);
 	dii->_filesystem_created = true;
@@ -243,14 +244,20 @@ int dii_create_filesystem(const struct ts_header *header, struct dii_table *dii,
 				sprintf(buf, "/Application_Name_Descriptor/Application_Name_01/application_name");
 				ait_dentry = fsutils_get_dentry(ait_dentry, buf);
 				if (ait_dentry) {
-					app_dentry = CREATE_DIRECTORY(dsmcc_dentry, ait_dentry->contents);
+					app_name = ait_dentry->contents;
 					break;
 				}
 			}
 		}
 	}
-	if (! app_dentry)
-		app_dentry = CREATE_DIRECTORY(dsmcc_dentry, FS_UNNAMED_APPLICATION_NAME);
+
+	/* BIOP messages move dentries around, so the application tree is built off-line */
+	app_dentry = (struct dentry *) calloc(1, sizeof(struct dentry));
+	assert(app_dentry);
+	app_dentry->name = strdup(app_name);
+	app_dentry->mode = S_IFDIR | 0555;
+	app_dentry->obj_type = OBJ_TYPE_DIR;
+	CREATE_UNLINKED(dsmcc_dentry, app_dentry);
 
 	/* For each module, get all of its blocks and expose their virtual filesystem */
 	struct dentry stepfather_dentry;
@@ -292,6 +299,7 @@ int dii_create_filesystem(const struct ts_header *header, struct dii_table *dii,
 		free(download_data);
 	}
 	biop_reparent_orphaned_dentries(app_dentry, &stepfather_dentry);
+	fsutils_publish_dentry(app_dentry, fsutils_get_child(dsmcc_dentry, app_dentry->name));
 
 	return 0;
 }
@@ -410,9 +418,11 @@ int dii_parse(const struct ts_header *header, const char *payload, uint32_t payl
 	dii_create_directory(header, dii, &version_dentry, priv);
 	dii_create_dentries(version_dentry, dii, priv);
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	dii->dentry = fsutils_publish_dentry(dii->dentry, current_dii ? current_dii->dentry : NULL);
 	if (current_dii) {
-		fsutils_migrate_children(current_dii->dentry, dii->dentry);
-		hashtable_del(priv->psi_tables, current_dii->dentry->inode);
+		current_dii->dentry = NULL;
+		hashtable_del(priv->psi_tables, dii->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, dii->dentry->inode, dii, (hashtable_free_function_t) dii_free);
 
@@ -82,7 +82,7 @@ static void dsi_create_directory(const struct ts_header *header, struct dsi_tabl
 	/* Create a directory named "<dsi_pid>" and populate it with files */
 	asprintf(&dsi->dentry->name, "%#04x", header->pid);
 	dsi->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(dsi_dir, dsi->dentry);
+	CREATE_UNLINKED(dsi_dir, dsi->dentry);
 
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(dsi->dentry, dsi->version_number);
@@ -131,8 +131,9 @@ void dsi_create_dii_symlink(const struct ts_header *header, struct dsi_table *ds
 		snprintf(subdir, sizeof(subdir), "/%s/transaction_id", FS_DSMCC_MESSAGE_HEADER_DIRNAME);
 		transaction_dentry = fsutils_get_dentry(dii_dentry, subdir);
 		assert(transaction_dentry);
+		assert(DEMUXFS_IS_NUMBER(transaction_dentry));
 
-		dii_transaction_id = strtoul(transaction_dentry->contents, NULL, 16);
+		dii_transaction_id = DENTRY_TO_NUMBER(transaction_dentry)->value;
 		dsi_transaction_id = tap->message_selector ? tap->message_selector->transaction_id : 0;
 		if (dii_transaction_id != dsi_transaction_id) {
 			TS_WARNING("dii_transaction_id %#x != dsi_transaction_id %#x", 
@@ -332,9 +333,11 @@ int dsi_parse(const struct ts_header *header, const char *payload, uint32_t payl
 		j += 2 + sgi->user_info_length;
 	}
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	dsi->dentry = fsutils_publish_dentry(dsi->dentry, current_dsi ? current_dsi->dentry : NULL);
 	if (current_dsi) {
-		fsutils_migrate_children(current_dsi->dentry, dsi->dentry);
-		hashtable_del(priv->psi_tables, current_dsi->dentry->inode);
+		current_dsi->dentry = NULL;
+		hashtable_del(priv->psi_tables, dsi->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, dsi->dentry->inode, dsi, (hashtable_free_function_t) dsi_free);
 
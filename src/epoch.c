@@ -0,0 +1,191 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "epoch.h"
+
+/*
+ * Epoch-based reclamation. Writers unlink objects from the tree and retire them,
+ * tagged with the current global epoch, which is then advanced. Readers record the
+ * global epoch when entering a read-side section. A retired object can be released
+ * once every active reader has entered after it was retired.
+ */
+
+struct epoch_reader {
+	/* Epoch this reader entered its section at, or 0 if it is not inside one */
+	uint64_t epoch;
+	bool in_use;
+};
+
+struct epoch_retired {
+	uint64_t epoch;
+	void *data;
+	epoch_reclaim_function_t reclaim;
+	struct epoch_retired *next;
+};
+
+static uint64_t global_epoch = 1;
+static struct epoch_reader readers[EPOCH_MAX_READERS];
+static struct epoch_retired *retired_list;
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t reader_key;
+
+static __thread struct epoch_reader *this_reader;
+static __thread int nesting;
+
+/* Hand the reader slot back when its thread exits */
+static void epoch_release_reader(void *data)
+{
+	struct epoch_reader *reader = (struct epoch_reader *) data;
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&reader->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void epoch_create_reader_key(void)
+{
+	pthread_key_create(&reader_key, epoch_release_reader);
+}
+
+static struct epoch_reader *epoch_claim_reader(void)
+{
+	int i;
+
+	pthread_once(&reader_key_once, epoch_create_reader_key);
+	for (;;) {
+		for (i=0; i<EPOCH_MAX_READERS; ++i) {
+			bool expected = false;
+			if (__atomic_compare_exchange_n(&readers[i].in_use, &expected, true, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				pthread_setspecific(reader_key, &readers[i]);
+				return &readers[i];
+			}
+		}
+		/* Every slot is taken: wait for a thread to exit */
+		sched_yield();
+	}
+}
+
+void epoch_read_lock(void)
+{
+	if (nesting++)
+		return;
+	if (! this_reader)
+		this_reader = epoch_claim_reader();
+	__atomic_store_n(&this_reader->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	/* Pairs with the fence in epoch_reclaim(): either the writer sees us, or we don't see what it unlinked */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_read_unlock(void)
+{
+	if (--nesting)
+		return;
+	__atomic_store_n(&this_reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void *data, epoch_reclaim_function_t reclaim)
+{
+	struct epoch_retired *entry = (struct epoch_retired *) malloc(sizeof(struct epoch_retired));
+	assert(entry);
+
+	entry->data = data;
+	entry->reclaim = reclaim;
+	pthread_mutex_lock(&retired_mutex);
+	entry->epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+	entry->next = retired_list;
+	retired_list = entry;
+	pthread_mutex_unlock(&retired_mutex);
+}
+
+bool epoch_free(void *data)
+{
+	free(data);
+	return true;
+}
+
+/* Take the whole retired list, so that reclaim functions can retire objects themselves */
+static struct epoch_retired *epoch_take_retired(void)
+{
+	struct epoch_retired *list;
+
+	pthread_mutex_lock(&retired_mutex);
+	list = retired_list;
+	retired_list = NULL;
+	pthread_mutex_unlock(&retired_mutex);
+	return list;
+}
+
+void epoch_reclaim(void)
+{
+	struct epoch_retired *list, *entry, *kept = NULL, **tail = &kept;
+	uint64_t oldest = UINT64_MAX, epoch;
+	int i;
+
+	list = epoch_take_retired();
+	if (! list)
+		return;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (i=0; i<EPOCH_MAX_READERS; ++i) {
+		epoch = __atomic_load_n(&readers[i].epoch, __ATOMIC_ACQUIRE);
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	while ((entry = list)) {
+		list = entry->next;
+		if (entry->epoch < oldest && entry->reclaim(entry->data))
+			free(entry);
+		else {
+			*tail = entry;
+			tail = &entry->next;
+		}
+	}
+
+	/* Put back what is still in use, ahead of what has been retired meanwhile */
+	if (kept) {
+		pthread_mutex_lock(&retired_mutex);
+		*tail = retired_list;
+		retired_list = kept;
+		pthread_mutex_unlock(&retired_mutex);
+	}
+}
+
+void epoch_destroy(void)
+{
+	struct epoch_retired *list, *entry;
+
+	while ((list = epoch_take_retired())) {
+		while ((entry = list)) {
+			list = entry->next;
+			entry->reclaim(entry->data);
+			free(entry);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef __epoch_h
+#define __epoch_h
+
+/* Maximum number of threads which can be inside read-side sections at the same time */
+#define EPOCH_MAX_READERS 128
+
+/* 
+ * Releases a retired object. Returns false if the object is still in use for
+ * some other reason (eg: an open file handle), in which case it is retried on
+ * the next epoch_reclaim() call. May retire other objects.
+ */
+typedef bool (*epoch_reclaim_function_t)(void *data);
+
+/**
+ * epoch_read_lock - Enters a read-side section. Objects reachable from the tree
+ * will not be released until the matching epoch_read_unlock(). Sections may nest.
+ */
+void epoch_read_lock(void);
+
+/**
+ * epoch_read_unlock - Leaves a read-side section.
+ */
+void epoch_read_unlock(void);
+
+/**
+ * epoch_retire - Schedules an object which is no longer reachable to be released
+ * once the readers which could still see it are gone.
+ */
+void epoch_retire(void *data, epoch_reclaim_function_t reclaim);
+
+/**
+ * epoch_reclaim - Releases the retired objects whose grace period is over. Never blocks
+ * on readers.
+ */
+void epoch_reclaim(void);
+
+/**
+ * epoch_free - Reclaim function for objects allocated with malloc().
+ */
+bool epoch_free(void *data);
+
+/**
+ * epoch_destroy - Releases every retired object. Only to be called once all readers are gone.
+ */
+void epoch_destroy(void);
+
+#endif /* __epoch_h */
@@ -31,8 +31,16 @@
 #include "buffer.h"
 #include "xattr.h"
 #include "fifo.h"
+#include "hash.h"
+#include "arena.h"
 
 static void _fsutils_dump_tree(struct dentry *dentry, int spaces);
+static void fsutils_merge_children(struct dentry *source, struct dentry *target);
+static void fsutils_lazy_merge(struct dentry *source, struct dentry *target);
+static void fsutils_lazy_free(struct dentry_lazy *lazy);
+static void fsutils_forget_version(struct dentry_version *version);
+static bool fsutils_reclaim_node(void *data);
+static void fsutils_track_versions(struct dentry *dentry);
 
 /**
  * Resolve the full pathname for a given dentry up to DemuxFS' root dentry.
@@ -122,6 +130,11 @@ static void _fsutils_dump_tree(struct dentry *dentry, int spaces)
 	list_for_each_entry(ptr, &dentry->children, list) {
 		for (i=0; i<spaces; ++i)
 			fprintf(stderr, " ");
+		if (DEMUXFS_IS_NUMBER(ptr)) {
+			fprintf(stderr, "%s [number] value=%#llx\n", ptr->name,
+					(unsigned long long) DENTRY_TO_NUMBER(ptr)->value);
+			continue;
+		}
 		fprintf(stderr, "%s [%s] inode=%#llx\n", 
 				ptr->name ? ptr->name : "(null)", 
 				ptr->mode & S_IFDIR ? "dir" : 
@@ -132,14 +145,423 @@ static void _fsutils_dump_tree(struct dentry *dentry, int spaces)
 	}
 }
 
+/*
+ * Global inode number to dentry index. Dentries are added when they are linked to a
+ * parent and removed when they are released. Different versions of a table or of a
+ * DSM-CC application share inode numbers, so dentries with the same inode number are
+ * chained through dentry->inode_next.
+ */
+static struct hash_table *inode_table;
+
+static void fsutils_inode_index_add(struct dentry *dentry)
+{
+	struct dentry *head;
+
+	if (DEMUXFS_IS_NUMBER(dentry) || ! dentry->inode || dentry->inode_indexed)
+		return;
+	if (! inode_table)
+		inode_table = hashtable_new(DEMUXFS_MAX_PIDS);
+	hashtable_lock(inode_table);
+	head = (struct dentry *) hashtable_get(inode_table, dentry->inode);
+	dentry->inode_next = head;
+	if (head)
+		hashtable_del(inode_table, dentry->inode);
+	dentry->inode_indexed = hashtable_add(inode_table, dentry->inode, dentry, NULL);
+	hashtable_unlock(inode_table);
+}
+
+static void fsutils_inode_index_del(struct dentry *dentry)
+{
+	struct dentry *ptr;
+
+	if (! dentry->inode_indexed)
+		return;
+	hashtable_lock(inode_table);
+	ptr = (struct dentry *) hashtable_get(inode_table, dentry->inode);
+	if (ptr == dentry) {
+		hashtable_del(inode_table, dentry->inode);
+		if (dentry->inode_next)
+			hashtable_add(inode_table, dentry->inode, dentry->inode_next, NULL);
+	} else {
+		while (ptr && ptr->inode_next != dentry)
+			ptr = ptr->inode_next;
+		if (ptr)
+			ptr->inode_next = dentry->inode_next;
+	}
+	hashtable_unlock(inode_table);
+	dentry->inode_next = NULL;
+	dentry->inode_indexed = false;
+}
+
+/* Whether a dentry is linked in its parent's list of children */
+static bool fsutils_is_linked(struct dentry *dentry)
+{
+	return ! list_poisoned(&dentry->list) && ! list_unlinked(&dentry->list) &&
+		! list_empty(&dentry->list);
+}
+
+/* Whether 'dentry' can be reached from 'root' by walking down the children lists */
+static bool fsutils_is_descendant(struct dentry *dentry, struct dentry *root)
+{
+	while (dentry != root) {
+		if (! dentry->parent || ! fsutils_is_linked(dentry))
+			return false;
+		dentry = dentry->parent;
+	}
+	return true;
+}
+
+/**
+ * Release the global inode index. Only to be called once all dentries are gone.
+ */
+void fsutils_destroy(void)
+{
+	if (inode_table)
+		hashtable_destroy(inode_table, NULL);
+	inode_table = NULL;
+}
+
+/*
+ * Directories with more than DENTRY_INDEX_THRESHOLD children get an open addressing
+ * index of their children so that fsutils_get_child() doesn't need to walk the whole
+ * list. The list is kept as is, so readdir still returns entries in creation order.
+ *
+ * The index is changed by the parser threads only, which are serialized by the tree
+ * lock, or by the thread building a lazy directory (see below). Readers look it up without locking: slots are updated with single atomic
+ * stores, removed entries leave a tombstone behind and a grown index replaces the
+ * old one in one step.
+ */
+#define DENTRY_INDEX_THRESHOLD 32
+#define DENTRY_INDEX_MIN_SIZE  64
+#define DENTRY_INDEX_TOMBSTONE ((struct dentry *) -1)
+
+struct dentry_index {
+	/* Number of slots, always a power of two */
+	uint32_t size;
+	/* Slots which are not empty, including tombstones */
+	uint32_t used;
+	struct dentry *slots[];
+};
+
+static uint32_t fsutils_name_hash(const char *name)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+	while (*name) {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static struct dentry *fsutils_index_lookup(struct dentry_index *index, const char *name)
+{
+	uint32_t mask = index->size - 1;
+	uint32_t i = fsutils_name_hash(name) & mask;
+	struct dentry *ptr;
+
+	while ((ptr = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE))) {
+		if (ptr != DENTRY_INDEX_TOMBSTONE && ! strcmp(ptr->name, name))
+			return ptr;
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+/* Find the slot holding 'child', which is indexed under 'name' */
+static struct dentry **fsutils_index_slot(struct dentry_index *index, struct dentry *child,
+		const char *name)
+{
+	uint32_t mask = index->size - 1;
+	uint32_t i = fsutils_name_hash(name) & mask;
+
+	while (index->slots[i]) {
+		if (index->slots[i] == child)
+			return &index->slots[i];
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+static void fsutils_index_store(struct dentry_index *index, struct dentry *child)
+{
+	uint32_t mask = index->size - 1;
+	uint32_t i = fsutils_name_hash(child->name) & mask;
+
+	while (index->slots[i] && index->slots[i] != DENTRY_INDEX_TOMBSTONE)
+		i = (i + 1) & mask;
+	if (! index->slots[i])
+		index->used++;
+	__atomic_store_n(&index->slots[i], child, __ATOMIC_RELEASE);
+}
+
+/* Build a new index out of the children list and swap it with the current one */
+static void fsutils_index_rebuild(struct dentry *dentry)
+{
+	struct dentry_index *index, *old_index = dentry->index;
+	struct dentry *ptr;
+	uint32_t size = DENTRY_INDEX_MIN_SIZE;
+
+	while (size < dentry->num_children * 2)
+		size <<= 1;
+
+	index = calloc(1, sizeof(struct dentry_index) + size * sizeof(struct dentry *));
+	assert(index);
+	index->size = size;
+	list_for_each_entry(ptr, &dentry->children, list)
+		fsutils_index_store(index, ptr);
+
+	__atomic_store_n(&dentry->index, index, __ATOMIC_RELEASE);
+	if (old_index)
+		epoch_retire(old_index, epoch_free);
+}
+
+static void fsutils_index_drop(struct dentry *dentry)
+{
+	struct dentry_index *index = dentry->index;
+
+	__atomic_store_n(&dentry->index, NULL, __ATOMIC_RELEASE);
+	epoch_retire(index, epoch_free);
+}
+
+static void fsutils_index_insert(struct dentry *dentry, struct dentry *child)
+{
+	struct dentry_index *index = dentry->index;
+
+	if (! index) {
+		if (dentry->num_children > DENTRY_INDEX_THRESHOLD)
+			fsutils_index_rebuild(dentry);
+	} else if ((index->used + 1) * 4 > index->size * 3)
+		fsutils_index_rebuild(dentry);
+	else
+		fsutils_index_store(index, child);
+}
+
+static void fsutils_index_remove(struct dentry *dentry, struct dentry *child, const char *name)
+{
+	struct dentry **slot;
+
+	if (! dentry->index)
+		return;
+	if (dentry->num_children < DENTRY_INDEX_THRESHOLD / 2) {
+		fsutils_index_drop(dentry);
+		return;
+	}
+	slot = fsutils_index_slot(dentry->index, child, name);
+	if (slot)
+		__atomic_store_n(slot, DENTRY_INDEX_TOMBSTONE, __ATOMIC_RELEASE);
+}
+
+/*
+ * The dentries of a table version and their names are allocated from an arena which
+ * is created along with the Version_N directory, and which goes away once all of them
+ * have been released. Dentries built off-line are in the arena of their parent, so
+ * only the thread building a tree allocates from it.
+ */
+static struct dentry *fsutils_alloc_node(struct arena *arena, size_t size)
+{
+	struct dentry *dentry;
+
+	if (! arena) {
+		dentry = (struct dentry *) calloc(1, size);
+		assert(dentry);
+		return dentry;
+	}
+	dentry = (struct dentry *) arena_alloc(arena, size);
+	dentry->arena = arena;
+	arena_get(arena);
+	return dentry;
+}
+
+static struct dentry *fsutils_alloc_dentry(struct arena *arena)
+{
+	return fsutils_alloc_node(arena, sizeof(struct dentry));
+}
+
+/**
+ * Allocate a zeroed dentry to be linked under 'parent'.
+ * @parent: parent dentry
+ */
+struct dentry *fsutils_new_dentry(struct dentry *parent)
+{
+	return fsutils_alloc_dentry(parent->arena);
+}
+
 /**
- * Dispose a dentry and its allocated memory.
+ * Duplicate a string which lives as long as 'dentry', such as its name.
+ * @dentry: dentry the string belongs to
+ * @str: string to copy
+ */
+char *fsutils_strdup(struct dentry *dentry, const char *str)
+{
+	return dentry->arena ? arena_strdup(dentry->arena, str) : strdup(str);
+}
+
+/**
+ * Append a dentry to its parent's list of children.
+ * @parent: parent dentry
+ * @dentry: child dentry, already initialized
+ */
+void fsutils_link_dentry(struct dentry *parent, struct dentry *dentry)
+{
+	dentry->versioned |= parent->versioned;
+	list_add_tail_rcu(&dentry->list, &parent->children);
+	parent->num_children++;
+	fsutils_index_insert(parent, dentry);
+	fsutils_inode_index_add(dentry);
+}
+
+/* Take a dentry out of its parent's list, leaving it in place for readers already on it */
+static void fsutils_unlink(struct dentry *dentry)
+{
+	if (! fsutils_is_linked(dentry))
+		return;
+	list_del_rcu(&dentry->list);
+	if (dentry->parent) {
+		dentry->parent->num_children--;
+		fsutils_index_remove(dentry->parent, dentry, dentry->name);
+	}
+	demuxfs_invalidate_entry(dentry);
+}
+
+/* Put 'new' at the place of 'old', which has the same name, in a single step */
+static void fsutils_replace_dentry(struct dentry *old, struct dentry *new)
+{
+	struct dentry *parent = old->parent;
+	struct dentry **slot;
+
+	new->parent = parent;
+	list_replace_rcu(&old->list, &new->list);
+	if (parent->index && (slot = fsutils_index_slot(parent->index, old, old->name)))
+		__atomic_store_n(slot, new, __ATOMIC_RELEASE);
+	fsutils_inode_index_add(new);
+	demuxfs_invalidate_entry(old);
+}
+
+/**
+ * Move a dentry to another parent. Only safe in trees which haven't been published yet.
+ * @dentry: dentry to move
+ * @parent: new parent
+ */
+void fsutils_move_dentry(struct dentry *dentry, struct dentry *parent)
+{
+	fsutils_unlink(dentry);
+	if (dentry->obj_type != OBJ_TYPE_FIFO)
+		parent->size += fsutils_get_size(dentry);
+	dentry->parent = parent;
+	fsutils_link_dentry(parent, dentry);
+}
+
+/**
+ * Change the name of a dentry, keeping its parent's index up to date.
+ * @dentry: dentry to rename
+ * @name: new name
+ */
+void fsutils_rename_dentry(struct dentry *dentry, const char *name)
+{
+	struct dentry *parent = dentry->parent;
+	char *old_name = dentry->name;
+	struct dentry **slot = NULL;
+
+	assert(! DEMUXFS_IS_NUMBER(dentry));
+	demuxfs_invalidate_entry(dentry);
+	if (parent && parent->index && (slot = fsutils_index_slot(parent->index, dentry, old_name)))
+		__atomic_store_n(slot, DENTRY_INDEX_TOMBSTONE, __ATOMIC_RELEASE);
+	__atomic_store_n(&dentry->name, fsutils_strdup(dentry, name), __ATOMIC_RELEASE);
+	if (slot)
+		fsutils_index_insert(parent, dentry);
+	/* Names in an arena stay around until the dentry is released */
+	if (! dentry->arena)
+		epoch_retire(old_name, epoch_free);
+}
+
+/**
+ * Render the value of a numeric dentry as text.
+ * @dentry: numeric dentry
+ * @buf: output buffer, or NULL
+ * @size: output buffer size
+ *
+ * Returns the length of the text, as snprintf() does.
+ */
+int fsutils_format_number(struct dentry *dentry, char *buf, size_t size)
+{
+	struct dentry_number *number = DENTRY_TO_NUMBER(dentry);
+	/* Parsers may change the value meanwhile; it is read once */
+	uint64_t value = __atomic_load_n(&number->value, __ATOMIC_RELAXED);
+
+	switch (number->format) {
+		case NUMBER_FORMAT_HEX:
+		default:
+			return snprintf(buf, size, "%#04llx", (unsigned long long) value);
+	}
+}
+
+/**
+ * Create a numeric file, allocated from the arena of its parent.
+ * @parent: parent dentry
+ * @name: file name, which must outlive the file
+ * @value: value
+ *
+ * Returns the numeric file.
+ */
+struct dentry *fsutils_create_number(struct dentry *parent, const char *name, uint64_t value)
+{
+	struct dentry *dentry = fsutils_alloc_node(parent->arena, sizeof(struct dentry_number));
+	struct dentry_number *number = DENTRY_TO_NUMBER(dentry);
+
+	number->name = (char *) name;
+	number->mode = S_IFREG | 0444;
+	number->obj_type = OBJ_TYPE_NUMBER;
+	number->format = NUMBER_FORMAT_HEX;
+	number->value = value;
+	number->parent = parent;
+	parent->size += fsutils_format_number(dentry, NULL, 0);
+	fsutils_link_dentry(parent, dentry);
+	return dentry;
+}
+
+/**
+ * Change the value of a numeric dentry.
+ * @dentry: numeric dentry
+ * @value: new value
+ */
+void fsutils_update_number(struct dentry *dentry, uint64_t value)
+{
+	int old_size = fsutils_format_number(dentry, NULL, 0);
+
+	__atomic_store_n(&DENTRY_TO_NUMBER(dentry)->value, value, __ATOMIC_RELAXED);
+	dentry->parent->size += fsutils_format_number(dentry, NULL, 0) - old_size;
+	demuxfs_invalidate_inode(dentry);
+}
+
+/**
+ * Get the size of a file as reported by stat().
+ * @dentry: dentry
+ */
+ssize_t fsutils_get_size(struct dentry *dentry)
+{
+	if (DEMUXFS_IS_NUMBER(dentry))
+		return fsutils_format_number(dentry, NULL, 0);
+	return dentry->size;
+}
+
+/**
+ * Release a dentry and its allocated memory. The dentry must not be reachable anymore.
  * @dentry: dentry to deallocate.
  */
-void fsutils_dispose_node(struct dentry *dentry)
+static void fsutils_free_node(struct dentry *dentry)
 {
 	struct xattr *xattr, *aux;
 
+	/* Numeric files only own their node. Their name points to the member's name */
+	if (DEMUXFS_IS_NUMBER(dentry)) {
+		if (dentry->arena)
+			arena_put(dentry->arena);
+		else
+			free(dentry);
+		return;
+	}
+
 	if (dentry->priv) {
 		switch (dentry->obj_type) {
 			case OBJ_TYPE_SNAPSHOT: {
@@ -173,60 +595,642 @@ void fsutils_dispose_node(struct dentry *dentry)
 		free(dentry->contents);
 	list_for_each_entry_safe(xattr, aux, &dentry->xattrs, list)
 		xattr_free(xattr);
-	if (dentry->name)
+	if (dentry->name && ! dentry->arena)
 		free(dentry->name);
+	if (dentry->index)
+		free(dentry->index);
+	if (dentry->lazy)
+		fsutils_lazy_free(dentry->lazy);
+	if (dentry->version) {
+		fsutils_forget_version(dentry->version);
+		free(dentry->version);
+	}
+	/* The target of the last link is unreachable now, but readers may still be using it */
+	if (dentry->hardlink && __atomic_sub_fetch(&dentry->hardlink->nlinks, 1, __ATOMIC_ACQ_REL) == 0)
+		epoch_retire(dentry->hardlink, fsutils_reclaim_node);
+	fsutils_inode_index_del(dentry);
 	pthread_mutex_destroy(&dentry->mutex);
-	if (! list_poisoned(&dentry->list))
-		list_del(&dentry->list);
-	free(dentry);
+	if (dentry->arena)
+		arena_put(dentry->arena);
+	else
+		free(dentry);
+}
+
+static void fsutils_free_tree(struct dentry *dentry)
+{
+	struct dentry *ptr, *aux;
+
+	list_for_each_entry_safe(ptr, aux, &dentry->children, list) {
+		if (ptr->mode & S_IFDIR)
+			fsutils_free_tree(ptr);
+		else
+			fsutils_free_node(ptr);
+	}
+	fsutils_free_node(dentry);
+}
+
+/* Whether the kernel still knows about a dentry or holds it open */
+static bool fsutils_node_is_busy(struct dentry *dentry)
+{
+	/* Numeric files are never referenced past the kernel's lookups */
+	if (DEMUXFS_IS_NUMBER(dentry))
+		return __atomic_load_n(&dentry->nlookup, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&dentry->refcount, __ATOMIC_ACQUIRE) ||
+		__atomic_load_n(&dentry->nlookup, __ATOMIC_ACQUIRE);
+}
+
+/* Whether any dentry of a tree is still referenced by the kernel */
+static bool fsutils_tree_is_busy(struct dentry *dentry)
+{
+	struct dentry *ptr;
+
+	if (fsutils_node_is_busy(dentry))
+		return true;
+	if (! S_ISDIR(dentry->mode))
+		return false;
+	list_for_each_entry(ptr, &dentry->children, list)
+		if (fsutils_tree_is_busy(ptr))
+			return true;
+	return false;
+}
+
+static bool fsutils_reclaim_node(void *data)
+{
+	struct dentry *dentry = (struct dentry *) data;
+	if (fsutils_node_is_busy(dentry))
+		return false;
+	fsutils_free_node(dentry);
+	return true;
+}
+
+static bool fsutils_reclaim_tree(void *data)
+{
+	struct dentry *dentry = (struct dentry *) data;
+	if (fsutils_tree_is_busy(dentry))
+		return false;
+	fsutils_free_tree(dentry);
+	return true;
+}
+
+/**
+ * Dispose a dentry. It is unlinked right away and released once no readers
+ * can be looking at it.
+ * @dentry: dentry to deallocate.
+ */
+void fsutils_dispose_node(struct dentry *dentry)
+{
+	fsutils_unlink(dentry);
+	epoch_retire(dentry, fsutils_reclaim_node);
 }
 
 /**
- * Dispose all nodes and their memory starting at a given dentry.
+ * Dispose all nodes and their memory starting at a given dentry. The tree is 
+ * unlinked right away and released once no readers can be looking at it.
  * @dentry: starting point
  */
 void fsutils_dispose_tree(struct dentry *dentry)
 {
-	struct dentry *ptr, *aux;
-	
 	if (! dentry)
 		return;
-	
-	list_for_each_entry_safe(ptr, aux, &dentry->children, list) {
-		if (ptr->mode & S_IFDIR)
-			fsutils_dispose_tree(ptr);
-		else
-			fsutils_dispose_node(ptr);
-	}
-	fsutils_dispose_node(dentry);
+	fsutils_unlink(dentry);
+	epoch_retire(dentry, fsutils_reclaim_tree);
 }
 
 /**
- * Migrate children from 'source' to 'target'. Children whose dentry names
- * are already contained within 'target' are skipped. The moved dentries will
- * no longer be available in source's child list.
+ * Release the retired dentries which readers and the kernel are done with. The reclaim
+ * functions update the version list, so this takes the tree lock. Nothing happens if a
+ * parser holds it: the parser reclaims before letting it go.
+ * @priv: private data
+ */
+void fsutils_reclaim(struct demuxfs_data *priv)
+{
+	if (pthread_mutex_trylock(&priv->tree_lock))
+		return;
+	epoch_reclaim();
+	pthread_mutex_unlock(&priv->tree_lock);
+}
+
+/**
+ * Move the children of 'source', which hasn't been published, into 'target'.
+ * Directories which exist on both sides are merged, other entries from 'source'
+ * replace their namesakes in 'target'. Readers walking 'target' concurrently see
+ * either the old or the new entry at each position.
  * @source: source dentry
  * @target: target dentry
  */
-void fsutils_migrate_children(struct dentry *source, struct dentry *target)
+static void fsutils_merge_children(struct dentry *source, struct dentry *target)
 {
 	struct dentry *ptr_source, *ptr_target, *aux;
 
 	list_for_each_entry_safe(ptr_source, aux, &source->children, list) {
-		bool already_exists = false;
-		list_for_each_entry(ptr_target, &target->children, list)
-			if (! strcmp(ptr_target->name, ptr_source->name)) {
-				already_exists = true;
-				break;
+		ptr_target = fsutils_get_child(target, ptr_source->name);
+		list_del(&ptr_source->list);
+		if (! ptr_target) {
+			ptr_source->parent = target;
+			fsutils_link_dentry(target, ptr_source);
+		} else if (S_ISDIR(ptr_target->mode) && S_ISDIR(ptr_source->mode)) {
+			if (ptr_source->lazy && ptr_target->lazy)
+				fsutils_lazy_merge(ptr_source, ptr_target);
+			else
+				fsutils_merge_children(ptr_source, ptr_target);
+			fsutils_free_node(ptr_source);
+		} else {
+			fsutils_replace_dentry(ptr_target, ptr_source);
+			epoch_retire(ptr_target, fsutils_reclaim_tree);
+		}
+	}
+}
+
+/**
+ * Make a dentry which has been built off-line with CREATE_UNLINKED() visible. 
+ * When the previous version of that dentry is given, the new children are merged 
+ * into it instead and 'dentry' is released. Readers never see a half-built directory.
+ * @dentry: unpublished dentry
+ * @current: currently published dentry with the same name, or NULL
+ *
+ * Returns the dentry which is now published.
+ */
+struct dentry *fsutils_publish_dentry(struct dentry *dentry, struct dentry *current)
+{
+	struct dentry *parent = dentry->parent;
+
+	if (! current) {
+		if (dentry->obj_type != OBJ_TYPE_FIFO)
+			parent->size += dentry->size;
+		fsutils_link_dentry(parent, dentry);
+		fsutils_track_versions(dentry);
+		return dentry;
+	}
+	fsutils_merge_children(dentry, current);
+	fsutils_free_node(dentry);
+	fsutils_track_versions(current);
+	return current;
+}
+
+/*
+ * Lazy directories keep the raw sections they are made of instead of their children.
+ * The children are built by a populate function when the directory is first looked
+ * into, and released by fsutils_shrink_lazy() once too many dentries have been built
+ * that way, starting with the directories which haven't been used for the longest.
+ *
+ * FUSE threads build the children without taking the tree lock, as the parser thread
+ * holding it may be waiting for the kernel to invalidate an entry in that very
+ * directory. Instead, the children of a lazy directory are only added or released
+ * with lazy->mutex held, except by the parser threads once they have been built.
+ */
+struct lazy_section {
+	struct list_head list;
+	uint32_t len;
+	char data[];
+};
+
+struct dentry_lazy {
+	struct dentry *dentry;
+	fsutils_populate_function_t populate;
+	struct demuxfs_data *priv;
+	/* Raw sections, in the order they have been received */
+	struct list_head sections;
+	pthread_mutex_t mutex;
+	/* Whether the children have been built */
+	bool materialized;
+	/* Set on every use, cleared by fsutils_shrink_lazy() */
+	bool referenced;
+	/* Number of dentries under the directory */
+	unsigned long num_dentries;
+	/* Entry in the list of built directories */
+	struct list_head lru;
+};
+
+static LIST_HEAD(lazy_lru);
+static unsigned long lazy_lru_length;
+static pthread_mutex_t lazy_lru_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Number of dentries under all built lazy directories */
+static unsigned long lazy_dentries;
+
+static unsigned long fsutils_count_children(struct dentry *dentry)
+{
+	struct dentry *ptr;
+	unsigned long count = 0;
+
+	list_for_each_entry(ptr, &dentry->children, list)
+		count += 1 + (S_ISDIR(ptr->mode) ? fsutils_count_children(ptr) : 0);
+	return count;
+}
+
+/**
+ * Turn a directory which hasn't been published yet into a lazy one.
+ * @dentry: directory
+ * @populate: function which builds the children out of a raw section
+ * @payload: raw section, which is copied
+ * @payload_len: section length
+ * @priv: private data passed to 'populate'
+ */
+void fsutils_make_lazy(struct dentry *dentry, fsutils_populate_function_t populate,
+		const char *payload, uint32_t payload_len, struct demuxfs_data *priv)
+{
+	struct dentry_lazy *lazy = (struct dentry_lazy *) calloc(1, sizeof(struct dentry_lazy));
+	struct lazy_section *section = (struct lazy_section *) malloc(sizeof(struct lazy_section) + payload_len);
+	assert(lazy);
+	assert(section);
+
+	section->len = payload_len;
+	memcpy(section->data, payload, payload_len);
+	lazy->dentry = dentry;
+	lazy->populate = populate;
+	lazy->priv = priv;
+	INIT_LIST_HEAD(&lazy->sections);
+	INIT_LIST_HEAD(&lazy->lru);
+	pthread_mutex_init(&lazy->mutex, NULL);
+	list_add_tail(&section->list, &lazy->sections);
+	dentry->lazy = lazy;
+}
+
+static void fsutils_lazy_free(struct dentry_lazy *lazy)
+{
+	struct lazy_section *section, *aux;
+
+	pthread_mutex_lock(&lazy_lru_mutex);
+	if (! list_empty(&lazy->lru)) {
+		list_del(&lazy->lru);
+		lazy_lru_length--;
+	}
+	pthread_mutex_unlock(&lazy_lru_mutex);
+	__atomic_sub_fetch(&lazy_dentries, lazy->num_dentries, __ATOMIC_RELAXED);
+
+	list_for_each_entry_safe(section, aux, &lazy->sections, list)
+		free(section);
+	pthread_mutex_destroy(&lazy->mutex);
+	free(lazy);
+}
+
+/* Build the children of 'sections' off-line and merge them into the lazy directory */
+static void fsutils_lazy_build(struct dentry *dentry, struct list_head *sections)
+{
+	struct dentry_lazy *lazy = dentry->lazy;
+	struct dentry *scratch = fsutils_alloc_dentry(arena_new());
+	struct lazy_section *section;
+	unsigned long num_dentries;
+
+	/* The children get an arena of their own, released when they are */
+	scratch->name = fsutils_strdup(scratch, dentry->name);
+	scratch->mode = dentry->mode;
+	scratch->obj_type = dentry->obj_type;
+	scratch->versioned = dentry->versioned;
+	CREATE_UNLINKED(dentry->parent, scratch);
+	list_for_each_entry(section, sections, list)
+		lazy->populate(scratch, section->data, section->len, lazy->priv);
+
+	dentry->size += scratch->size;
+	fsutils_merge_children(scratch, dentry);
+	fsutils_free_node(scratch);
+
+	num_dentries = fsutils_count_children(dentry);
+	__atomic_add_fetch(&lazy_dentries, num_dentries - lazy->num_dentries, __ATOMIC_RELAXED);
+	lazy->num_dentries = num_dentries;
+}
+
+/* 
+ * Move 'sections' to the end of the sections of a lazy directory. A newer copy of a
+ * PSI section (same table_id, table_id_extension and section_number) replaces the
+ * older one, so that the list doesn't grow as table versions wrap around.
+ */
+static void fsutils_lazy_add_sections(struct dentry_lazy *lazy, struct list_head *sections)
+{
+	struct lazy_section *section, *aux, *old, *old_aux;
+
+	list_for_each_entry_safe(section, aux, sections, list) {
+		list_for_each_entry_safe(old, old_aux, &lazy->sections, list) {
+			if (old->len >= 8 && section->len >= 8 && old->data[0] == section->data[0] &&
+					old->data[3] == section->data[3] && old->data[4] == section->data[4] &&
+					old->data[6] == section->data[6]) {
+				list_del(&old->list);
+				free(old);
 			}
-		if (! already_exists) {
-			list_del(&ptr_source->list);
-			list_add_tail(&ptr_source->list, &target->children);
-		} else if (S_ISDIR(ptr_target->mode) && S_ISDIR(ptr_source->mode))
-			fsutils_migrate_children(ptr_source, ptr_target);
+		}
+		list_move_tail(&section->list, &lazy->sections);
+	}
+}
+
+/* Add the sections of 'source', which hasn't been published, to those of 'target' */
+static void fsutils_lazy_merge(struct dentry *source, struct dentry *target)
+{
+	struct dentry_lazy *lazy = target->lazy;
+	bool materialized;
+
+	pthread_mutex_lock(&lazy->mutex);
+	materialized = lazy->materialized;
+	if (! materialized)
+		fsutils_lazy_add_sections(lazy, &source->lazy->sections);
+	pthread_mutex_unlock(&lazy->mutex);
+	if (! materialized)
+		return;
+
+	/* Built directories are only released by the parser threads, so 'target' stays built meanwhile */
+	fsutils_lazy_build(target, &source->lazy->sections);
+	pthread_mutex_lock(&lazy->mutex);
+	fsutils_lazy_add_sections(lazy, &source->lazy->sections);
+	pthread_mutex_unlock(&lazy->mutex);
+}
+
+/**
+ * Build the children of a lazy directory if that hasn't been done yet, and keep them
+ * from being released until fsutils_lazy_put(). Does nothing for other dentries.
+ * @dentry: directory about to be looked into
+ */
+void fsutils_lazy_get(struct dentry *dentry)
+{
+	struct dentry_lazy *lazy = dentry->lazy;
+
+	if (! lazy)
+		return;
+	pthread_mutex_lock(&lazy->mutex);
+	__atomic_store_n(&lazy->referenced, true, __ATOMIC_RELAXED);
+	if (! lazy->materialized) {
+		fsutils_lazy_build(dentry, &lazy->sections);
+		lazy->materialized = true;
+		pthread_mutex_lock(&lazy_lru_mutex);
+		list_add_tail(&lazy->lru, &lazy_lru);
+		lazy_lru_length++;
+		pthread_mutex_unlock(&lazy_lru_mutex);
+	}
+}
+
+/**
+ * Allow the children of a lazy directory to be released again.
+ * @dentry: directory given to fsutils_lazy_get()
+ */
+void fsutils_lazy_put(struct dentry *dentry)
+{
+	if (dentry->lazy)
+		pthread_mutex_unlock(&dentry->lazy->mutex);
+}
+
+/* Whether the kernel holds a reference to the directory's children or the directory is open */
+static bool fsutils_lazy_is_busy(struct dentry *dentry)
+{
+	struct dentry *ptr;
+
+	if (__atomic_load_n(&dentry->refcount, __ATOMIC_ACQUIRE))
+		return true;
+	list_for_each_entry(ptr, &dentry->children, list)
+		if (fsutils_tree_is_busy(ptr))
+			return true;
+	return false;
+}
+
+/* Release the children of a lazy directory, which are built again on next use */
+static void fsutils_lazy_release(struct dentry *dentry)
+{
+	struct dentry_lazy *lazy = dentry->lazy;
+	struct dentry *ptr, *aux;
+
+	list_for_each_entry_safe(ptr, aux, &dentry->children, list)
+		fsutils_dispose_tree(ptr);
+	dentry->size = 0;
+	__atomic_sub_fetch(&lazy_dentries, lazy->num_dentries, __ATOMIC_RELAXED);
+	lazy->num_dentries = 0;
+	lazy->materialized = false;
+}
+
+/**
+ * Release the children of the lazy directories which haven't been used recently until
+ * no more than 'budget' dentries are left under them. Directories in use are skipped.
+ * Only to be called by the parser threads, with the tree lock held.
+ * @budget: number of dentries to keep
+ */
+void fsutils_shrink_lazy(unsigned long budget)
+{
+	struct dentry_lazy *lazy;
+	unsigned long scanned = 0;
+
+	if (__atomic_load_n(&lazy_dentries, __ATOMIC_RELAXED) <= budget)
+		return;
+
+	/* Second chance: directories used since the last pass are moved to the end */
+	pthread_mutex_lock(&lazy_lru_mutex);
+	while (__atomic_load_n(&lazy_dentries, __ATOMIC_RELAXED) > budget && 
+			! list_empty(&lazy_lru) && scanned++ < 2 * lazy_lru_length) {
+		lazy = list_entry(lazy_lru.next, struct dentry_lazy, lru);
+		list_move_tail(&lazy->lru, &lazy_lru);
+		if (__atomic_exchange_n(&lazy->referenced, false, __ATOMIC_RELAXED))
+			continue;
+		if (pthread_mutex_trylock(&lazy->mutex))
+			continue;
+		if (fsutils_lazy_is_busy(lazy->dentry)) {
+			pthread_mutex_unlock(&lazy->mutex);
+			continue;
+		}
+		list_del_init(&lazy->lru);
+		lazy_lru_length--;
+		/* Lazy directories are released by the parser threads only, so 'lazy' stays valid */
+		pthread_mutex_unlock(&lazy_lru_mutex);
+		fsutils_lazy_release(lazy->dentry);
+		pthread_mutex_unlock(&lazy->mutex);
+		pthread_mutex_lock(&lazy_lru_mutex);
+	}
+	pthread_mutex_unlock(&lazy_lru_mutex);
+}
+
+/*
+ * Version directories are kept in a list ordered by the last time they were found to
+ * be the current version of their table, oldest first. fsutils_shrink_versions() walks
+ * it to drop the versions beyond the number kept per table and, once all versions
+ * take more memory than allowed, the ones which have been replaced the longest ago.
+ * The current version of a table is never dropped.
+ *
+ * The list is only used by the parser threads, with the tree lock held. The counters
+ * and the size of each version are read by /.stats without locking.
+ */
+struct dentry_version {
+	struct dentry *dentry;
+	/* Value of version_clock when the version was last found to be current */
+	unsigned long long stamp;
+	/* Approximate memory taken by the version's dentries and contents */
+	size_t bytes;
+	/* Entry in version_lru, empty once the version is gone from the tree */
+	struct list_head lru;
+};
+
+static LIST_HEAD(version_lru);
+static unsigned long long version_clock;
+/* Value of version_clock at the end of the last fsutils_shrink_versions() */
+static unsigned long long version_clock_shrunk;
+static unsigned long version_count;
+static size_t version_bytes;
+
+/* Approximate memory taken by a tree. Lazy directories count their raw sections only */
+static size_t fsutils_tree_bytes(struct dentry *dentry)
+{
+	struct lazy_section *section;
+	struct dentry *ptr;
+	size_t bytes = sizeof(struct dentry) + strlen(dentry->name) + 1;
+
+	if (DEMUXFS_IS_NUMBER(dentry))
+		return sizeof(struct dentry_number);
+	if (dentry->contents && ! S_ISDIR(dentry->mode))
+		bytes += dentry->size;
+	if (dentry->lazy) {
+		list_for_each_entry(section, &dentry->lazy->sections, list)
+			bytes += sizeof(struct lazy_section) + section->len;
+		return bytes;
+	}
+	list_for_each_entry(ptr, &dentry->children, list)
+		bytes += fsutils_tree_bytes(ptr);
+	return bytes;
+}
+
+/* Whether a dentry can be reached from the root of the tree */
+static bool fsutils_is_reachable(struct dentry *dentry)
+{
+	while (dentry->parent) {
+		if (! fsutils_is_linked(dentry))
+			return false;
+		dentry = dentry->parent;
+	}
+	return true;
+}
+
+/* Take a version out of the accounting */
+static void fsutils_forget_version(struct dentry_version *version)
+{
+	if (list_empty(&version->lru))
+		return;
+	list_del_init(&version->lru);
+	__atomic_sub_fetch(&version_count, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&version_bytes, version->bytes, __ATOMIC_RELAXED);
+}
+
+/* Move a current version to the end of the list and update its size */
+static void fsutils_touch_version(struct dentry_version *version)
+{
+	size_t bytes = fsutils_tree_bytes(version->dentry);
+
+	fsutils_forget_version(version);
+	__atomic_store_n(&version->bytes, bytes, __ATOMIC_RELAXED);
+	version->stamp = ++version_clock;
+	list_add_tail(&version->lru, &version_lru);
+	__atomic_add_fetch(&version_count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&version_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/* Record the current version of each table found in a tree which has just been published */
+static void fsutils_track_versions(struct dentry *dentry)
+{
+	struct dentry *current, *ptr;
+
+	if (! S_ISDIR(dentry->mode))
+		return;
+	current = fsutils_get_current(dentry);
+	if (current && current->version)
+		fsutils_touch_version(current->version);
+	list_for_each_entry(ptr, &dentry->children, list)
+		if (S_ISDIR(ptr->mode) && ! ptr->version && ! ptr->lazy)
+			fsutils_track_versions(ptr);
+}
+
+static void fsutils_drop_version(struct dentry *dentry)
+{
+	fsutils_forget_version(dentry->version);
+	fsutils_dispose_tree(dentry);
+}
+
+/* Drop the oldest versions of a table until no more than 'keep_versions' are left */
+static void fsutils_retain_versions(struct dentry *table, unsigned int keep_versions)
+{
+	struct dentry *current = fsutils_get_current(table);
+	struct dentry *ptr, *oldest;
+	unsigned int count;
+
+	do {
+		count = 0;
+		oldest = NULL;
+		list_for_each_entry(ptr, &table->children, list) {
+			if (! S_ISDIR(ptr->mode) || ! ptr->version)
+				continue;
+			count++;
+			if (ptr != current && (! oldest || ptr->version->stamp < oldest->version->stamp))
+				oldest = ptr;
+		}
+		if (count <= keep_versions || ! oldest)
+			break;
+		fsutils_drop_version(oldest);
+	} while (true);
+}
+
+/**
+ * Drop old versions of the tables. Each table published since the last call keeps
+ * its 'keep_versions' most recent versions, then the versions which have been replaced
+ * the longest ago are dropped until all versions take no more than 'budget' bytes.
+ * Only to be called by the parser threads, with the tree lock held.
+ * @keep_versions: number of versions to keep per table, or 0 to keep them all
+ * @budget: memory all versions may take, or 0 for no limit
+ */
+void fsutils_shrink_versions(unsigned int keep_versions, size_t budget)
+{
+	struct dentry_version *version, *aux;
+
+	/* Versions found current since the last call are at the end of the list */
+	if (keep_versions) {
+		version = list_entry(version_lru.prev, struct dentry_version, lru);
+		while (&version->lru != &version_lru && version->stamp > version_clock_shrunk) {
+			/* Only older versions are dropped, so 'version' stays in the list */
+			if (fsutils_is_reachable(version->dentry))
+				fsutils_retain_versions(version->dentry->parent, keep_versions);
+			version = list_entry(version->lru.prev, struct dentry_version, lru);
+		}
+	}
+	version_clock_shrunk = version_clock;
+
+	if (! budget)
+		return;
+	list_for_each_entry_safe(version, aux, &version_lru, lru) {
+		if (version_bytes <= budget)
+			break;
+		if (! fsutils_is_reachable(version->dentry))
+			/* Disposed along with its table, just not released yet */
+			fsutils_forget_version(version);
+		else if (fsutils_get_current(version->dentry->parent) != version->dentry)
+			fsutils_drop_version(version->dentry);
 	}
 }
 
+/**
+ * Get the number of versions in the tree and the memory they take.
+ * @count: output number of versions
+ * @bytes: output number of bytes
+ */
+void fsutils_get_version_stats(unsigned long *count, size_t *bytes)
+{
+	*count = __atomic_load_n(&version_count, __ATOMIC_RELAXED);
+	*bytes = __atomic_load_n(&version_bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Report the versions kept by each table found under a directory. Must be called
+ * from a read-side section.
+ * @dentry: directory to start at
+ * @report: function called for each table
+ * @data: private data passed to 'report'
+ */
+void fsutils_walk_versions(struct dentry *dentry, fsutils_version_report_t report, void *data)
+{
+	struct dentry *ptr;
+	unsigned int count = 0;
+	size_t bytes = 0;
+
+	list_for_each_entry_rcu(ptr, &dentry->children, list) {
+		if (! S_ISDIR(ptr->mode))
+			continue;
+		if (ptr->version) {
+			count++;
+			bytes += __atomic_load_n(&ptr->version->bytes, __ATOMIC_RELAXED);
+		} else if (! ptr->lazy)
+			fsutils_walk_versions(ptr, report, data);
+	}
+	if (count)
+		report(dentry, count, bytes, data);
+}
+
 #define TRUNCATE_STRING(end) do { if ((end)) *(end) = '\0'; } while(0)
 #define RESTORE_STRING(end)  do { if ((end)) *(end) =  '/'; } while(0)
 
@@ -239,12 +1243,18 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target)
  */
 struct dentry * fsutils_get_child(struct dentry *dentry, const char *name)
 {
+	struct dentry_index *index;
 	struct dentry *ptr;
 	if (! strcmp(name, "."))
 		return dentry;
 	if (! strcmp(name, ".."))
 		return dentry->parent ? dentry->parent : dentry;
-	list_for_each_entry(ptr, &dentry->children, list)
+	if (DEMUXFS_IS_NUMBER(dentry))
+		return NULL;
+	index = __atomic_load_n(&dentry->index, __ATOMIC_ACQUIRE);
+	if (index)
+		return fsutils_index_lookup(index, name);
+	list_for_each_entry_rcu(ptr, &dentry->children, list)
 		if (! strcmp(ptr->name, name))
 			return ptr;
 	return NULL;
@@ -299,9 +1309,9 @@ struct dentry * fsutils_get_dentry(struct dentry *root, const char *cpath)
 		}
 		RESTORE_STRING(end);
 
-		if (prev->mode & S_IFLNK) {
+		if (S_ISLNK(prev->mode)) {
 			/* Follow symlink */
-			cached = fsutils_get_dentry(prev, prev->contents);
+			cached = fsutils_get_dentry(prev, __atomic_load_n(&prev->contents, __ATOMIC_ACQUIRE));
 			if (cached) {
 				prev = cached;
 				start--;
@@ -314,24 +1324,30 @@ struct dentry * fsutils_get_dentry(struct dentry *root, const char *cpath)
 	return prev;
 }
 
+/**
+ * Given a subtree and an inode number, return a pointer to the dentry with that inode.
+ * @root: subtree to search
+ * @inode: inode number
+ *
+ * Returns the dentry on success or NULL if no such dentry is linked under 'root'.
+ */
 struct dentry * fsutils_find_by_inode(struct dentry *root, ino_t inode)
 {
-	struct dentry *ptr, *ret = NULL;
+	struct dentry *ptr;
 	
 	if (! root)
 		return NULL;
 	else if (root->inode == inode)
 		return root;
+	else if (! inode || ! inode_table)
+		return NULL;
 
-	list_for_each_entry(ptr, &root->children, list) {
-		if (ptr->mode & S_IFDIR)
-			ret = fsutils_find_by_inode(ptr, inode);
-		else if (ptr->inode == inode)
-			ret = ptr;
-		if (ret)
-			return ret;
-	}
-	return NULL;
+	hashtable_lock(inode_table);
+	ptr = (struct dentry *) hashtable_get(inode_table, inode);
+	while (ptr && ! fsutils_is_descendant(ptr, root))
+		ptr = ptr->inode_next;
+	hashtable_unlock(inode_table);
+	return ptr;
 }
 
 struct dentry * fsutils_create_version_dir(struct dentry *parent, int version)
@@ -341,18 +1357,29 @@ struct dentry * fsutils_create_version_dir(struct dentry *parent, int version)
 	struct dentry *current;
 
 	snprintf(version_dir, sizeof(version_dir), "Version_%d", version);
-	child = CREATE_DIRECTORY(parent, version_dir);
+	child = fsutils_get_child(parent, version_dir);
+	if (! child) {
+		/* Everything in the new version is allocated from its arena */
+		child = fsutils_alloc_dentry(arena_new());
+		child->name = fsutils_strdup(child, version_dir);
+		child->mode = S_IFDIR | 0555;
+		child->obj_type = OBJ_TYPE_DIR;
+		CREATE_COMMON(parent, child);
+	}
+	child->versioned = true;
+	if (! child->version) {
+		child->version = (struct dentry_version *) calloc(1, sizeof(struct dentry_version));
+		assert(child->version);
+		child->version->dentry = child;
+		INIT_LIST_HEAD(&child->version->lru);
+	}
 	
 	/* Update the 'Current' symlink if it exists or create a new symlink if it doesn't */
 	current = fsutils_get_child(parent, FS_CURRENT_NAME);
 	if (! current)
 		current = CREATE_SYMLINK(parent, FS_CURRENT_NAME, version_dir);
-	else {
-		pthread_mutex_lock(&current->mutex);
-		free(current->contents);
-		current->contents = strdup(version_dir);
-		pthread_mutex_unlock(&current->mutex);
-	}
+	else
+		fsutils_update_symlink(current, version_dir);
 
 	return child;
 }
@@ -365,3 +1392,83 @@ struct dentry * fsutils_get_current(struct dentry *parent)
 		target = fsutils_get_child(parent, current->contents);
 	return target;
 }
+
+/**
+ * Point a symlink to a new target.
+ * @dentry: symlink
+ * @target: new target
+ */
+void fsutils_update_symlink(struct dentry *dentry, const char *target)
+{
+	/* Readers follow the symlink without locking it, so swap the target in one step */
+	char *old_contents = dentry->contents;
+	pthread_mutex_lock(&dentry->mutex);
+	__atomic_store_n(&dentry->contents, strdup(target), __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dentry->mutex);
+	demuxfs_invalidate_inode(dentry);
+	epoch_retire(old_contents, epoch_free);
+}
+
+/**
+ * Create a hard link. The kernel only ever sees the target: lookups through the
+ * link return the target's inode. The target isn't part of the tree, and is retired
+ * when its last link is released.
+ * @parent: directory to create the link in
+ * @target: dentry to link to, which may be a link itself
+ *
+ * Returns the link.
+ */
+struct dentry *fsutils_create_hardlink(struct dentry *parent, struct dentry *target)
+{
+	struct dentry *dentry = fsutils_new_dentry(parent);
+
+	if (target->hardlink)
+		target = target->hardlink;
+	dentry->name = fsutils_strdup(dentry, target->name);
+	dentry->mode = target->mode;
+	dentry->obj_type = target->obj_type;
+	dentry->hardlink = target;
+	__atomic_add_fetch(&target->nlinks, 1, __ATOMIC_RELAXED);
+	CREATE_COMMON(parent, dentry);
+	return dentry;
+}
+
+/**
+ * Create a FIFO which several table versions can share. The FIFO itself isn't part of
+ * the tree: 'parent' gets a hard link to it, and so can later versions of the table
+ * with fsutils_create_hardlink(). It is released once all links are gone and the kernel
+ * has forgotten it.
+ * @parent: directory to create the link in
+ * @obj_type: OBJ_TYPE_FIFO, OBJ_TYPE_AUDIO_FIFO or OBJ_TYPE_VIDEO_FIFO
+ * @name: FIFO name
+ * @path: path the FIFO is written to, which must remain valid across versions
+ *
+ * Returns the link.
+ */
+struct dentry *fsutils_create_shared_fifo(struct dentry *parent, int obj_type, const char *name,
+		const char *path)
+{
+	struct dentry *fifo = fsutils_alloc_dentry(NULL);
+	assert(fifo);
+
+	fifo->name = strdup(name);
+	fifo->size = fifo_get_default_size();
+	fifo->mode = fifo_get_type() | 0777;
+	fifo->obj_type = obj_type;
+	if (obj_type == OBJ_TYPE_VIDEO_FIFO || obj_type == OBJ_TYPE_AUDIO_FIFO) {
+		struct av_fifo_priv *priv = (struct av_fifo_priv *) calloc(1, sizeof(struct av_fifo_priv));
+		assert(priv);
+		priv->fifo = fifo_init();
+		fifo_set_path(priv->fifo, (char *) path);
+		fifo->priv = priv;
+	} else {
+		struct fifo_priv *priv = (struct fifo_priv *) calloc(1, sizeof(struct fifo_priv));
+		assert(priv);
+		priv->fifo = fifo_init();
+		fifo_set_path(priv->fifo, (char *) path);
+		fifo->priv = priv;
+	}
+	INITIALIZE_DENTRY_UNLINKED(fifo);
+	INIT_LIST_HEAD(&fifo->list);
+	return fsutils_create_hardlink(parent, fifo);
+}
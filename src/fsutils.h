@@ -2,6 +2,7 @@
 #define __fsutils_h
 
 #define FS_DEFAULT_TMPDIR               "/tmp"
+#define FS_DEFAULT_LAZY_BUDGET          32768
 
 #define FS_ES_FIFO_NAME                 "ES"
 #define FS_PES_FIFO_NAME                "PES"
@@ -63,9 +64,42 @@ struct dentry *fsutils_find_by_inode(struct dentry *root, ino_t inode);
 struct dentry *fsutils_get_current(struct dentry *parent);
 struct dentry *fsutils_create_dentry(const char *path, mode_t mode);
 struct dentry *fsutils_create_version_dir(struct dentry *parent, int version);
+void fsutils_update_symlink(struct dentry *dentry, const char *target);
+struct dentry *fsutils_create_hardlink(struct dentry *parent, struct dentry *target);
+struct dentry *fsutils_create_shared_fifo(struct dentry *parent, int obj_type, const char *name,
+		const char *path);
 void fsutils_dispose_tree(struct dentry *dentry);
+void fsutils_reclaim(struct demuxfs_data *priv);
 void fsutils_dispose_node(struct dentry *dentry);
-void fsutils_migrate_children(struct dentry *source, struct dentry *target);
+struct dentry *fsutils_publish_dentry(struct dentry *dentry, struct dentry *current);
+void fsutils_link_dentry(struct dentry *parent, struct dentry *dentry);
+void fsutils_move_dentry(struct dentry *dentry, struct dentry *parent);
+void fsutils_rename_dentry(struct dentry *dentry, const char *name);
+void fsutils_destroy(void);
+struct dentry *fsutils_new_dentry(struct dentry *parent);
+char *fsutils_strdup(struct dentry *dentry, const char *str);
+int fsutils_format_number(struct dentry *dentry, char *buf, size_t size);
+struct dentry *fsutils_create_number(struct dentry *parent, const char *name, uint64_t value);
+void fsutils_update_number(struct dentry *dentry, uint64_t value);
+ssize_t fsutils_get_size(struct dentry *dentry);
+
+/* Builds the children of a lazy directory out of one of its raw sections */
+typedef void (*fsutils_populate_function_t)(struct dentry *dentry, const char *payload,
+		uint32_t payload_len, struct demuxfs_data *priv);
+
+void fsutils_make_lazy(struct dentry *dentry, fsutils_populate_function_t populate,
+		const char *payload, uint32_t payload_len, struct demuxfs_data *priv);
+void fsutils_lazy_get(struct dentry *dentry);
+void fsutils_lazy_put(struct dentry *dentry);
+void fsutils_shrink_lazy(unsigned long budget);
+
+/* Called with a table directory, the number of versions it holds and their size */
+typedef void (*fsutils_version_report_t)(struct dentry *table, unsigned int count,
+		size_t bytes, void *data);
+
+void fsutils_shrink_versions(unsigned int keep_versions, size_t budget);
+void fsutils_get_version_stats(unsigned long *count, size_t *bytes);
+void fsutils_walk_versions(struct dentry *dentry, fsutils_version_report_t report, void *data);
 
 /* Macros to ease the creation of files and directories */
 #define INITIALIZE_DENTRY_UNLINKED(_dentry) \
@@ -78,7 +112,13 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	if ((_dentry)->obj_type != OBJ_TYPE_FIFO) \
 		_parent->size += (_dentry)->size; \
 	(_dentry)->parent = _parent; \
-	list_add_tail(&(_dentry)->list, &((_parent)->children));
+	fsutils_link_dentry(_parent, _dentry);
+
+/* Prepare a dentry to be built off-line and linked later with fsutils_publish_dentry() */
+#define CREATE_UNLINKED(_parent,_dentry) \
+	INITIALIZE_DENTRY_UNLINKED(_dentry); \
+	INIT_LIST_HEAD(&(_dentry)->list); \
+	(_dentry)->parent = _parent;
 
 #define UPDATE_COMMON(_dentry,_new_contents,_new_size) \
  	pthread_mutex_lock(&_dentry->mutex); \
@@ -91,20 +131,16 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
  		_dentry->size = _new_size; \
  	} else \
  		memcpy(_dentry->contents, _new_contents, _dentry->size); \
- 	pthread_mutex_unlock(&_dentry->mutex);
+ 	pthread_mutex_unlock(&_dentry->mutex); \
+ 	demuxfs_invalidate_inode(_dentry);
 
 #define UPDATE_NAME(_dentry,_name) \
-	free(_dentry->name); \
-	_dentry->name = strdup(_name)
+	fsutils_rename_dentry(_dentry, _name)
 
+/* Moving dentries around is only safe in trees which haven't been published yet */
 #define UPDATE_PARENT(_dentry,_parent) \
-	if (_dentry->parent != _parent) { \
-		list_del(&(_dentry)->list); \
- 		if ((_dentry)->obj_type != OBJ_TYPE_FIFO) \
- 			_parent->size += (_dentry)->size; \
- 		(_dentry)->parent = _parent; \
-		list_add_tail(&(_dentry)->list, &_parent->children); \
-	}
+	if (_dentry->parent != _parent) \
+		fsutils_move_dentry(_dentry, _parent);
 
 #define CREATE_FILE_BIN(parent,header,member,_size) \
 	({ \
@@ -112,10 +148,10 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	if (_dentry) { \
 	 		UPDATE_COMMON(_dentry, (header)->member, _size); \
 		} else { \
-	 		_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
+	 		_dentry = fsutils_new_dentry(parent); \
 	 		_dentry->contents = malloc(_size); \
 	 		memcpy(_dentry->contents, (header)->member, _size); \
-			_dentry->name = strdup((char *) #member); \
+			_dentry->name = fsutils_strdup(_dentry, #member); \
 			_dentry->size = _size; \
 			_dentry->mode = S_IFREG | 0444; \
 	 		_dentry->obj_type = OBJ_TYPE_FILE; \
@@ -125,28 +161,15 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	_dentry; \
 	})
 
+/* Numeric files keep the value only, and their name points to the member's name */
 #define CREATE_FILE_NUMBER(_parent,header,member) \
 	({ \
 	 	uint64_t member64 = (uint64_t) (header)->member; \
 	 	struct dentry *_dentry = fsutils_get_child((_parent), #member); \
-	 	if (_dentry) { \
-	 		pthread_mutex_lock(&_dentry->mutex); \
-	 		free(_dentry->contents); \
-			asprintf(&_dentry->contents, "%#04llx", member64); \
-			_dentry->parent->size -= _dentry->size; \
-			_dentry->size = strlen(_dentry->contents); \
-			_dentry->parent->size += _dentry->size; \
-	 		pthread_mutex_unlock(&_dentry->mutex); \
-	 	} else { \
-			_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
-			asprintf(&_dentry->contents, "%#04llx", member64); \
-			_dentry->name = strdup(#member); \
-			_dentry->size = strlen(_dentry->contents); \
-			_dentry->mode = S_IFREG | 0444; \
-	 		_dentry->obj_type = OBJ_TYPE_FILE; \
-			CREATE_COMMON((_parent),_dentry); \
-			xattr_add(_dentry, XATTR_FORMAT, XATTR_FORMAT_NUMBER, strlen(XATTR_FORMAT_NUMBER), false); \
-	 	} \
+	 	if (_dentry) \
+	 		fsutils_update_number(_dentry, member64); \
+	 	else \
+			_dentry = fsutils_create_number((_parent), #member, member64); \
 	 	_dentry; \
 	})
 
@@ -156,9 +179,9 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	if (_dentry) { \
 	 		UPDATE_COMMON(_dentry, (header)->member, strlen((header)->member)); \
 	 	} else { \
-			_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
+			_dentry = fsutils_new_dentry(_parent); \
 			_dentry->contents = strdup((header)->member); \
-			_dentry->name = strdup(#member); \
+			_dentry->name = fsutils_strdup(_dentry, #member); \
 			_dentry->size = strlen(_dentry->contents); \
 			_dentry->mode = S_IFREG | 0444; \
 	 		_dentry->obj_type = OBJ_TYPE_FILE; \
@@ -173,9 +196,9 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	    struct dentry *_dentry = fsutils_find_by_inode(_parent, _inode); \
 	 	if (! _dentry) _dentry = fsutils_get_child(_parent, _name); \
 	 	if (! _dentry || _dentry->inode != _inode) { \
-	 		_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
+	 		_dentry = fsutils_new_dentry(_parent); \
 	 		_dentry->contents = _size ? malloc(_size) : NULL; \
-			_dentry->name = strdup(_name); \
+			_dentry->name = fsutils_strdup(_dentry, _name); \
 			_dentry->size = _size; \
 	 		_dentry->inode = _inode; \
 			_dentry->mode = S_IFREG | 0444; \
@@ -193,9 +216,9 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	({ \
 	 	struct dentry *_dentry = fsutils_get_child(parent, sname); \
 	 	if (! _dentry) { \
-			struct dentry *_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
+			struct dentry *_dentry = fsutils_new_dentry(parent); \
 			_dentry->contents = strdup(target); \
-			_dentry->name = strdup(sname); \
+			_dentry->name = fsutils_strdup(_dentry, sname); \
 	 		_dentry->obj_type = OBJ_TYPE_SYMLINK; \
 			_dentry->mode = S_IFLNK | 0777; \
 			CREATE_COMMON((parent),_dentry); \
@@ -209,8 +232,8 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	if (! _dentry) { \
 	 		char _path2es[PATH_MAX]; \
 	 		struct snapshot_priv *_priv = (struct snapshot_priv *) calloc(1, sizeof(struct snapshot_priv)); \
-			_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
-			_dentry->name = strdup(fname); \
+			_dentry = fsutils_new_dentry(parent); \
+			_dentry->name = fsutils_strdup(_dentry, fname); \
 			_dentry->mode = S_IFREG | 0444; \
 	 		_dentry->size = 0xffffff; \
 	 		_dentry->obj_type = OBJ_TYPE_SNAPSHOT; \
@@ -228,9 +251,9 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	struct dentry *_dentry = fsutils_get_child(parent, fname); \
 	 	struct fifo *_fifo; \
 	 	if (! _dentry) { \
-	 		_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
+	 		_dentry = fsutils_new_dentry(parent); \
 	 		_dentry->size = fifo_get_default_size(); \
-	 		_dentry->name = strdup(fname); \
+	 		_dentry->name = fsutils_strdup(_dentry, fname); \
 	 		_dentry->mode = fifo_get_type() | 0777; \
 	 		_dentry->obj_type = ftype; \
 	 		if (ftype == OBJ_TYPE_VIDEO_FIFO || ftype == OBJ_TYPE_AUDIO_FIFO) { \
@@ -255,18 +278,14 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	 	snprintf(_dbuf, sizeof(_dbuf), _dname); \
 	 	_dentry = fsutils_get_child(_parent, _dbuf); \
 	 	if (! _dentry) { \
-			_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
-			_dentry->name = strdup(_dbuf); \
+			_dentry = fsutils_new_dentry(_parent); \
+			_dentry->name = fsutils_strdup(_dentry, _dbuf); \
 			_dentry->mode = S_IFDIR | 0555; \
 	 		_dentry->obj_type = OBJ_TYPE_DIR; \
 			CREATE_COMMON((_parent),_dentry); \
 	 	} else if (_dentry->parent != _parent) { \
 	 		/* Update parent */ \
-	 		list_del(&_dentry->list); \
-	 		if ((_dentry)->obj_type != OBJ_TYPE_FIFO) \
-	 			_parent->size += (_dentry)->size; \
-	 		(_dentry)->parent = _parent; \
-	 		list_add_tail(&(_dentry)->list, &((_parent)->children)); \
+	 		fsutils_move_dentry(_dentry, _parent); \
 	 	} \
 	 	_dentry; \
 	})
@@ -276,19 +295,15 @@ void fsutils_migrate_children(struct dentry *source, struct dentry *target);
 	    struct dentry *_dentry = fsutils_find_by_inode(_parent, _inode); \
 	 	if (! _dentry) _dentry = fsutils_get_child(_parent, _dname); \
 	 	if (! _dentry || _dentry->inode != _inode) { \
-			_dentry = (struct dentry *) calloc(1, sizeof(struct dentry)); \
-			_dentry->name = strdup(_dname); \
+			_dentry = fsutils_new_dentry(_parent); \
+			_dentry->name = fsutils_strdup(_dentry, _dname); \
 			_dentry->mode = S_IFDIR | 0555; \
 	 		_dentry->obj_type = OBJ_TYPE_DIR; \
 	 		_dentry->inode = _inode; \
 			CREATE_COMMON((_parent),_dentry); \
 	 	} else if (_dentry->parent != _parent) { \
 	 		/* Update parent */ \
-	 		list_del(&_dentry->list); \
-	 		if ((_dentry)->obj_type != OBJ_TYPE_FIFO) \
-	 			_parent->size += (_dentry)->size; \
-	 		(_dentry)->parent = _parent; \
-	 		list_add_tail(&(_dentry)->list, &((_parent)->children)); \
+	 		fsutils_move_dentry(_dentry, _parent); \
 	 	} \
 	 	_dentry; \
 	})
@@ -29,6 +29,9 @@
 #include "demuxfs.h"
 #include "hash.h"
 
+/* Smallest table allocated by hashtable_new() */
+#define HASHTABLE_MIN_SIZE 16
+
 void hashtable_lock(struct hash_table *hash)
 {
 	pthread_mutex_lock(&hash->mutex);
@@ -39,12 +42,64 @@ void hashtable_unlock(struct hash_table *hash)
 	pthread_mutex_unlock(&hash->mutex);
 }
 
+/**
+ * Keys are often small sequential numbers (PIDs, inodes) or have their entropy in the
+ * upper bits (section keys), so mix all 64 bits before masking the slot index.
+ */
+static inline uint32_t hashtable_index(struct hash_table *table, ino_t key)
+{
+	uint64_t h = (uint64_t) key;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h & (table->size - 1);
+}
+
+/**
+ * Find the slot holding @key, or the empty slot which ends its probe chain.
+ */
+static struct hash_item *hashtable_find(struct hash_table *table, ino_t key)
+{
+	uint32_t mask = table->size - 1;
+	uint32_t index = hashtable_index(table, key);
+
+	while (table->items[index].used && table->items[index].key != key)
+		index = (index + 1) & mask;
+	return &table->items[index];
+}
+
+static bool hashtable_resize(struct hash_table *table, int size)
+{
+	struct hash_item *old_items = table->items;
+	int i, old_size = table->size;
+
+	table->items = (struct hash_item *) calloc(size, sizeof(struct hash_item));
+	if (! table->items) {
+		table->items = old_items;
+		return false;
+	}
+	table->size = size;
+	for (i=0; i<old_size; ++i)
+		if (old_items[i].used)
+			*hashtable_find(table, old_items[i].key) = old_items[i];
+	free(old_items);
+	return true;
+}
+
+/**
+ * hashtable_new - Create a hash table.
+ * @size: number of items expected. The table grows as needed.
+ */
 struct hash_table *hashtable_new(int size)
 {
 	struct hash_table *table = (struct hash_table *) calloc(1, sizeof(struct hash_table));
 	assert(table);
-	table->size = size;
-	table->items = (struct hash_item **) calloc(size, sizeof(struct hash_item *));
+	table->size = HASHTABLE_MIN_SIZE;
+	while (table->size < size)
+		table->size <<= 1;
+	table->items = (struct hash_item *) calloc(table->size, sizeof(struct hash_item));
 	assert(table->items);
 	pthread_mutex_init(&table->mutex, NULL);
 	return table;
@@ -55,103 +110,71 @@ void hashtable_destroy(struct hash_table *table, hashtable_free_function_t free_
 	int i;
 	pthread_mutex_destroy(&table->mutex);
 	for (i=0; i<table->size; ++i) {
-		struct hash_item *item = table->items[i];
-		if (item) {
+		struct hash_item *item = &table->items[i];
+		if (item->used) {
 			if (item->free_function && item->data)
 				item->free_function(item->data);
 			else if (free_function && item->data)
 				free_function(item->data);
-			free(item);
-			table->items[i] = NULL;
 		}
 	}
 	free(table->items);
 	free(table);
 }
 
-void hashtable_invalidate_contents(struct hash_table *table)
-{
-	int i;
-	pthread_mutex_destroy(&table->mutex);
-	for (i=0; i<table->size; ++i) {
-		struct hash_item *item = table->items[i];
-		if (item) {
-			item->data = NULL;
-			table->items[i] = NULL;
-		}
-	}
-}
-
 void *hashtable_get(struct hash_table *table, ino_t key)
 {
-	int index = key % table->size;
-	struct hash_item *item = table->items[index];
-	struct hash_item *start = item;
-	do {
-		if (! item)
-			return NULL;
-		else if (item->key == key)
-			return item->data;
-		else {
-			index = (index+1) % table->size;
-			item = table->items[index];
-		}
-	} while (item != start);
-	return NULL;
+	struct hash_item *item = hashtable_find(table, key);
+	return item->used ? item->data : NULL;
 }
 
 bool hashtable_add(struct hash_table *table, ino_t key, void *data, hashtable_free_function_t free_function)
 {
-	int index = key % table->size;
-	struct hash_item *item = table->items[index];
-	struct hash_item *start = item;
-	do {
-		if (item == NULL) {
-			item = (struct hash_item *) calloc(1, sizeof(struct hash_item));
-			item->key = key;
-			item->data = data;
-			item->free_function = free_function;
-			table->items[index] = item;
-			return true;
-		} else if (item->key == key) {
-			dprintf("overwriting previous contents (key=%#llx)", key);
-			item->key = key;
-			item->data = data;
-			item->free_function = free_function;
-			return true;
-		} else {
-			index = (index+1) % table->size;
-			item = table->items[index];
-		}
-	} while (item != start);
-	return false;
-}
+	struct hash_item *item;
 
-void _hashtable_del_item(struct hash_item *item)
-{
-	if (item) {
-		if (item->free_function && item->data)
-			item->free_function(item->data);
-		free(item);
-	}
+	/* Keep the load factor under 3/4 so that probe chains stay short */
+	if ((table->count + 1) * 4 > table->size * 3 && ! hashtable_resize(table, table->size * 2))
+		return false;
+
+	item = hashtable_find(table, key);
+	if (item->used)
+		dprintf("overwriting previous contents (key=%#llx)", (unsigned long long) key);
+	else
+		table->count++;
+	item->key = key;
+	item->data = data;
+	item->free_function = free_function;
+	item->used = true;
+	return true;
 }
 
 bool hashtable_del(struct hash_table *table, ino_t key)
 {
-	int index = key % table->size;
-	struct hash_item *item = table->items[index];
-	struct hash_item *start = item;
-	do {
-		if (! item) 
-			return true;
-		else if (item->key == key) {
-			_hashtable_del_item(item);
-			table->items[index] = NULL;
-			return true;
-		} else {
-			index = (index+1) % table->size;
-			item = table->items[index];
+	uint32_t mask = table->size - 1;
+	struct hash_item *item = hashtable_find(table, key);
+	uint32_t hole, index, home;
+
+	if (! item->used)
+		return true;
+	if (item->free_function && item->data)
+		item->free_function(item->data);
+
+	/* 
+	 * Backward shift: move the following items of the probe chain into the hole
+	 * unless that would put them before their home slot.
+	 */
+	hole = index = item - table->items;
+	for (;;) {
+		index = (index + 1) & mask;
+		if (! table->items[index].used)
+			break;
+		home = hashtable_index(table, table->items[index].key);
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			table->items[hole] = table->items[index];
+			hole = index;
 		}
-	} while (item != start);
-	return false;
+	}
+	memset(&table->items[hole], 0, sizeof(struct hash_item));
+	table->count--;
+	return true;
 }
@@ -7,17 +7,25 @@ struct hash_item {
 	ino_t key;
 	void *data;
 	hashtable_free_function_t free_function;
+	bool used;
 };
 
+/**
+ * Open addressing hash table with linear probing. Items are stored inline in a
+ * power-of-two array which doubles in size when it gets 3/4 full. Deletion shifts
+ * the following items of the probe chain back, so no tombstones are needed.
+ */
 struct hash_table {
+	/* Number of slots, always a power of two */
 	int size;
+	/* Number of slots in use */
+	int count;
 	pthread_mutex_t mutex;
-	struct hash_item **items;
+	struct hash_item *items;
 };
 
 struct hash_table *hashtable_new(int size);
 void hashtable_destroy(struct hash_table *table, hashtable_free_function_t free_function);
-void hashtable_invalidate_contents(struct hash_table *table);
 void *hashtable_get(struct hash_table *table, ino_t key);
 bool hashtable_add(struct hash_table *table, ino_t key, void *data, hashtable_free_function_t free_function);
 bool hashtable_del(struct hash_table *table, ino_t key);
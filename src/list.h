@@ -203,6 +203,63 @@ static inline void list_move_tail(struct list_head *list,
         list_add_tail(list, head);
 }
 
+/*
+ * RCU-style variants. Writers must be serialized by the caller; readers walk the
+ * list with list_for_each_entry_rcu() without taking any lock. Entries are fully
+ * initialized before they become reachable, and removed entries keep their next
+ * pointer so that a reader standing on them can still finish its walk. Removed
+ * entries must not be freed until all readers which could see them are gone.
+ */
+
+/**
+ * list_add_tail_rcu - publish a new entry at the end of a list
+ * @new: new entry to be added, already initialized
+ * @head: list head to add it before
+ */
+static inline void list_add_tail_rcu(struct list_head *new, struct list_head *head)
+{
+	struct list_head *prev = head->prev;
+
+	new->next = head;
+	new->prev = prev;
+	__atomic_store_n(&prev->next, new, __ATOMIC_RELEASE);
+	head->prev = new;
+}
+
+/**
+ * list_del_rcu - unpublish an entry, leaving its next pointer intact
+ * @entry: the element to delete from the list
+ */
+static inline void list_del_rcu(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	__atomic_store_n(&entry->prev->next, entry->next, __ATOMIC_RELEASE);
+	entry->prev = LIST_POISON2;
+}
+
+/**
+ * list_replace_rcu - replace an entry by a new one in a single step
+ * @old: the element to be replaced
+ * @new: the new element to insert, already initialized
+ */
+static inline void list_replace_rcu(struct list_head *old, struct list_head *new)
+{
+	new->next = old->next;
+	new->prev = old->prev;
+	__atomic_store_n(&new->prev->next, new, __ATOMIC_RELEASE);
+	new->next->prev = new;
+	old->prev = LIST_POISON2;
+}
+
+/*
+ * list_unlinked - tests whether an entry has been removed with list_del_rcu()
+ * or list_replace_rcu()
+ */
+static inline int list_unlinked(struct list_head *entry)
+{
+	return entry->prev == LIST_POISON2;
+}
+
 /**
  * list_is_last - tests whether @list is the last entry in list @head
  * @list: the entry to test
@@ -344,6 +401,17 @@ static inline void list_splice_init(struct list_head *list,
 	     &pos->member != (head); 	\
 	     pos = list_entry(pos->member.next, typeof(*pos), member))
 
+/**
+ * list_for_each_entry_rcu	-	iterate over a list which writers may change concurrently
+ * @pos:	the type * to use as a loop cursor.
+ * @head:	the head for your list.
+ * @member:	the name of the list_struct within the struct.
+ */
+#define list_for_each_entry_rcu(pos, head, member)			\
+	for (pos = list_entry(__atomic_load_n(&(head)->next, __ATOMIC_ACQUIRE), typeof(*pos), member); \
+	     &pos->member != (head); 	\
+	     pos = list_entry(__atomic_load_n(&pos->member.next, __ATOMIC_ACQUIRE), typeof(*pos), member))
+
 /**
  * list_for_each_entry_reverse - iterate backwards over list of given type.
  * @pos:	the type * to use as a loop cursor.
@@ -30,47 +30,129 @@
 #include "fsutils.h"
 #include "xattr.h"
 #include "buffer.h"
+#include "crc32.h"
 #include "hash.h"
 #include "fifo.h"
 #include "ts.h"
 #include "backend.h"
 #include "snapshot.h"
+#include "stats.h"
+#include "ring.h"
+#include "pipeline.h"
 #include "tables/descriptors/descriptors.h"
 #include "dsm-cc/descriptors/descriptors.h"
 
 /* Defined in demuxfs.c */
-extern struct fuse_operations demuxfs_ops;
+extern struct fuse_lowlevel_ops demuxfs_ops;
 
 /* Globals */
 static bool main_thread_stopped;
 
+/**
+ * Parse a batch in this thread, or hand it to the parser pipeline if one is running.
+ * Returns a negative error code if parsing cannot go on.
+ */
+static int ts_process_batch(struct ts_packet_vec *vec, struct ts_parser_context *ctx, struct demuxfs_data *priv)
+{
+	if (priv->pipeline)
+		return pipeline_dispatch(priv->pipeline, vec, priv);
+	return ts_parse_batch(vec, ctx, priv);
+}
+
+/**
+ * ts_reader_thread: reads packets from the input and queues them for the TS parser thread.
+ * @userdata: private data
+ */
+void * ts_reader_thread(void *userdata)
+{
+	struct demuxfs_data *priv = (struct demuxfs_data *) userdata;
+	struct ts_packet_vec *vec;
+	int ret;
+
+	vec = backend_packet_vec_new(BACKEND_BATCH_PACKETS);
+	if (! vec) {
+		dprintf("Not enough memory to allocate the packet vector");
+		ring_close(priv->ring);
+		pthread_exit(NULL);
+	}
+
+	while (priv->backend->keep_alive(priv) && !main_thread_stopped) {
+		ret = priv->backend->read_batch(vec, priv);
+		if (ret < 0) {
+			if (ret != -ENODATA)
+				dprintf("read error");
+			break;
+		}
+		if (vec->count == 0)
+			continue;
+		ret = ring_push(priv->ring, vec, priv->options.packet_size);
+		if (ret < 0) {
+			if (ret != -EPIPE)
+				dprintf("Error queueing packets: %s", strerror(-ret));
+			break;
+		}
+	}
+	ring_close(priv->ring);
+	backend_packet_vec_free(vec);
+	pthread_exit(NULL);
+}
+
 /**
  * ts_parser_thread: consumes transport stream packets from the input and processes them.
+ * Packets are taken from the ring filled by ts_reader_thread, or read straight from the 
+ * backend if the ring has been disabled. When parsing is sharded, this thread only routes
+ * the packets to the pipeline workers.
  * @userdata: private data
  */
 void * ts_parser_thread(void *userdata)
 {
 	struct demuxfs_data *priv = (struct demuxfs_data *) userdata;
-	struct ts_header header;
-	void *payload = NULL;
+	struct ts_parser_context *ctx = NULL;
+	struct ts_packet_vec *vec;
 	int ret;
+
+	if (! priv->pipeline) {
+		ctx = ts_parser_context_new();
+		if (! ctx) {
+			dprintf("Not enough memory to allocate the parser context");
+			goto out;
+		}
+	}
+
+	if (priv->ring) {
+		while ((vec = ring_peek(priv->ring)) != NULL) {
+			ret = ts_process_batch(vec, ctx, priv);
+			ring_release(priv->ring);
+			if (ret < 0 || main_thread_stopped)
+				break;
+		}
+		goto out;
+	}
+
+	vec = backend_packet_vec_new(BACKEND_BATCH_PACKETS);
+	if (! vec) {
+		dprintf("Not enough memory to allocate the packet vector");
+		goto out;
+	}
     
 	while (priv->backend->keep_alive(priv) && !main_thread_stopped) {
-		ret = priv->backend->read(priv);
+		ret = priv->backend->read_batch(vec, priv);
 		if (ret < 0) {
 			if (ret != -ENODATA)
 				dprintf("read error");
 			break;
 		}
-		ret = priv->backend->process(&header, &payload, priv);
-		if (ret < 0)
-			continue;
-		ret = ts_parse_packet(&header, payload, priv);
-		if (ret < 0 && ret != -ENOBUFS) {
-			dprintf("Error processing packet: %s", strerror(-ret));
+		if (ts_process_batch(vec, ctx, priv) < 0)
 			break;
-		}
 	}
+	backend_packet_vec_free(vec);
+
+out:
+	if (priv->ring)
+		ring_stop(priv->ring);
+	if (priv->pipeline)
+		pipeline_close(priv->pipeline);
+	ts_parser_context_destroy(ctx);
 	pthread_exit(NULL);
 }
 
@@ -93,42 +175,67 @@ static struct dentry * create_rootfs(const char *name, struct demuxfs_data *priv
  */
 void demuxfs_destroy(void *data)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
+	struct demuxfs_data *priv = (struct demuxfs_data *) data;
 
 	main_thread_stopped = true;
 	pthread_join(priv->ts_parser_id, NULL);
+	if (priv->ring)
+		pthread_join(priv->ts_reader_id, NULL);
+	pipeline_destroy(priv->pipeline);
 
 	descriptors_destroy(priv->ts_descriptors);
 	dsmcc_descriptors_destroy(priv->dsmcc_descriptors);
-	hashtable_destroy(priv->pes_parsers, NULL);
-	hashtable_destroy(priv->psi_parsers, NULL);
 	hashtable_destroy(priv->pes_tables, NULL);
 	hashtable_destroy(priv->psi_tables, (hashtable_free_function_t) free);
-	hashtable_destroy(priv->packet_buffer, (hashtable_free_function_t) buffer_destroy);
+	ts_pid_table_destroy(priv->pid_table);
 	fsutils_dispose_tree(priv->root);
+	/* All threads are gone by now, so everything retired can be released */
+	epoch_destroy();
+	fsutils_destroy();
+	stats_destroy(priv->stats);
+	ring_destroy(priv->ring);
+	pthread_mutex_destroy(&priv->tree_lock);
 }
 
 /**
  * Implements FUSE init method.
  */
-void * demuxfs_init(struct fuse_conn_info *conn)
+void demuxfs_init(void *data, struct fuse_conn_info *conn)
 {
-	struct demuxfs_data *priv = fuse_get_context()->private_data;
+	struct demuxfs_data *priv = (struct demuxfs_data *) data;
+	pthread_mutexattr_t attr;
 
 #ifdef USE_FFMPEG
 	avcodec_register_all();
 #endif
 	priv->psi_tables = hashtable_new(DEMUXFS_MAX_PIDS);
 	priv->pes_tables = hashtable_new(DEMUXFS_MAX_PIDS);
-	priv->psi_parsers = hashtable_new(DEMUXFS_MAX_PIDS);
-	priv->pes_parsers = hashtable_new(DEMUXFS_MAX_PIDS);
-	priv->packet_buffer = hashtable_new(DEMUXFS_MAX_PIDS);
+	crc32_init();
+	priv->pid_table = ts_pid_table_new();
+	ts_pid_table_add_filters(priv);
+	/* Recursive, as a table parser may run a nested parser which also changes the tree */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&priv->tree_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	priv->stats = stats_new();
 	priv->ts_descriptors = descriptors_init(priv);
 	priv->dsmcc_descriptors = dsmcc_descriptors_init(priv);
 	priv->root = create_rootfs("/", priv);
+	stats_create_dentry(priv->root);
+	if (priv->opt_ring_depth) {
+		priv->ring = ring_new(priv->opt_ring_depth, BACKEND_BATCH_PACKETS);
+		if (! priv->ring)
+			fprintf(stderr, "Not enough memory to allocate the packet ring, reading from the parser thread\n");
+	}
+	if (priv->options.pes_workers) {
+		priv->pipeline = pipeline_new(priv);
+		if (! priv->pipeline)
+			fprintf(stderr, "Failed to start the parser pipeline, parsing from a single thread\n");
+	}
 	pthread_create(&priv->ts_parser_id, NULL, ts_parser_thread, priv);
-
-	return priv;
+	if (priv->ring)
+		pthread_create(&priv->ts_reader_id, NULL, ts_reader_thread, priv);
 }
 
 /**
@@ -144,6 +251,15 @@ static struct fuse_opt demuxfs_options[] = {
 	DEMUXFS_OPT("standard=%s",  opt_standard, 0),
 	DEMUXFS_OPT("tmpdir=%s",    opt_tmpdir, 0),
 	DEMUXFS_OPT("report=%s",    opt_report, 0),
+	DEMUXFS_OPT("ring_depth=%d", opt_ring_depth, 0),
+	DEMUXFS_OPT("pes_workers=%d", opt_pes_workers, 0),
+	DEMUXFS_OPT("psi_cpu=%d",   opt_psi_cpu, 0),
+	DEMUXFS_OPT("dsmcc_cpu=%d", opt_dsmcc_cpu, 0),
+	DEMUXFS_OPT("pes_cpus=%s",  opt_pes_cpus, 0),
+	DEMUXFS_OPT("lazy_tables=%d", opt_lazy_tables, 0),
+	DEMUXFS_OPT("lazy_budget=%d", opt_lazy_budget, 0),
+	DEMUXFS_OPT("keep_versions=%d", opt_keep_versions, 0),
+	DEMUXFS_OPT("version_budget=%d", opt_version_budget, 0),
 	FUSE_OPT_KEY("-h",          KEY_HELP),
 	FUSE_OPT_KEY("--help",      KEY_HELP),
 	FUSE_OPT_END
@@ -156,8 +272,17 @@ static void demuxfs_usage(struct demuxfs_data *priv)
 			"    -o parse_pes=1|0       parse PES packets (default: 0)\n"
 			"    -o standard=TYPE       transmission type: SBTVD, ISDB, DVB or ATSC (default: SBTVD)\n"
 			"    -o tmpdir=DIR          temporary directory in which to store DSM-CC files (default: %s)\n"
-			"    -o report=MASK         colon-separated list of errors to report: NONE,CRC,CONTINUITY or ALL (default: NONE)\n",
-			FS_DEFAULT_TMPDIR);
+			"    -o report=MASK         colon-separated list of errors to report: NONE,CRC,CONTINUITY or ALL (default: NONE)\n"
+			"    -o ring_depth=N        packet batches queued between a reader and the parser thread, copied unless filesrc_mmap is set (default: %d, read from the parser thread)\n"
+			"    -o pes_workers=N       parse PSI, DSM-CC and PES packets in separate threads, with N PES threads (default: 0, single parser thread)\n"
+			"    -o psi_cpu=N           CPU to bind the PSI parser thread to (default: none)\n"
+			"    -o dsmcc_cpu=N         CPU to bind the DSM-CC parser thread to (default: none)\n"
+			"    -o pes_cpus=LIST       colon-separated list of CPUs to bind the PES parser threads to (default: none)\n"
+			"    -o lazy_tables=1|0     build the contents of EIT versions only when they are first looked into (default: 0)\n"
+			"    -o lazy_budget=N       dentries built on demand to keep before releasing the least recently used (default: %d)\n"
+			"    -o keep_versions=N     versions to keep per table, counting the current one (default: 0, keep all)\n"
+			"    -o version_budget=MB   memory all table versions may take before the oldest replaced ones are dropped (default: 0, no limit)\n",
+			FS_DEFAULT_TMPDIR, RING_DEFAULT_DEPTH, FS_DEFAULT_LAZY_BUDGET);
 	backend_print_usage();
 }
 
@@ -180,17 +305,117 @@ static int demuxfs_parse_options(void *priv, const char *arg, int key, struct fu
 	return 1;
 }
 
+/**
+ * Mount the filesystem and serve requests until it's unmounted.
+ */
+static int demuxfs_run(struct fuse_args *args, struct demuxfs_data *priv)
+{
+	struct fuse_session *se;
+	struct fuse_chan *ch;
+	char *mountpoint = NULL;
+	int multithreaded, foreground;
+	int ret = 1;
+
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) < 0)
+		return 1;
+	if (! mountpoint) {
+		fprintf(stderr, "Error: no mount point was supplied\n");
+		return 1;
+	}
+	priv->mount_point = mountpoint;
+
+	ch = fuse_mount(mountpoint, args);
+	if (! ch)
+		return 1;
+
+	se = fuse_lowlevel_new(args, &demuxfs_ops, sizeof(demuxfs_ops), priv);
+	if (se) {
+		if (fuse_set_signal_handlers(se) != -1) {
+			fuse_session_add_chan(se, ch);
+			demuxfs_set_notify_channel(ch);
+			if (fuse_daemonize(foreground) != -1)
+				ret = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+			/* The parser threads outlive the session; stop them from sending notices */
+			demuxfs_set_notify_channel(NULL);
+			fuse_remove_signal_handlers(se);
+			fuse_session_remove_chan(ch);
+		}
+		fuse_session_destroy(se);
+	}
+	fuse_unmount(mountpoint, ch);
+	return ret ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct demuxfs_data *priv = (struct demuxfs_data *) calloc(1, sizeof(struct demuxfs_data));
+	int i;
 	assert(priv);
 
 	/* Parse command line options */
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	priv->opt_ring_depth = RING_DEFAULT_DEPTH;
+	priv->opt_psi_cpu = -1;
+	priv->opt_dsmcc_cpu = -1;
+	priv->opt_lazy_budget = FS_DEFAULT_LAZY_BUDGET;
 	int ret = fuse_opt_parse(&args, priv, demuxfs_options, demuxfs_parse_options);
 	if (ret < 0)
 		goto out_free;
 
+	if (priv->opt_ring_depth < 0 || priv->opt_ring_depth > RING_MAX_DEPTH) {
+		fprintf(stderr, "Error: ring_depth must be between 0 and %d.\n", RING_MAX_DEPTH);
+		ret = 1;
+		goto out_free;
+	}
+
+	if (priv->opt_pes_workers < 0 || priv->opt_pes_workers > DEMUXFS_MAX_PES_WORKERS) {
+		fprintf(stderr, "Error: pes_workers must be between 0 and %d.\n", DEMUXFS_MAX_PES_WORKERS);
+		ret = 1;
+		goto out_free;
+	}
+
+	if (priv->opt_lazy_budget < 0) {
+		fprintf(stderr, "Error: lazy_budget cannot be negative.\n");
+		ret = 1;
+		goto out_free;
+	}
+	priv->options.lazy_tables = priv->opt_lazy_tables;
+	priv->options.lazy_budget = priv->opt_lazy_budget;
+
+	if (priv->opt_keep_versions < 0 || priv->opt_version_budget < 0) {
+		fprintf(stderr, "Error: keep_versions and version_budget cannot be negative.\n");
+		ret = 1;
+		goto out_free;
+	}
+	priv->options.keep_versions = priv->opt_keep_versions;
+	priv->options.version_budget = (size_t) priv->opt_version_budget * 1024 * 1024;
+
+	priv->options.pes_workers = priv->opt_pes_workers;
+	priv->options.psi_cpu = priv->opt_psi_cpu;
+	priv->options.dsmcc_cpu = priv->opt_dsmcc_cpu;
+
+	for (i=0; i<DEMUXFS_MAX_PES_WORKERS; ++i)
+		priv->options.pes_cpus[i] = -1;
+	if (priv->opt_pes_cpus) {
+		char *opt_copy = strdup(priv->opt_pes_cpus);
+		char *opt = opt_copy;
+		for (i=0; opt && i<DEMUXFS_MAX_PES_WORKERS; ++i) {
+			char *colon = strstr(opt, ":");
+			char *end;
+			if (colon)
+				*colon = '\0';
+			priv->options.pes_cpus[i] = strtol(opt, &end, 10);
+			if (end == opt || *end || priv->options.pes_cpus[i] < 0) {
+				fprintf(stderr, "Invalid value '%s' for '-o pes_cpus'\n", opt);
+				free(opt_copy);
+				ret = 1;
+				goto out_free;
+			}
+			opt = colon ? ++colon : NULL;
+		}
+		free(opt_copy);
+	}
+
 	if (! priv->opt_standard || ! strcasecmp(priv->opt_standard, "SBTVD"))
 		priv->options.standard = SBTVD_STANDARD;
 	else if (! strcasecmp(priv->opt_standard, "ISDB"))
@@ -269,9 +494,8 @@ int main(int argc, char **argv)
 	}
 
 	/* Start the FUSE services */
-	priv->mount_point = strdup(argv[argc-1]);
 	fuse_opt_add_arg(&args, "-ointr");
-	ret = fuse_main(args.argc, args.argv, &demuxfs_ops, priv);
+	ret = demuxfs_run(&args, priv);
 
 out_destroy:
 	/* Destroy the backend private data */
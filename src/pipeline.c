@@ -0,0 +1,212 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "backend.h"
+#include "ring.h"
+#include "ts.h"
+#include "pipeline.h"
+#include "dsm-cc/dsmcc.h"
+
+static const char *pipeline_worker_name(struct pipeline_worker *worker)
+{
+	switch (worker->class) {
+		case PIPELINE_WORKER_PSI:   return "psi";
+		case PIPELINE_WORKER_DSMCC: return "dsmcc";
+		case PIPELINE_WORKER_PES:   return "pes";
+		default:                    return "unknown";
+	}
+}
+
+static void *pipeline_worker_thread(void *userdata)
+{
+	struct pipeline_worker *worker = (struct pipeline_worker *) userdata;
+	struct ts_packet_vec *vec;
+	char name[16];
+	int ret;
+
+	snprintf(name, sizeof(name), "demuxfs-%s", pipeline_worker_name(worker));
+	pthread_setname_np(pthread_self(), name);
+
+	if (worker->cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(worker->cpu, &cpuset);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (ret)
+			fprintf(stderr, "Failed to bind the %s worker to CPU %d: %s\n",
+					pipeline_worker_name(worker), worker->cpu, strerror(ret));
+	}
+
+	while ((vec = ring_peek(worker->ring)) != NULL) {
+		ret = ts_parse_batch(vec, worker->context, worker->priv);
+		ring_release(worker->ring);
+		if (ret < 0)
+			break;
+	}
+	/* Make pipeline_dispatch() fail if we gave up early */
+	ring_stop(worker->ring);
+	pthread_exit(NULL);
+}
+
+static void pipeline_worker_free(struct pipeline_worker *worker)
+{
+	ring_destroy(worker->ring);
+	ts_parser_context_destroy(worker->context);
+	backend_packet_vec_free(worker->pending);
+}
+
+struct pipeline *pipeline_new(struct demuxfs_data *priv)
+{
+	struct user_options *opt = &priv->options;
+	struct pipeline *pipeline = (struct pipeline *) calloc(1, sizeof(struct pipeline));
+	int i, started;
+
+	assert(pipeline);
+	pipeline->num_workers = 2 + opt->pes_workers;
+	pipeline->workers = (struct pipeline_worker *) calloc(pipeline->num_workers, sizeof(struct pipeline_worker));
+	assert(pipeline->workers);
+
+	for (i=0; i<pipeline->num_workers; ++i) {
+		struct pipeline_worker *worker = &pipeline->workers[i];
+		if (i == 0) {
+			worker->class = PIPELINE_WORKER_PSI;
+			worker->cpu = opt->psi_cpu;
+		} else if (i == 1) {
+			worker->class = PIPELINE_WORKER_DSMCC;
+			worker->cpu = opt->dsmcc_cpu;
+		} else {
+			worker->class = PIPELINE_WORKER_PES;
+			worker->cpu = opt->pes_cpus[i-2];
+		}
+		worker->priv = priv;
+		worker->ring = ring_new(PIPELINE_RING_DEPTH, BACKEND_BATCH_PACKETS);
+		worker->context = ts_parser_context_new();
+		worker->pending = backend_packet_vec_new(BACKEND_BATCH_PACKETS);
+		if (! worker->ring || ! worker->context || ! worker->pending)
+			goto out_free;
+	}
+
+	for (started=0; started<pipeline->num_workers; ++started) {
+		struct pipeline_worker *worker = &pipeline->workers[started];
+		if (pthread_create(&worker->thread, NULL, pipeline_worker_thread, worker)) {
+			perror("pthread_create");
+			goto out_stop;
+		}
+	}
+	return pipeline;
+
+out_stop:
+	for (i=0; i<started; ++i) {
+		ring_close(pipeline->workers[i].ring);
+		pthread_join(pipeline->workers[i].thread, NULL);
+	}
+out_free:
+	for (i=0; i<pipeline->num_workers; ++i)
+		pipeline_worker_free(&pipeline->workers[i]);
+	free(pipeline->workers);
+	free(pipeline);
+	return NULL;
+}
+
+/**
+ * Pick the worker of a PID. Returns -1 for PIDs which have no parser.
+ */
+static int pipeline_route(struct pipeline *pipeline, uint16_t pid, struct demuxfs_data *priv)
+{
+	struct ts_pid_state *state = &priv->pid_table[pid & (TS_MAX_PIDS-1)];
+	uint8_t type = __atomic_load_n(&state->type, __ATOMIC_ACQUIRE);
+
+	if (type == TS_PID_PES)
+		return 2 + pid % (pipeline->num_workers - 2);
+	else if (type != TS_PID_PSI)
+		return -1;
+	else if (__atomic_load_n(&state->parser, __ATOMIC_ACQUIRE) == dsmcc_parse)
+		return 1;
+	return 0;
+}
+
+int pipeline_dispatch(struct pipeline *pipeline, struct ts_packet_vec *vec, struct demuxfs_data *priv)
+{
+	struct ts_packet_vec *pending;
+	int i, index, ret;
+
+	for (i=0; i<pipeline->num_workers; ++i) {
+		pipeline->workers[i].pending->count = 0;
+		pipeline->workers[i].pending->sections = vec->sections;
+		pipeline->workers[i].pending->stable = vec->stable;
+	}
+
+	for (i=0; i<vec->count; ++i) {
+		index = pipeline_route(pipeline, vec->headers[i].pid, priv);
+		if (index < 0)
+			continue;
+		pending = pipeline->workers[index].pending;
+		pending->headers[pending->count] = vec->headers[i];
+		pending->payloads[pending->count] = vec->payloads[i];
+		pending->lengths[pending->count] = vec->lengths[i];
+		pending->count++;
+	}
+
+	/* ring_push() copies the payloads, so the batch can be released as soon as we return */
+	for (i=0; i<pipeline->num_workers; ++i) {
+		pending = pipeline->workers[i].pending;
+		if (pending->count == 0)
+			continue;
+		ret = ring_push(pipeline->workers[i].ring, pending, priv->options.packet_size);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+void pipeline_close(struct pipeline *pipeline)
+{
+	int i;
+
+	if (pipeline->closed)
+		return;
+	for (i=0; i<pipeline->num_workers; ++i)
+		ring_close(pipeline->workers[i].ring);
+	pipeline->closed = true;
+}
+
+void pipeline_destroy(struct pipeline *pipeline)
+{
+	int i;
+
+	if (! pipeline)
+		return;
+	pipeline_close(pipeline);
+	for (i=0; i<pipeline->num_workers; ++i) {
+		pthread_join(pipeline->workers[i].thread, NULL);
+		pipeline_worker_free(&pipeline->workers[i]);
+	}
+	free(pipeline->workers);
+	free(pipeline);
+}
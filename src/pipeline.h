@@ -0,0 +1,68 @@
+#ifndef __pipeline_h
+#define __pipeline_h
+
+/* Number of packet batches queued for each worker */
+#define PIPELINE_RING_DEPTH 4
+
+enum pipeline_worker_class {
+	PIPELINE_WORKER_PSI,
+	PIPELINE_WORKER_DSMCC,
+	PIPELINE_WORKER_PES,
+};
+
+struct ts_packet_vec;
+struct ts_parser_context;
+struct packet_ring;
+
+struct pipeline_worker {
+	enum pipeline_worker_class class;
+	/* CPU the thread is bound to, or -1 */
+	int cpu;
+	pthread_t thread;
+	/* Batches routed to this worker */
+	struct packet_ring *ring;
+	/* Reassembly buffers and section cache owned by this worker */
+	struct ts_parser_context *context;
+	/* Batch being gathered for this worker by pipeline_dispatch() */
+	struct ts_packet_vec *pending;
+	struct demuxfs_data *priv;
+};
+
+/**
+ * Sharded parsing pipeline. Packets are routed by PID class to one worker for the
+ * PSI/SI tables, one for the DSM-CC carousels and a number of PES workers. A PID is
+ * always handled by the same worker, so reassembly needs no locking. Table parsers
+ * serialize their changes to the filesystem tree with priv->tree_lock.
+ */
+struct pipeline {
+	int num_workers;
+	/* The PSI worker comes first, then the DSM-CC worker and the PES workers */
+	struct pipeline_worker *workers;
+	bool closed;
+};
+
+/**
+ * pipeline_new - Starts the worker threads as configured in priv->options.
+ *
+ * Returns the new pipeline or NULL on failure.
+ */
+struct pipeline *pipeline_new(struct demuxfs_data *priv);
+
+/**
+ * pipeline_dispatch - Queues each packet of a batch to the worker which handles its PID.
+ *
+ * Returns 0 on success or a negative error code if a worker has stopped.
+ */
+int pipeline_dispatch(struct pipeline *pipeline, struct ts_packet_vec *vec, struct demuxfs_data *priv);
+
+/**
+ * pipeline_close - Lets the workers exit once they have parsed the batches already queued.
+ */
+void pipeline_close(struct pipeline *pipeline);
+
+/**
+ * pipeline_destroy - Waits for the workers to exit and frees the pipeline.
+ */
+void pipeline_destroy(struct pipeline *pipeline);
+
+#endif /* __pipeline_h */
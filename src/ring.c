@@ -0,0 +1,180 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "backend.h"
+#include "ring.h"
+
+struct packet_ring *ring_new(int depth, int batch_size)
+{
+	struct packet_ring *ring = (struct packet_ring *) calloc(1, sizeof(struct packet_ring));
+	int i;
+
+	assert(ring);
+	ring->depth = depth;
+	ring->slots = (struct ts_packet_vec **) calloc(depth, sizeof(struct ts_packet_vec *));
+	ring->capacity = (size_t *) calloc(depth, sizeof(size_t));
+	if (! ring->slots || ! ring->capacity)
+		goto out_free;
+	for (i=0; i<depth; ++i) {
+		ring->slots[i] = backend_packet_vec_new(batch_size);
+		if (! ring->slots[i])
+			goto out_free;
+	}
+	sem_init(&ring->filled, 0, 0);
+	sem_init(&ring->empty, 0, depth);
+	return ring;
+
+out_free:
+	if (ring->slots)
+		for (i=0; i<depth; ++i)
+			backend_packet_vec_free(ring->slots[i]);
+	free(ring->slots);
+	free(ring->capacity);
+	free(ring);
+	return NULL;
+}
+
+void ring_destroy(struct packet_ring *ring)
+{
+	int i;
+
+	if (! ring)
+		return;
+	for (i=0; i<ring->depth; ++i)
+		backend_packet_vec_free(ring->slots[i]);
+	sem_destroy(&ring->filled);
+	sem_destroy(&ring->empty);
+	free(ring->slots);
+	free(ring->capacity);
+	free(ring);
+}
+
+/**
+ * Copy the payloads of a batch into the slot's own storage, as the backend is free to
+ * reuse its buffers as soon as the next batch is read. Stable payloads are passed by
+ * reference instead.
+ */
+static int ring_copy_batch(struct packet_ring *ring, int index, const struct ts_packet_vec *vec,
+		uint8_t packet_size)
+{
+	struct ts_packet_vec *slot = ring->slots[index];
+	size_t len, offset = 0, total = 0;
+	int i;
+
+	if (vec->stable) {
+		memcpy(slot->payloads, vec->payloads, vec->count * sizeof(*vec->payloads));
+		memcpy(slot->lengths, vec->lengths, vec->count * sizeof(*vec->lengths));
+		goto out;
+	}
+
+	if (vec->sections)
+		for (i=0; i<vec->count; ++i)
+			total += vec->lengths[i];
+	else
+		total = (size_t) vec->count * (packet_size - 4);
+
+	if (total > ring->capacity[index]) {
+		char *data = (char *) realloc(slot->data, total);
+		if (! data)
+			return -ENOMEM;
+		slot->data = data;
+		ring->capacity[index] = total;
+	}
+
+	for (i=0; i<vec->count; ++i) {
+		len = vec->sections ? vec->lengths[i] : (size_t) packet_size - 4;
+		memcpy(&slot->data[offset], vec->payloads[i], len);
+		slot->payloads[i] = &slot->data[offset];
+		slot->lengths[i] = vec->lengths[i];
+		offset += len;
+	}
+out:
+	memcpy(slot->headers, vec->headers, vec->count * sizeof(struct ts_header));
+	slot->sections = vec->sections;
+	slot->stable = vec->stable;
+	slot->count = vec->count;
+	return 0;
+}
+
+int ring_push(struct packet_ring *ring, const struct ts_packet_vec *vec, uint8_t packet_size)
+{
+	unsigned int head = ring->head, used;
+	int ret;
+
+	if (sem_trywait(&ring->empty) < 0) {
+		ring->full_waits++;
+		while (sem_wait(&ring->empty) < 0 && errno == EINTR)
+			continue;
+	}
+	if (__atomic_load_n(&ring->stopped, __ATOMIC_ACQUIRE))
+		return -EPIPE;
+
+	ret = ring_copy_batch(ring, head % ring->depth, vec, packet_size);
+	if (ret < 0) {
+		sem_post(&ring->empty);
+		return ret;
+	}
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	sem_post(&ring->filled);
+
+	used = head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (used > ring->high_water)
+		ring->high_water = used;
+	return 0;
+}
+
+void ring_close(struct packet_ring *ring)
+{
+	__atomic_store_n(&ring->closed, true, __ATOMIC_RELEASE);
+	sem_post(&ring->filled);
+}
+
+struct ts_packet_vec *ring_peek(struct packet_ring *ring)
+{
+	unsigned int tail = ring->tail;
+
+	while (sem_wait(&ring->filled) < 0 && errno == EINTR)
+		continue;
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+		/* Woken up by ring_close() */
+		return NULL;
+	return ring->slots[tail % ring->depth];
+}
+
+void ring_release(struct packet_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+	sem_post(&ring->empty);
+}
+
+void ring_stop(struct packet_ring *ring)
+{
+	__atomic_store_n(&ring->stopped, true, __ATOMIC_RELEASE);
+	sem_post(&ring->empty);
+}
@@ -0,0 +1,84 @@
+#ifndef __ring_h
+#define __ring_h
+
+#include <semaphore.h>
+
+/* Number of packet batches which can be queued between the reader and the parser */
+#define RING_DEFAULT_DEPTH 0
+#define RING_MAX_DEPTH     256
+
+struct ts_packet_vec;
+
+/**
+ * Single-producer/single-consumer ring of packet batches. The reader thread copies
+ * each batch returned by the backend into a free slot, unless its payloads are stable
+ * in which case only the pointers are copied, and publishes it by advancing
+ * 'head'; the parser thread consumes slots by advancing 'tail'. Each index is only
+ * written by one side, so no lock is taken. The semaphores are only there to put a
+ * thread to sleep when the ring is empty or full.
+ */
+struct packet_ring {
+	int depth;
+	struct ts_packet_vec **slots;
+	/* Bytes of storage allocated to each slot */
+	size_t *capacity;
+	/* Next slot to be published. Written by the producer only */
+	unsigned int head;
+	/* Next slot to be consumed. Written by the consumer only */
+	unsigned int tail;
+	sem_t filled;
+	sem_t empty;
+	/* Set by the producer when it won't publish anything else */
+	bool closed;
+	/* Set by the consumer when it won't consume anything else */
+	bool stopped;
+	/* Statistics, written by the producer */
+	unsigned int high_water;
+	uint64_t full_waits;
+};
+
+/**
+ * ring_new - Allocates a ring of 'depth' slots, each holding up to 'batch_size' packets.
+ *
+ * Returns the new ring or NULL on failure.
+ */
+struct packet_ring *ring_new(int depth, int batch_size);
+
+/**
+ * ring_destroy - Frees the ring and its slots. Both threads must have finished using it.
+ */
+void ring_destroy(struct packet_ring *ring);
+
+/**
+ * ring_push - Copies a batch into the next free slot and publishes it. Blocks while the ring is full.
+ * The payloads are copied too, unless the batch is stable.
+ *
+ * @packet_size: size of the TS packets in the batch, ignored for batches of sections.
+ *
+ * Returns 0 on success, -EPIPE if the consumer has stopped or -ENOMEM.
+ */
+int ring_push(struct packet_ring *ring, const struct ts_packet_vec *vec, uint8_t packet_size);
+
+/**
+ * ring_close - Tells the consumer that no more batches will be published.
+ */
+void ring_close(struct packet_ring *ring);
+
+/**
+ * ring_peek - Returns the oldest published batch. Blocks while the ring is empty.
+ *
+ * Returns NULL once the ring has been closed and drained.
+ */
+struct ts_packet_vec *ring_peek(struct packet_ring *ring);
+
+/**
+ * ring_release - Hands the batch returned by ring_peek() back to the producer.
+ */
+void ring_release(struct packet_ring *ring);
+
+/**
+ * ring_stop - Tells the producer that no more batches will be consumed.
+ */
+void ring_stop(struct packet_ring *ring);
+
+#endif /* __ring_h */
@@ -0,0 +1,135 @@
+/* 
+ * Copyright (c) 2008-2010, Lucas C. Villa Real <lucasvr@gobolinux.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of GoboLinux nor the names of its contributors may
+ * be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "demuxfs.h"
+#include "fsutils.h"
+#include "xattr.h"
+#include "ts.h"
+#include "stats.h"
+#include "ring.h"
+#include "arena.h"
+
+struct demuxfs_stats *stats_new()
+{
+	struct demuxfs_stats *stats = (struct demuxfs_stats *) calloc(1, sizeof(struct demuxfs_stats));
+	assert(stats);
+	return stats;
+}
+
+void stats_destroy(struct demuxfs_stats *stats)
+{
+	free(stats);
+}
+
+struct dentry *stats_create_dentry(struct dentry *parent)
+{
+	struct dentry *dentry = (struct dentry *) calloc(1, sizeof(struct dentry));
+	assert(dentry);
+
+	dentry->name = strdup(FS_STATS_NAME);
+	dentry->mode = S_IFREG | 0444;
+	dentry->obj_type = OBJ_TYPE_STATS;
+	CREATE_COMMON(parent, dentry);
+	return dentry;
+}
+
+static void stats_render_versions(struct dentry *table, unsigned int count, size_t bytes, void *data)
+{
+	FILE *fp = (FILE *) data;
+	char buf[PATH_MAX], *path;
+
+	path = fsutils_path_walk(table, buf, sizeof(buf));
+	if (path)
+		fprintf(fp, "versions[%s]: retained=%u bytes=%llu\n", path, count, (unsigned long long) bytes);
+}
+
+static void stats_render(FILE *fp, struct demuxfs_data *priv)
+{
+	struct demuxfs_stats *stats = priv->stats;
+	struct arena_stats arena;
+	uint64_t parsed = 0, skipped = 0;
+	unsigned long versions;
+	size_t version_bytes;
+	int i;
+
+	for (i=0; i<TS_MAX_TABLE_IDS; ++i) {
+		parsed += stats->sections_parsed[i];
+		skipped += stats->sections_skipped[i];
+	}
+	fprintf(fp, "sections_parsed=%llu\n", (unsigned long long) parsed);
+	fprintf(fp, "sections_skipped=%llu\n", (unsigned long long) skipped);
+	fprintf(fp, "input_overflows=%llu\n", (unsigned long long) stats->input_overflows);
+	if (priv->ring) {
+		fprintf(fp, "ring_depth=%d\n", priv->ring->depth);
+		fprintf(fp, "ring_high_water=%u\n", priv->ring->high_water);
+		fprintf(fp, "ring_full_waits=%llu\n", (unsigned long long) priv->ring->full_waits);
+	}
+	arena_get_stats(&arena);
+	fprintf(fp, "arenas=%llu\n", (unsigned long long) arena.arenas);
+	fprintf(fp, "arena_chunks=%llu\n", (unsigned long long) arena.chunks);
+	fprintf(fp, "arena_bytes_reserved=%llu\n", (unsigned long long) arena.bytes_reserved);
+	fprintf(fp, "arena_bytes_used=%llu\n", (unsigned long long) arena.bytes_used);
+	fprintf(fp, "arena_allocations=%llu\n", (unsigned long long) arena.allocations);
+	fsutils_get_version_stats(&versions, &version_bytes);
+	fprintf(fp, "versions_retained=%lu\n", versions);
+	fprintf(fp, "version_bytes=%llu\n", (unsigned long long) version_bytes);
+
+	for (i=0; i<TS_MAX_TABLE_IDS; ++i) {
+		if (! stats->sections_parsed[i] && ! stats->sections_skipped[i])
+			continue;
+		fprintf(fp, "table_id[%#04x]: parsed=%llu skipped=%llu\n", i,
+				(unsigned long long) stats->sections_parsed[i],
+				(unsigned long long) stats->sections_skipped[i]);
+	}
+
+	read_lock();
+	fsutils_walk_versions(priv->root, stats_render_versions, fp);
+	read_unlock();
+}
+
+int stats_update_dentry(struct dentry *dentry, struct demuxfs_data *priv)
+{
+	char *contents = NULL;
+	size_t size = 0;
+	FILE *fp;
+
+	fp = open_memstream(&contents, &size);
+	if (! fp)
+		return -errno;
+	stats_render(fp, priv);
+	fclose(fp);
+
+	pthread_mutex_lock(&dentry->mutex);
+	free(dentry->contents);
+	dentry->contents = contents;
+	dentry->parent->size -= dentry->size;
+	dentry->size = size;
+	dentry->parent->size += dentry->size;
+	pthread_mutex_unlock(&dentry->mutex);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __stats_h
+#define __stats_h
+
+#define FS_STATS_NAME ".stats"
+
+/**
+ * Runtime statistics, exported to userspace through the /.stats file.
+ * Section counters are updated atomically, as several parser threads may write
+ * them when -o pes_workers is set. input_overflows is only written by the thread
+ * that reads from the backend.
+ */
+struct demuxfs_stats {
+	/* Complete sections handed to the table parsers, indexed by table_id */
+	uint64_t sections_parsed[TS_MAX_TABLE_IDS];
+	/* Sections dropped by the section cache because they had not changed, indexed by table_id */
+	uint64_t sections_skipped[TS_MAX_TABLE_IDS];
+	/* Times the input device dropped data because it wasn't read fast enough (EOVERFLOW) */
+	uint64_t input_overflows;
+};
+
+/**
+ * stats_new - Allocates a zeroed statistics structure.
+ */
+struct demuxfs_stats *stats_new();
+
+/**
+ * stats_destroy - Frees a statistics structure.
+ *
+ * @stats: statistics allocated by stats_new().
+ */
+void stats_destroy(struct demuxfs_stats *stats);
+
+/**
+ * stats_create_dentry - Creates the statistics file under the given directory.
+ *
+ * @parent: parent directory, usually the filesystem root.
+ *
+ * Returns the new dentry.
+ */
+struct dentry *stats_create_dentry(struct dentry *parent);
+
+/**
+ * stats_update_dentry - Renders the current statistics into the dentry contents.
+ *
+ * @dentry: dentry created by stats_create_dentry().
+ * @priv: private data.
+ *
+ * Returns 0 on success or a negative value on error.
+ */
+int stats_update_dentry(struct dentry *dentry, struct demuxfs_data *priv);
+
+#endif /* __stats_h */
@@ -38,19 +38,12 @@
 
 void eit_free(struct eit_table *eit)
 {
-	struct eit_event *event, *next_event;
-
 	if (eit->dentry && eit->dentry->name)
 		fsutils_dispose_tree(eit->dentry);
 	else if (eit->dentry)
 		/* Dentry has simply been calloc'ed */
 		free(eit->dentry);
 
-	for (event=eit->eit_event; event != NULL; event=next_event) {
-		next_event = event->next;
-		free(event);
-	}
-
 	/* Free the eit table structure */
 	free(eit);
 }
@@ -79,8 +72,59 @@ static time_t eit_convert_from_mjd_time(uint64_t mjd_time)
 	return utc_time;
 }
 
+/* Create the files and the event directories of an EIT version out of its raw section */
+static void eit_populate_version(struct dentry *version_dentry, const char *payload,
+		uint32_t payload_len, struct demuxfs_data *priv)
+{
+	struct eit_table eit;
+	struct eit_event event;
+
+	eit.transport_stream_id = CONVERT_TO_16(payload[8], payload[9]);
+	eit.original_network_id = CONVERT_TO_16(payload[10], payload[11]);
+	eit.segment_last_section_number = payload[12];
+	eit.last_table_id = payload[13];
+	CREATE_FILE_NUMBER(version_dentry, &eit, transport_stream_id);
+	CREATE_FILE_NUMBER(version_dentry, &eit, original_network_id);
+	CREATE_FILE_NUMBER(version_dentry, &eit, segment_last_section_number);
+	CREATE_FILE_NUMBER(version_dentry, &eit, last_table_id);
+
+	int event_nr = 1, i = 14;
+	/* Include extra 4 bytes needed by the CRC32 */
+	while ((i + 4) < payload_len) {
+		char event_dirname[32];
+		struct dentry *event_dentry;
+		
+		event.event_id = CONVERT_TO_16(payload[i], payload[i+1]);
+		event.start_time = CONVERT_TO_40(payload[i+2], payload[i+3], payload[i+4], payload[i+5], payload[i+6]);
+		event.duration = CONVERT_TO_24(payload[i+7], payload[i+8], payload[i+9]);
+		event.running_status = (payload[i+10] >> 5) & 0x03;
+		event.free_ca_mode = (payload[i+10] >> 4) & 0x01;
+		event.descriptors_loop_length = CONVERT_TO_16(payload[i+10], payload[i+11]) & 0x0fff;
+		i += 12;
+
+		/* TODO: unused */
+		eit_convert_from_mjd_time(event.start_time);
+
+		sprintf(event_dirname, "Event_%02d", event_nr++);
+		event_dentry = CREATE_DIRECTORY(version_dentry, event_dirname);
+		CREATE_FILE_NUMBER(event_dentry, &event, event_id);
+		CREATE_FILE_NUMBER(event_dentry, &event, start_time);
+		CREATE_FILE_NUMBER(event_dentry, &event, duration);
+		CREATE_FILE_NUMBER(event_dentry, &event, running_status);
+		CREATE_FILE_NUMBER(event_dentry, &event, free_ca_mode);
+		CREATE_FILE_NUMBER(event_dentry, &event, descriptors_loop_length);
+
+		int loop_length = event.descriptors_loop_length;
+		while (loop_length > 0) {
+			uint32_t desc_length = descriptors_parse(&payload[i], 1, event_dentry, priv);
+			loop_length -= desc_length;
+			i += desc_length;
+		}
+	}
+}
+
 static void eit_create_directory(const struct ts_header *header, struct eit_table *eit, 
-	struct dentry **version_dentry, struct demuxfs_data *priv)
+	struct dentry **pid_dentry, struct dentry **version_dentry, struct demuxfs_data *priv)
 {
 	/* Create a directory named "EIT" at the root filesystem if it doesn't exist yet */
 	struct dentry *eit_dir, *eit_pid_dir;
@@ -97,18 +141,18 @@ static void eit_create_directory(const struct ts_header *header, struct eit_tabl
 		eit_dir = CREATE_DIRECTORY(priv->root, "EIT");
 	}
 
-	/* Create a directory named "<eit_pid>" and populate it with files */
+	/* 
+	 * Create a directory named "<eit_pid>" and populate it with files. All EIT tables on this
+	 * PID share that directory, so it's built off-line and merged into the published one later.
+	 */
 	asprintf(&pid_name, "%#04x", header->pid);
-	eit_pid_dir = fsutils_get_child(eit_dir, pid_name);
-	if (eit_pid_dir) {
-		free(pid_name);
-		INITIALIZE_DENTRY_UNLINKED(eit->dentry);
-	} else {
-		eit->dentry->name = pid_name;
-		eit->dentry->mode = S_IFDIR | 0555;
-		CREATE_COMMON(eit_dir, eit->dentry);
-		eit_pid_dir = eit->dentry;
-	}
+	eit_pid_dir = (struct dentry *) calloc(1, sizeof(struct dentry));
+	assert(eit_pid_dir);
+	eit_pid_dir->name = pid_name;
+	eit_pid_dir->mode = S_IFDIR | 0555;
+	CREATE_UNLINKED(eit_dir, eit_pid_dir);
+	INITIALIZE_DENTRY_UNLINKED(eit->dentry);
+	*pid_dentry = eit_pid_dir;
 	
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(eit_pid_dir, eit->version_number);
@@ -147,68 +191,24 @@ int eit_parse(const struct ts_header *header, const char *payload, uint32_t payl
 			header->pid, eit->table_id, current_eit, eit->version_number, payload_len);
 
 	/* Parse EIT specific bits */
-	struct dentry *version_dentry;
-	eit_create_directory(header, eit, &version_dentry, priv);
+	struct dentry *pid_dentry, *version_dentry;
+	eit_create_directory(header, eit, &pid_dentry, &version_dentry, priv);
 
 	eit->transport_stream_id = CONVERT_TO_16(payload[8], payload[9]);
 	eit->original_network_id = CONVERT_TO_16(payload[10], payload[11]);
 	eit->segment_last_section_number = payload[12];
 	eit->last_table_id = payload[13];
-	CREATE_FILE_NUMBER(version_dentry, eit, transport_stream_id);
-	CREATE_FILE_NUMBER(version_dentry, eit, original_network_id);
-	CREATE_FILE_NUMBER(version_dentry, eit, segment_last_section_number);
-	CREATE_FILE_NUMBER(version_dentry, eit, last_table_id);
-
-	struct eit_event *this_event;
-	eit->eit_event = calloc(1, sizeof(struct eit_event));
-	this_event = eit->eit_event;
-
-	int event_nr = 1, i = 14;
-	/* Include extra 4 bytes needed by the CRC32 */
-	while ((i + 4) < payload_len) {
-		char event_dirname[32];
-		struct dentry *event_dentry;
-		struct eit_event *next_event = NULL;
-		
-		this_event->event_id = CONVERT_TO_16(payload[i], payload[i+1]);
-		this_event->start_time = CONVERT_TO_40(payload[i+2], payload[i+3], payload[i+4], payload[i+5], payload[i+6]);
-		this_event->duration = CONVERT_TO_24(payload[i+7], payload[i+8], payload[i+9]);
-		this_event->running_status = (payload[i+10] >> 5) & 0x03;
-		this_event->free_ca_mode = (payload[i+10] >> 4) & 0x01;
-		this_event->descriptors_loop_length = CONVERT_TO_16(payload[i+10], payload[i+11]) & 0x0fff;
-		i += 12;
 
-		/* TODO: unused */
-		eit_convert_from_mjd_time(this_event->start_time);
+	/* In lazy mode the events are only parsed if someone looks into the version directory */
+	if (priv->options.lazy_tables)
+		fsutils_make_lazy(version_dentry, eit_populate_version, payload, payload_len, priv);
+	else
+		eit_populate_version(version_dentry, payload, payload_len, priv);
 
-		sprintf(event_dirname, "Event_%02d", event_nr++);
-		event_dentry = CREATE_DIRECTORY(version_dentry, event_dirname);
-		CREATE_FILE_NUMBER(event_dentry, this_event, event_id);
-		CREATE_FILE_NUMBER(event_dentry, this_event, start_time);
-		CREATE_FILE_NUMBER(event_dentry, this_event, duration);
-		CREATE_FILE_NUMBER(event_dentry, this_event, running_status);
-		CREATE_FILE_NUMBER(event_dentry, this_event, free_ca_mode);
-		CREATE_FILE_NUMBER(event_dentry, this_event, descriptors_loop_length);
-
-		int loop_length = this_event->descriptors_loop_length;
-		while (loop_length > 0) {
-			uint32_t desc_length = descriptors_parse(&payload[i], 1, event_dentry, priv);
-			loop_length -= desc_length;
-			i += desc_length;
-		}
-
-		if (i < payload_len) {
-			next_event = calloc(1, sizeof(struct eit_event));
-			this_event->next = next_event;
-			this_event = next_event;
-		} else
-			this_event->next = NULL;
-	}
-
-	if (current_eit) {
-		fsutils_migrate_children(current_eit->dentry, eit->dentry);
+	/* Make the new version visible at once */
+	fsutils_publish_dentry(pid_dentry, fsutils_get_child(pid_dentry->parent, pid_dentry->name));
+	if (current_eit)
 		hashtable_del(priv->psi_tables, current_eit->dentry->inode);
-	}
 
 	hashtable_add(priv->psi_tables, eit->dentry->inode, eit, (hashtable_free_function_t) eit_free);
 	return 0;
@@ -2,7 +2,6 @@
 #define __eit_h
 
 struct eit_event {
-	struct eit_event *next;
 	uint16_t event_id;
 	uint64_t start_time:40;
 	uint64_t duration:24;
@@ -25,7 +24,6 @@ typedef struct eit_table {
 	uint16_t original_network_id;
 	uint8_t segment_last_section_number;
 	uint8_t last_table_id;
-	struct eit_event *eit_event;
 	uint32_t crc;
 } __attribute__((__packed__)) eit_table;
 
@@ -54,7 +54,7 @@ static void nit_create_directory(struct nit_table *nit, struct dentry **version_
 	/* Create a directory named "NIT" and populate it with files */
 	nit->dentry->name = strdup(FS_NIT_NAME);
 	nit->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(priv->root, nit->dentry);
+	CREATE_UNLINKED(priv->root, nit->dentry);
 
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(nit->dentry, nit->version_number);
@@ -130,9 +130,11 @@ int nit_parse(const struct ts_header *header, const char *payload, uint32_t payl
 		offset += 6 + ts_data.transport_descriptors_length;
 	}
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	nit->dentry = fsutils_publish_dentry(nit->dentry, current_nit ? current_nit->dentry : NULL);
 	if (current_nit) {
-		fsutils_migrate_children(current_nit->dentry, nit->dentry);
-		hashtable_del(priv->psi_tables, current_nit->dentry->inode);
+		current_nit->dentry = NULL;
+		hashtable_del(priv->psi_tables, nit->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, nit->dentry->inode, nit, (hashtable_free_function_t) nit_free);
 
@@ -91,17 +91,36 @@ static void pat_populate(struct pat_table *pat, struct dentry *parent,
 			snprintf(target, sizeof(target), "../../../%s/%s",
 				FS_NIT_NAME, FS_CURRENT_NAME);
 			if (! existing_parser)
-				hashtable_add(priv->psi_parsers, pid, nit_parse, NULL);
+				ts_set_pid_parser(pid, TS_PID_PSI, nit_parse, priv);
 		} else {
 			snprintf(target, sizeof(target), "../../../%s/%#04x/%s",
 				FS_PMT_NAME, pid, FS_CURRENT_NAME);
 			if (! existing_parser)
-				hashtable_add(priv->psi_parsers, pid, pmt_parse, NULL);
+				ts_set_pid_parser(pid, TS_PID_PSI, pmt_parse, priv);
 		}
 		CREATE_SYMLINK(dentry, name, target);
 	}
 }
 
+/* Stop parsing the PMT PIDs which are no longer announced by the PAT, and their streams */
+static void pat_drop_stale_parsers(struct pat_table *current_pat, struct pat_table *pat,
+		struct demuxfs_data *priv)
+{
+	for (uint16_t i=0; i<current_pat->num_programs; ++i) {
+		uint16_t pid = current_pat->programs[i].pid;
+		bool found = false;
+
+		if (current_pat->programs[i].program_number == 0)
+			continue;
+		for (uint16_t j=0; j<pat->num_programs && ! found; ++j)
+			found = pat->programs[j].pid == pid;
+		if (! found && ts_get_pid_parser(pid, TS_PID_PSI, priv) == pmt_parse) {
+			pmt_drop_stream_parsers(pid, pat, priv);
+			ts_clear_pid_parser(pid, priv);
+		}
+	}
+}
+
 static void pat_create_directory(struct pat_table *pat, struct demuxfs_data *priv)
 {
 	struct dentry *version_dentry;
@@ -109,7 +128,7 @@ static void pat_create_directory(struct pat_table *pat, struct demuxfs_data *pri
 	/* Create a directory named "PAT" and populate it with files */
 	pat->dentry->name = strdup(FS_PAT_NAME);
 	pat->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(priv->root, pat->dentry);
+	CREATE_UNLINKED(priv->root, pat->dentry);
 
 	/* Create the versioned dir and update the Current symlink */
 	version_dentry = fsutils_create_version_dir(pat->dentry, pat->version_number);
@@ -169,10 +188,12 @@ int pat_parse(const struct ts_header *header, const char *payload, uint32_t payl
 
 	pat_create_directory(pat, priv);
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	pat->dentry = fsutils_publish_dentry(pat->dentry, current_pat ? current_pat->dentry : NULL);
 	if (current_pat) {
-		fsutils_migrate_children(current_pat->dentry, pat->dentry);
-		fsutils_dispose_tree(current_pat->dentry);
-		hashtable_del(priv->psi_tables, current_pat->dentry->inode);
+		pat_drop_stale_parsers(current_pat, pat, priv);
+		current_pat->dentry = NULL;
+		hashtable_del(priv->psi_tables, pat->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, pat->dentry->inode, pat, (hashtable_free_function_t) pat_free);
 
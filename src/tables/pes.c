@@ -76,19 +76,44 @@ int pes_identify_stream_id(uint8_t stream_id)
 	}
 }
 
+/* Key of a PID's ES or PES FIFO in the cache of FIFO dentries */
+#define PES_CACHE_KEY(pid,is_es) ((ino_t) (pid) << 1 | ((is_es) ? 0 : 1))
+
+/**
+ * Drop the FIFOs of a PID from the cache, so that they are looked up again on
+ * the next packet. Must be called before the FIFOs are released.
+ * @pid: elementary stream PID
+ * @priv: filesystem data
+ */
+void pes_forget_stream(uint16_t pid, struct demuxfs_data *priv)
+{
+	hashtable_lock(priv->pes_tables);
+	hashtable_del(priv->pes_tables, PES_CACHE_KEY(pid, true));
+	hashtable_del(priv->pes_tables, PES_CACHE_KEY(pid, false));
+	hashtable_unlock(priv->pes_tables);
+}
+
 static struct dentry *pes_get_dentry(const struct ts_header *header, 
 		const char *fifo_name, struct demuxfs_data *priv)
 {
 	struct dentry *slink, *dentry = NULL;
 	char pathname[PATH_MAX];
-	ino_t key = header->pid << 1 | (strcmp(fifo_name, FS_ES_FIFO_NAME) == 0 ? 0 : 1);
+	ino_t key = PES_CACHE_KEY(header->pid, strcmp(fifo_name, FS_ES_FIFO_NAME) == 0);
 
+	/* 
+	 * PES parsers run without the tree lock, which is only taken to walk the tree on a
+	 * cache miss. The cache has its own lock so that hits don't wait for table parsers.
+	 */
+	hashtable_lock(priv->pes_tables);
 	dentry = hashtable_get(priv->pes_tables, key);
+	hashtable_unlock(priv->pes_tables);
 	if (! dentry) {
+		pthread_mutex_lock(&priv->tree_lock);
 		sprintf(pathname, "/%s/%#x", FS_STREAMS_NAME, header->pid);
 		slink = fsutils_get_dentry(priv->root, pathname);
 		if (! slink) {
 			dprintf("couldn't get a dentry for '%s'", pathname);
+			pthread_mutex_unlock(&priv->tree_lock);
 			return NULL;
 		}
 
@@ -96,9 +121,16 @@ static struct dentry *pes_get_dentry(const struct ts_header *header,
 		dentry = fsutils_get_dentry(priv->root, pathname);
 		if (! dentry) {
 			dprintf("couldn't get a dentry for '%s'", pathname);
+			pthread_mutex_unlock(&priv->tree_lock);
 			return NULL;
 		}
+		/* The FIFO may be shared by several versions of the PMT */
+		if (dentry->hardlink)
+			dentry = dentry->hardlink;
+		hashtable_lock(priv->pes_tables);
 		hashtable_add(priv->pes_tables, key, dentry, NULL);
+		hashtable_unlock(priv->pes_tables);
+		pthread_mutex_unlock(&priv->tree_lock);
 	}
 	return dentry;
 }
@@ -49,6 +49,7 @@ enum {
 };
 
 int pes_identify_stream_id(uint8_t stream_id);
+void pes_forget_stream(uint16_t pid, struct demuxfs_data *priv);
 int pes_parse_audio(const struct ts_header *header, const char *payload, uint32_t payload_len,
 		struct demuxfs_data *priv);
 int pes_parse_video(const struct ts_header *header, const char *payload, uint32_t payload_len,
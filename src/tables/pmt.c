@@ -38,6 +38,7 @@
 #include "stream_type.h"
 #include "component_tag.h"
 #include "tables/psi.h"
+#include "tables/pat.h"
 #include "tables/pmt.h"
 #include "tables/pes.h"
 #include "dsm-cc/dsmcc.h"
@@ -64,6 +65,7 @@ void pmt_free(struct pmt_table *pmt)
 
 	/* Free the pmt table structure */
 	pmt->dentry = NULL;
+	free(pmt->es_loop);
 	free(pmt);
 }
 
@@ -74,15 +76,130 @@ static void pmt_populate(struct pmt_table *pmt, struct dentry *parent,
 	CREATE_FILE_NUMBER(parent, pmt, program_information_length);
 }
 
+/* Length of the elementary stream loop entry at 'entry' */
+static uint32_t pmt_stream_entry_len(const char *entry)
+{
+	return 5 + (CONVERT_TO_16(entry[3], entry[4]) & 0x0fff);
+}
+
+/* Whether 'pmt' lists the elementary stream loop entry 'entry' with the very same contents */
+static bool pmt_has_stream_entry(struct pmt_table *pmt, const char *entry, uint32_t entry_len)
+{
+	uint32_t offset = 0, len;
+
+	if (! pmt || ! pmt->es_loop)
+		return false;
+	while (offset + 5 <= pmt->es_loop_len) {
+		len = pmt_stream_entry_len(&pmt->es_loop[offset]);
+		if (len == entry_len && offset + len <= pmt->es_loop_len &&
+				memcmp(&pmt->es_loop[offset], entry, len) == 0)
+			return true;
+		offset += len;
+	}
+	return false;
+}
+
+/* Whether 'pmt' lists an elementary stream carried on 'pid' */
+static bool pmt_has_stream_pid(struct pmt_table *pmt, uint16_t pid)
+{
+	uint32_t offset = 0;
+
+	if (! pmt || ! pmt->es_loop)
+		return false;
+	while (offset + 5 <= pmt->es_loop_len) {
+		if ((CONVERT_TO_16(pmt->es_loop[offset+1], pmt->es_loop[offset+2]) & 0x1fff) == pid)
+			return true;
+		offset += pmt_stream_entry_len(&pmt->es_loop[offset]);
+	}
+	return false;
+}
+
+/**
+ * Stop parsing the elementary streams of a program which has left the PAT, which 
+ * also removes them from the backend's PID filter. Streams which the PMT of another 
+ * program still announced by 'pat' lists as well are kept.
+ * @pmt_pid: PID the program's PMT is carried on
+ * @pat: new version of the PAT
+ * @priv: private data
+ */
+void pmt_drop_stream_parsers(uint16_t pmt_pid, struct pat_table *pat, struct demuxfs_data *priv)
+{
+	struct pmt_table *pmt = hashtable_get(priv->psi_tables, (pmt_pid << 8) | TS_PMT_TABLE_ID);
+	uint32_t offset = 0;
+
+	while (pmt && pmt->es_loop && offset + 5 <= pmt->es_loop_len) {
+		const char *entry = &pmt->es_loop[offset];
+		uint16_t pid = CONVERT_TO_16(entry[1], entry[2]) & 0x1fff;
+		bool shared = false;
+
+		for (uint16_t i=0; i<pat->num_programs && ! shared; ++i) {
+			uint16_t other_pid = pat->programs[i].pid;
+			if (pat->programs[i].program_number == 0 || other_pid == pmt_pid)
+				continue;
+			shared = pmt_has_stream_pid(hashtable_get(priv->psi_tables, 
+						(other_pid << 8) | TS_PMT_TABLE_ID), pid);
+		}
+		if (! shared) {
+			pes_forget_stream(pid, priv);
+			ts_clear_pid_parser(pid, priv);
+		}
+		offset += pmt_stream_entry_len(entry);
+	}
+}
+
+/* 
+ * Create a stream FIFO. Streams which the new version doesn't change get a link to the
+ * FIFO of the previous version, so that readers and the PES parsers carry on using it.
+ */
+static struct dentry *pmt_create_fifo(struct dentry *subdir, struct dentry *previous_subdir,
+		int obj_type, const char *name, uint16_t pid, struct demuxfs_data *priv)
+{
+	struct dentry *dentry = fsutils_get_child(subdir, name);
+	struct dentry *previous = previous_subdir ? fsutils_get_child(previous_subdir, name) : NULL;
+	char path[PATH_MAX];
+
+	if (dentry)
+		return dentry;
+	if (previous && previous->hardlink)
+		return fsutils_create_hardlink(subdir, previous);
+
+	/* Written to through /Streams, which always leads to the current version */
+	snprintf(path, sizeof(path), "%s/%s/%#04x/%s", priv->mount_point, FS_STREAMS_NAME, pid, name);
+	return fsutils_create_shared_fifo(subdir, obj_type, name, path);
+}
+
+/* Point the symlink in /Streams to the directory of a stream in the version being built */
+static void pmt_link_stream_dir(struct dentry *subdir, struct demuxfs_data *priv)
+{
+	struct dentry *streams_dir, *slink;
+	char es_path[PATH_MAX], *es;
+
+	es = fsutils_path_walk(subdir, es_path, sizeof(es_path));
+	if (! es)
+		return;
+	streams_dir = CREATE_DIRECTORY(priv->root, FS_STREAMS_NAME);
+	if (es > es_path + 2) {
+		*(--es) = '.';
+		*(--es) = '.';
+	}
+	slink = fsutils_get_child(streams_dir, subdir->name);
+	if (! slink)
+		CREATE_SYMLINK(streams_dir, subdir->name, es);
+	else if (strcmp(slink->contents, es))
+		/* The FIFOs are looked up and written to through that symlink */
+		fsutils_update_symlink(slink, es);
+}
+
 static void pmt_populate_stream_dir(struct pmt_stream *stream, const char *descriptor_info,
-		struct dentry *version_dentry, struct dentry **subdir, struct demuxfs_data *priv)
+		struct dentry *version_dentry, struct dentry *previous_version, struct dentry **subdir,
+		struct demuxfs_data *priv)
 {
 	uint8_t tag = descriptor_info ? descriptor_info[0] : 0;
 	uint8_t component_tag = descriptor_info ? descriptor_info[2] : 0;
 	bool is_primary = false, is_secondary = false;
-	struct dentry *parent = NULL;
+	struct dentry *parent = NULL, *previous_subdir = NULL;
 	const char *streams_name = FS_RESERVED_STREAMS_NAME;
-	char dirname[16], stream_type[256], es_path[PATH_MAX], *es;
+	char dirname[16], stream_type[256];
 
 	// STREAM_IDENTIFIER_DESCRIPTOR
 	if (tag == 0x52) {
@@ -124,6 +241,8 @@ static void pmt_populate_stream_dir(struct pmt_stream *stream, const char *descr
 	/* Create a directory with this stream's PID number in /PMT/<pid>/Current/<streams_name>/ */
 	sprintf(dirname, "%#04x", stream->elementary_stream_pid);
 	*subdir = CREATE_DIRECTORY(parent, dirname);
+	if (previous_version && (previous_subdir = fsutils_get_child(previous_version, streams_name)))
+		previous_subdir = fsutils_get_child(previous_subdir, dirname);
 
 	/* Create a 'Primary' symlink pointing to <streams_name> if it happens to be the primary component */
 	if (is_primary)
@@ -134,32 +253,23 @@ static void pmt_populate_stream_dir(struct pmt_stream *stream, const char *descr
 		/* TODO: The descriptor with the lowest component_tag will become the secondary stream */
 	}
 
-	/* Create a symlink in /Streams pointing to this new directory */
-	es = fsutils_path_walk((*subdir), es_path, sizeof(es_path));
-	if (es) {
-		struct dentry *streams_dir = CREATE_DIRECTORY(priv->root, FS_STREAMS_NAME);
-		if (es > es_path + 2) {
-			*(--es) = '.';
-			*(--es) = '.';
-		}
-		CREATE_SYMLINK(streams_dir, dirname, es);
-	}
-
 	/* Create a FIFO which will contain this stream's PES contents */
 	if (stream_type_is_audio(stream->stream_type_identifier) ||
 		stream_type_is_video(stream->stream_type_identifier)) {
 		int obj_type = stream_type_is_video(stream->stream_type_identifier) ? 
 			OBJ_TYPE_VIDEO_FIFO : OBJ_TYPE_AUDIO_FIFO;
 
-		CREATE_FIFO((*subdir), obj_type, FS_PES_FIFO_NAME, priv);
+		pmt_create_fifo(*subdir, previous_subdir, obj_type, FS_PES_FIFO_NAME, 
+				stream->elementary_stream_pid, priv);
 
 		if (priv->options.parse_pes) {
 			/* Create a FIFO which will contain this stream's ES contents */
-			struct dentry *es_dentry = CREATE_FIFO((*subdir), obj_type, FS_ES_FIFO_NAME, priv);
+			struct dentry *es_dentry = pmt_create_fifo(*subdir, previous_subdir, obj_type, 
+					FS_ES_FIFO_NAME, stream->elementary_stream_pid, priv);
 #ifdef USE_FFMPEG
 			if (stream_type_is_video(stream->stream_type_identifier))
 				/* Create a file named snapshot.ppm */
-				CREATE_SNAPSHOT_FILE((*subdir), FS_VIDEO_SNAPSHOT_NAME, es_dentry, priv);
+				CREATE_SNAPSHOT_FILE((*subdir), FS_VIDEO_SNAPSHOT_NAME, es_dentry->hardlink, priv);
 #endif
 		}
 	}
@@ -189,21 +299,21 @@ static void pmt_populate_stream_dir(struct pmt_stream *stream, const char *descr
 		stream_type_is_mpe(stream->stream_type_identifier) ||
 		stream_type_is_object_carousel(stream->stream_type_identifier)) {
 		/* Assign this PID to the DSM-CC parser */
-		if (! hashtable_get(priv->psi_parsers, stream->elementary_stream_pid))
-			hashtable_add(priv->psi_parsers, stream->elementary_stream_pid, dsmcc_parse, NULL);
+		if (! ts_get_pid_parser(stream->elementary_stream_pid, TS_PID_PSI, priv))
+			ts_set_pid_parser(stream->elementary_stream_pid, TS_PID_PSI, dsmcc_parse, priv);
 	} else if (stream_type_is_audio(stream->stream_type_identifier)) {
 		/* Assign this to the PES audio parser */
-		if (! hashtable_get(priv->pes_parsers, stream->elementary_stream_pid))
-			hashtable_add(priv->pes_parsers, stream->elementary_stream_pid, pes_parse_audio, NULL);
+		if (! ts_get_pid_parser(stream->elementary_stream_pid, TS_PID_PES, priv))
+			ts_set_pid_parser(stream->elementary_stream_pid, TS_PID_PES, pes_parse_audio, priv);
 	} else if (stream_type_is_video(stream->stream_type_identifier)) {
 		/* Assign this to the PES video parser */
-		if (! hashtable_get(priv->pes_parsers, stream->elementary_stream_pid))
-			hashtable_add(priv->pes_parsers, stream->elementary_stream_pid, pes_parse_video, NULL);
-	} else if (! hashtable_get(priv->pes_parsers, stream->elementary_stream_pid)) {
+		if (! ts_get_pid_parser(stream->elementary_stream_pid, TS_PID_PES, priv))
+			ts_set_pid_parser(stream->elementary_stream_pid, TS_PID_PES, pes_parse_video, priv);
+	} else if (! ts_get_pid_parser(stream->elementary_stream_pid, TS_PID_PES, priv)) {
 		/* Assign this to the PES generic parser */
 		TS_INFO("Will parse pid %#x / stream_type %#x using a generic PES parser", 
 				stream->elementary_stream_pid, stream->stream_type_identifier);
-		hashtable_add(priv->psi_parsers, stream->elementary_stream_pid, pes_parse_other, NULL);
+		ts_set_pid_parser(stream->elementary_stream_pid, TS_PID_PSI, pes_parse_other, priv);
 	}
 }
 
@@ -216,9 +326,13 @@ static void pmt_create_directory(const struct ts_header *header, struct pmt_tabl
 	/* Create a directory named "<pmt_pid>" and populate it with files */
 	asprintf(&pmt->dentry->name, "%#04x", header->pid);
 	pmt->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(pmt_dir, pmt->dentry);
+	CREATE_UNLINKED(pmt_dir, pmt->dentry);
 	
-	/* Create the versioned dir and update the Current symlink */
+	/* 
+	 * Create the versioned dir and update the Current symlink. Each version is a full
+	 * snapshot, so it is built from scratch; only the stream FIFOs are shared with the
+	 * previous version (see pmt_create_fifo()).
+	 */
 	*version_dentry = fsutils_create_version_dir(pmt->dentry, pmt->version_number);
 
 	psi_populate((void **) &pmt, *version_dentry);
@@ -257,7 +371,7 @@ int pmt_parse(const struct ts_header *header, const char *payload, uint32_t payl
 			header->pid, pmt->table_id, current_pmt, pmt->version_number, payload_len);
 
 	/* Parse PMT specific bits */
-	struct dentry *version_dentry;
+	struct dentry *version_dentry, *previous_version;
 	pmt->reserved_4 = payload[8] >> 5;
 	pmt->pcr_pid = CONVERT_TO_16(payload[8], payload[9]) & 0x1fff;
 	pmt->reserved_5 = payload[10] >> 4;
@@ -269,8 +383,22 @@ int pmt_parse(const struct ts_header *header, const char *payload, uint32_t payl
 			version_dentry, priv);
 
 	uint32_t offset = 12 + descriptors_len;
+	uint32_t es_loop_end = 3 + pmt->section_length - sizeof(pmt->crc);
+	if (offset < es_loop_end && es_loop_end <= payload_len) {
+		pmt->es_loop_len = es_loop_end - offset;
+		pmt->es_loop = malloc(pmt->es_loop_len);
+		assert(pmt->es_loop);
+		memcpy(pmt->es_loop, &payload[offset], pmt->es_loop_len);
+	}
+
+	/* 
+	 * Only the streams which this version adds or changes get new FIFOs, so only their
+	 * PIDs are dropped from the PES cache. That happens before anything is retired, so 
+	 * PES parsers can't pick up a dentry which is about to be released.
+	 */
+	previous_version = current_pmt ? fsutils_get_current(current_pmt->dentry) : NULL;
 	pmt->num_programs = 0;
-	while (offset < 3 + pmt->section_length - sizeof(pmt->crc)) {
+	while (offset < es_loop_end) {
 		struct pmt_stream stream;
 		stream.stream_type_identifier = payload[offset];
 		stream.reserved_1 = (payload[offset+1] >> 5) & 0x7;
@@ -278,15 +406,25 @@ int pmt_parse(const struct ts_header *header, const char *payload, uint32_t payl
 		stream.reserved_2 = (payload[offset+3] >> 4) & 0x0f; 
 		stream.es_information_length = CONVERT_TO_16(payload[offset+3], payload[offset+4]) & 0x0fff;
 
+		struct dentry *unchanged_version = NULL;
+		if (pmt_has_stream_entry(current_pmt, &payload[offset], 5 + stream.es_information_length))
+			unchanged_version = previous_version;
+		else if (current_pmt)
+			pes_forget_stream(stream.elementary_stream_pid, priv);
+
 		uint32_t es_i = 0;
 		if (! stream.es_information_length) {
 				struct dentry *subdir = NULL;
-				pmt_populate_stream_dir(&stream, NULL, version_dentry, &subdir, priv);
+				pmt_populate_stream_dir(&stream, NULL, version_dentry, unchanged_version, &subdir, priv);
+				pmt_link_stream_dir(subdir, priv);
 		} else {
 			while (es_i < stream.es_information_length) {
 				struct dentry *subdir = NULL;
 				const char *descriptor_info = &payload[offset+5+es_i];
-				pmt_populate_stream_dir(&stream, descriptor_info, version_dentry, &subdir, priv);
+				pmt_populate_stream_dir(&stream, descriptor_info, version_dentry, unchanged_version, 
+						&subdir, priv);
+				if (es_i == 0)
+					pmt_link_stream_dir(subdir, priv);
 
 				priv->shared_data = (void *) &stream;
 				es_i += descriptors_parse(descriptor_info, 1, subdir, priv);
@@ -299,11 +437,20 @@ int pmt_parse(const struct ts_header *header, const char *payload, uint32_t payl
 	}
 	offset = 12 + pmt->program_information_length;
 
+	/* Streams which are gone or changed in this version */
+	for (uint32_t i = 0; current_pmt && i + 5 <= current_pmt->es_loop_len; ) {
+		const char *entry = &current_pmt->es_loop[i];
+		uint32_t entry_len = pmt_stream_entry_len(entry);
+		if (! pmt_has_stream_entry(pmt, entry, entry_len))
+			pes_forget_stream(CONVERT_TO_16(entry[1], entry[2]) & 0x1fff, priv);
+		i += entry_len;
+	}
+
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	pmt->dentry = fsutils_publish_dentry(pmt->dentry, current_pmt ? current_pmt->dentry : NULL);
 	if (current_pmt) {
-		fsutils_migrate_children(current_pmt->dentry, pmt->dentry);
-		hashtable_del(priv->psi_tables, current_pmt->dentry->inode);
-		/* Invalidate all items from the PES hash table */
-		hashtable_invalidate_contents(priv->pes_tables);
+		current_pmt->dentry = NULL;
+		hashtable_del(priv->psi_tables, pmt->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, pmt->dentry->inode, pmt, (hashtable_free_function_t) pmt_free);
 
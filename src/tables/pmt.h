@@ -35,11 +35,17 @@ struct pmt_table {
 	uint16_t num_descriptors;
 	uint16_t num_programs;
 	struct pmt_program *programs;
+	/* Raw elementary stream loop, to tell which streams the next version changes */
+	char *es_loop;
+	uint16_t es_loop_len;
 	uint32_t crc;
 } __attribute__((__packed__));
 
+struct pat_table;
+
 int pmt_parse(const struct ts_header *header, const char *payload, uint32_t payload_len,
 		struct demuxfs_data *priv);
 void pmt_free(struct pmt_table *pmt);
+void pmt_drop_stream_parsers(uint16_t pmt_pid, struct pat_table *pat, struct demuxfs_data *priv);
 
 #endif /* __pmt_h */
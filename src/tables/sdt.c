@@ -69,7 +69,7 @@ static void sdt_create_directory(const struct ts_header *header, struct sdt_tabl
 	/* Create a directory named "SDT" at the root filesystem */
 	sdt->dentry->name = strdup(FS_SDT_NAME);
 	sdt->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(priv->root, sdt->dentry);
+	CREATE_UNLINKED(priv->root, sdt->dentry);
 
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(sdt->dentry, sdt->version_number);
@@ -161,9 +161,11 @@ int sdt_parse(const struct ts_header *header, const char *payload, uint32_t payl
 		i += 5 + si->descriptors_loop_length;
 	}
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	sdt->dentry = fsutils_publish_dentry(sdt->dentry, current_sdt ? current_sdt->dentry : NULL);
 	if (current_sdt) {
-		fsutils_migrate_children(current_sdt->dentry, sdt->dentry);
-		hashtable_del(priv->psi_tables, current_sdt->dentry->inode);
+		current_sdt->dentry = NULL;
+		hashtable_del(priv->psi_tables, sdt->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, sdt->dentry->inode, sdt, (hashtable_free_function_t) sdt_free);
 
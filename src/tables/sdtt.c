@@ -76,7 +76,7 @@ static void sdtt_create_directory(const struct ts_header *header, struct sdtt_ta
 	/* Create a directory named "<sdtt_pid>" and populate it with files */
 	asprintf(&sdtt->dentry->name, "%#04x", header->pid);
 	sdtt->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(sdtt_dir, sdtt->dentry);
+	CREATE_UNLINKED(sdtt_dir, sdtt->dentry);
 	
 	/* Create the versioned dir and update the Current symlink */
 	*version_dentry = fsutils_create_version_dir(sdtt->dentry, sdtt->version_number);
@@ -212,9 +212,11 @@ int sdtt_parse(const struct ts_header *header, const char *payload, uint32_t pay
 		descriptors_parse(&payload[index], c->_num_descriptors, subdir, priv);
 	}
 
+	/* Make the new version visible at once; the published dentry now belongs to the new table */
+	sdtt->dentry = fsutils_publish_dentry(sdtt->dentry, current_sdtt ? current_sdtt->dentry : NULL);
 	if (current_sdtt) {
-		fsutils_migrate_children(current_sdtt->dentry, sdtt->dentry);
-		hashtable_del(priv->psi_tables, current_sdtt->dentry->inode);
+		current_sdtt->dentry = NULL;
+		hashtable_del(priv->psi_tables, sdtt->dentry->inode);
 	}
 	hashtable_add(priv->psi_tables, sdtt->dentry->inode, sdtt, (hashtable_free_function_t) sdtt_free);
 
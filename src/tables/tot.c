@@ -131,7 +131,7 @@ static void tot_create_directory(const struct ts_header *header, struct tot_tabl
 	//asprintf(&tot->dentry->name, "%#04x", header->pid);
 	asprintf(&tot->dentry->name, FS_CURRENT_NAME);
 	tot->dentry->mode = S_IFDIR | 0555;
-	CREATE_COMMON(tot_dir, tot->dentry);
+	CREATE_UNLINKED(tot_dir, tot->dentry);
 	
 	/* PSI header */
 	CREATE_FILE_NUMBER(tot->dentry, tot, table_id);
@@ -188,6 +188,7 @@ int tot_parse(const struct ts_header *header, const char *payload, uint32_t payl
                 header->pid, tot->table_id, current_tot, payload_len);
 		tot_create_directory(header, tot, priv);
 		descriptors_parse(&payload[10], num_descriptors, tot->dentry, priv);
+		fsutils_publish_dentry(tot->dentry, NULL);
 		hashtable_add(priv->psi_tables, tot->dentry->inode, tot, (hashtable_free_function_t) tot_free);
 	}
 	
@@ -34,6 +34,8 @@
 #include "ts.h"
 #include "crc32.h"
 #include "fsutils.h"
+#include "stats.h"
+#include "backend.h"
 
 /* PSI tables */
 #include "tables/psi.h"
@@ -52,6 +54,42 @@ struct packet_parser {
 	parse_function_t parser;
 };
 
+/* Known PSI parsers. A pid of -1 means that the table can be carried on any PID */
+static const struct packet_parser ts_psi_parsers[] = {
+	{ TS_PAT_TABLE_ID,               TS_PAT_PID, pat_parse },
+	{ TS_PMT_TABLE_ID,                       -1, pmt_parse },
+	{ TS_NIT_TABLE_ID,               TS_NIT_PID, nit_parse },
+	{ TS_SDT_TABLE_ID,               TS_SDT_PID, sdt_parse },
+	{ TS_TOT_TABLE_ID,                       -1, tot_parse },
+	{ TS_SDTT_TABLE_ID,            TS_SDTT1_PID, sdtt_parse },
+	{ TS_SDTT_TABLE_ID,            TS_SDTT2_PID, sdtt_parse },
+//	{ TS_CDT_TABLE_ID,               TS_CDT_PID, cdt_parse },
+//	{ TS_TDT_TABLE_ID,                       -1, tdt_parse },
+	{ TS_L_EIT_TABLE_ID,                     -1, eit_parse },
+	{ TS_M_EIT_TABLE_ID,                     -1, eit_parse },
+	{ TS_H_EIT_P_F_TABLE_ID,                 -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_1_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_2_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_3_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_4_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_5_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_6_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_7_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_8_BASIC_TABLE_ID,    -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_1_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_2_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_3_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_4_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_5_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_6_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_7_TABLE_ID, -1, eit_parse },
+	{ TS_H_EIT_SCHEDULE_EXTENDED_8_TABLE_ID, -1, eit_parse },
+	{ 0, 0, NULL }
+};
+
+/* Parsers of tables which can be carried on any PID, indexed by table_id. Built by ts_pid_table_new() */
+static parse_function_t ts_table_id_parsers[TS_MAX_TABLE_IDS];
+
 void ts_dump_header(const struct ts_header *header)
 {
 	fprintf(stdout, "--- ts header ---\n");
@@ -72,99 +110,207 @@ void ts_dump_payload(const char *payload, int len)
 	fprintf(stdout, "table_id=%#x\nsize=%#x (%d)\n", payload[0], size, size);
 }
 
-static bool ts_is_psi_packet(uint16_t pid, struct demuxfs_data *priv)
+/**
+ * ts_pid_table_new - Allocate the PID table, mark the well-known SI PIDs as PSI and
+ * build the table_id dispatch table out of ts_psi_parsers[].
+ *
+ * Returns a TS_MAX_PIDS sized array on success or NULL on failure.
+ */
+struct ts_pid_state *ts_pid_table_new(void)
 {
-	parse_function_t parse_function;
+	int i;
+	struct ts_pid_state *pid_table;
+	uint16_t si_pids[] = {
+		TS_PAT_PID,
+		TS_CAT_PID,
+		TS_NIT_PID,
+		TS_SDT_PID, /* or TS_BAT_PID */
+		TS_H_EIT_PID,
+		TS_M_EIT_PID,
+		TS_L_EIT_PID,
+		TS_RST_PID,
+		TS_TDT_PID,
+		TS_DCT_PID,
+		TS_DIT_PID,
+		TS_SIT_PID,
+		TS_PCAT_PID,
+		TS_SDTT1_PID,
+		TS_SDTT2_PID,
+		TS_BIT_PID,
+		TS_NBIT_PID, /* or TS_LDT_PID */
+		TS_CDT_PID,
+		TS_NULL_PID,
+	};
+
+	pid_table = (struct ts_pid_state *) calloc(TS_MAX_PIDS, sizeof(struct ts_pid_state));
+	if (! pid_table)
+		return NULL;
 
-	switch (pid) {
-		case TS_PAT_PID:
-		case TS_CAT_PID:
-		case TS_NIT_PID:
-		case TS_SDT_PID: /* or TS_BAT_PID */
-		case TS_H_EIT_PID:
-		case TS_M_EIT_PID:
-		case TS_L_EIT_PID:
-		case TS_RST_PID:
-		case TS_TDT_PID:
-		case TS_DCT_PID:
-		case TS_DIT_PID:
-		case TS_SIT_PID:
-		case TS_PCAT_PID:
-		case TS_SDTT1_PID:
-		case TS_SDTT2_PID:
-		case TS_BIT_PID:
-		case TS_NBIT_PID: /* or TS_LDT_PID */
-		case TS_CDT_PID:
-		case TS_NULL_PID:
-			return true;
-		default:
-			parse_function = (parse_function_t) hashtable_get(priv->psi_parsers, pid);
-			return parse_function ? true : false;
+	for (i=0; i<sizeof(si_pids)/sizeof(si_pids[0]); ++i)
+		pid_table[si_pids[i]].type = TS_PID_PSI;
+
+	for (i=0; ts_psi_parsers[i].parser != NULL; ++i) {
+		const struct packet_parser *p = &ts_psi_parsers[i];
+		if (p->pid == -1) {
+			ts_table_id_parsers[p->table_id] = p->parser;
+		} else {
+			pid_table[p->pid].si_table_id = p->table_id;
+			pid_table[p->pid].si_parser = p->parser;
+		}
 	}
+
+	return pid_table;
 }
 
-static bool ts_is_pes_packet(uint16_t pid, struct demuxfs_data *priv)
+/**
+ * ts_pid_table_destroy - Free the PID table.
+ * @pid_table: PID table allocated with ts_pid_table_new()
+ */
+void ts_pid_table_destroy(struct ts_pid_state *pid_table)
 {
-	parse_function_t parse_function;
-	parse_function = (parse_function_t) hashtable_get(priv->pes_parsers, pid);
-	return parse_function ? true : false;
+	free(pid_table);
 }
 
-static parse_function_t ts_get_psi_parser(const struct ts_header *header, uint8_t table_id,
+/**
+ * ts_parser_context_new - Allocate the reassembly state and section cache of a parsing thread.
+ *
+ * Returns the new context or NULL on failure.
+ */
+struct ts_parser_context *ts_parser_context_new(void)
+{
+	struct ts_parser_context *ctx = (struct ts_parser_context *) calloc(1, sizeof(struct ts_parser_context));
+	if (! ctx)
+		return NULL;
+	ctx->reassembly = (struct ts_reassembly *) calloc(TS_MAX_PIDS, sizeof(struct ts_reassembly));
+	if (! ctx->reassembly) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->section_cache = hashtable_new(TS_SECTION_CACHE_SIZE);
+	return ctx;
+}
+
+/**
+ * ts_parser_context_destroy - Free a context and any pending reassembly buffers.
+ * @ctx: context allocated with ts_parser_context_new()
+ */
+void ts_parser_context_destroy(struct ts_parser_context *ctx)
+{
+	int i;
+
+	if (! ctx)
+		return;
+	for (i=0; i<TS_MAX_PIDS; ++i)
+		if (ctx->reassembly[i].buffer)
+			buffer_destroy(ctx->reassembly[i].buffer);
+	hashtable_destroy(ctx->section_cache, (hashtable_free_function_t) free);
+	free(ctx->reassembly);
+	free(ctx);
+}
+
+/**
+ * Ask the backend to route a PID to us, if it filters its input. PES PIDs are
+ * left out unless they're going to be parsed.
+ */
+static void ts_pid_filter_add(uint16_t pid, struct ts_pid_state *state, struct demuxfs_data *priv)
+{
+	if (state->filtered || ! priv->backend->add_pid)
+		return;
+	if (state->type == TS_PID_PES && ! priv->options.parse_pes)
+		return;
+	if (priv->backend->add_pid(pid, priv) == 0)
+		state->filtered = true;
+}
+
+/**
+ * ts_pid_table_add_filters - Ask the backend to route the PIDs which are known
+ * upfront, that is, the well-known SI PIDs.
+ * @priv: private data
+ */
+void ts_pid_table_add_filters(struct demuxfs_data *priv)
+{
+	uint16_t pid;
+
+	for (pid=0; pid<TS_MAX_PIDS; ++pid)
+		if (pid != TS_NULL_PID && priv->pid_table[pid].type != TS_PID_UNKNOWN)
+			ts_pid_filter_add(pid, &priv->pid_table[pid], priv);
+}
+
+/**
+ * ts_get_pid_parser - Return the parser registered for a PID.
+ * @pid: PID to look up
+ * @type: the kind of parser wanted (TS_PID_PSI or TS_PID_PES)
+ * @priv: private data
+ *
+ * Returns NULL if the PID has no parser of the requested type.
+ */
+parse_function_t ts_get_pid_parser(uint16_t pid, enum ts_pid_type type, struct demuxfs_data *priv)
+{
+	struct ts_pid_state *state = &priv->pid_table[pid & (TS_MAX_PIDS-1)];
+	return state->type == type ? state->parser : NULL;
+}
+
+/**
+ * ts_set_pid_parser - Register a parser for a PID.
+ * @pid: PID to register
+ * @type: TS_PID_PSI or TS_PID_PES
+ * @parser: function invoked once a full section or PES packet has been reassembled
+ * @priv: private data
+ *
+ * PSI parsers take precedence: registering a PES parser on a PID which is already
+ * known to carry sections is a no-op. Reassembly buffers created for another kind
+ * of payload are dropped by the parsing threads as they notice the change.
+ */
+void ts_set_pid_parser(uint16_t pid, enum ts_pid_type type, parse_function_t parser,
 		struct demuxfs_data *priv)
 {
-	uint16_t i, pid = header->pid;
-	parse_function_t parse_function;
-	struct packet_parser parser[] = {
-		{ TS_PAT_TABLE_ID,               TS_PAT_PID, pat_parse },
-		{ TS_PMT_TABLE_ID,                       -1, pmt_parse },
-		{ TS_NIT_TABLE_ID,               TS_NIT_PID, nit_parse },
-		{ TS_SDT_TABLE_ID,               TS_SDT_PID, sdt_parse },
-		{ TS_TOT_TABLE_ID,                       -1, tot_parse },
-		{ TS_SDTT_TABLE_ID,            TS_SDTT1_PID, sdtt_parse },
-		{ TS_SDTT_TABLE_ID,            TS_SDTT2_PID, sdtt_parse },
-//		{ TS_CDT_TABLE_ID,               TS_CDT_PID, cdt_parse },
-//		{ TS_TDT_TABLE_ID,                       -1, tdt_parse },
-		{ TS_L_EIT_TABLE_ID,                     -1, eit_parse },
-		{ TS_M_EIT_TABLE_ID,                     -1, eit_parse },
-		{ TS_H_EIT_P_F_TABLE_ID,                 -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_1_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_2_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_3_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_4_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_5_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_6_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_7_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_8_BASIC_TABLE_ID,    -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_1_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_2_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_3_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_4_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_5_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_6_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_7_TABLE_ID, -1, eit_parse },
-		{ TS_H_EIT_SCHEDULE_EXTENDED_8_TABLE_ID, -1, eit_parse },
-		{ 0, 0, NULL }
-	};
+	struct ts_pid_state *state = &priv->pid_table[pid & (TS_MAX_PIDS-1)];
 
-	parse_function = (parse_function_t) hashtable_get(priv->psi_parsers, pid);
-	if (parse_function)
-		return parse_function;
+	if (type == TS_PID_PES && state->type == TS_PID_PSI)
+		return;
+	__atomic_store_n(&state->parser, parser, __ATOMIC_RELEASE);
+	__atomic_store_n(&state->type, type, __ATOMIC_RELEASE);
+	ts_pid_filter_add(pid, state, priv);
+}
+
+/**
+ * ts_clear_pid_parser - Forget the parser registered for a PID and ask the backend
+ * to stop routing it.
+ * @pid: PID to unregister
+ * @priv: private data
+ */
+void ts_clear_pid_parser(uint16_t pid, struct demuxfs_data *priv)
+{
+	struct ts_pid_state *state = &priv->pid_table[pid & (TS_MAX_PIDS-1)];
 
-	for (i=0; parser[i].parser != NULL; ++i)
-		if (table_id == parser[i].table_id && (parser[i].pid == -1 || parser[i].pid == pid))
-			return parser[i].parser;
+	__atomic_store_n(&state->type, TS_PID_UNKNOWN, __ATOMIC_RELEASE);
+	__atomic_store_n(&state->parser, NULL, __ATOMIC_RELEASE);
+	if (state->filtered && priv->backend->remove_pid)
+		priv->backend->remove_pid(pid, priv);
+	state->filtered = false;
+}
 
-	if ((pid == TS_NULL_PID) && (header->payload_unit_start_indicator != 0))
+static parse_function_t ts_get_psi_parser(const struct ts_header *header, uint8_t table_id,
+		struct ts_pid_state *state)
+{
+	if (state->parser)
+		return state->parser;
+	if (state->si_parser && state->si_table_id == table_id)
+		return state->si_parser;
+	if (ts_table_id_parsers[table_id])
+		return ts_table_id_parsers[table_id];
+
+	if ((header->pid == TS_NULL_PID) && (header->payload_unit_start_indicator != 0))
 		TS_WARNING("NULL packet has payload_unit_start_indicator != 0");
 
     return NULL;
 }
 
-static bool continuity_counter_is_ok(const struct ts_header *header, struct buffer *buffer, bool psi,
-	struct demuxfs_data *priv)
+static bool continuity_counter_is_ok(const struct ts_header *header, struct ts_reassembly *state,
+	bool psi, struct demuxfs_data *priv)
 {
-	uint8_t last_cc = buffer->continuity_counter;
+	struct buffer *buffer = state->buffer;
+	uint8_t last_cc = state->continuity_counter;
 	uint8_t this_cc = header->continuity_counter;
 	bool buf_empty = buffer_get_current_size(buffer) == 0;
 
@@ -186,10 +332,208 @@ static bool continuity_counter_is_ok(const struct ts_header *header, struct buff
 	return true;
 }
 
+/* Identity of a long-form section: PID, table_id, table_id_extension and section_number */
+#define TS_SECTION_KEY(pid,data) \
+	((((ino_t) (pid)) << 32) | (((ino_t) (data)[0] & 0xff) << 24) | \
+	 (((ino_t) CONVERT_TO_16((data)[3], (data)[4]) & 0xffff) << 8) | ((data)[6] & 0xff))
+
+struct section_cache_entry {
+	uint32_t crc32;
+	uint8_t version_number;
+};
+
+/**
+ * ts_section_get_crc - Return the CRC_32 field which closes a complete PSI section.
+ */
+static uint32_t ts_section_get_crc(const char *data)
+{
+	uint16_t section_length = CONVERT_TO_16(data[1], data[2]) & 0x0fff;
+	const char *crc = &data[3 + section_length - 4];
+	return CONVERT_TO_32(crc[0], crc[1], crc[2], crc[3]);
+}
+
+/**
+ * ts_section_is_cacheable - Only long-form sections carry the fields which identify them.
+ */
+static bool ts_section_is_cacheable(const char *data)
+{
+	uint16_t section_length = CONVERT_TO_16(data[1], data[2]) & 0x0fff;
+	bool section_syntax_indicator = data[1] & 0x80;
+	return section_syntax_indicator && section_length >= 9;
+}
+
+/**
+ * ts_section_is_unchanged - Tell whether an identical copy of this section has been parsed already.
+ *
+ * Broadcasters repeat every section several times per second. Sections whose CRC_32 and
+ * version_number match the last ones parsed for the same identity can be dropped before
+ * the CRC is computed and before the table parser allocates anything.
+ */
+static bool ts_section_is_unchanged(const struct ts_header *header, const char *data,
+		struct ts_parser_context *ctx)
+{
+	struct section_cache_entry *entry;
+
+	if (! ts_section_is_cacheable(data))
+		return false;
+
+	entry = hashtable_get(ctx->section_cache, TS_SECTION_KEY(header->pid, data));
+	return entry && 
+		entry->crc32 == ts_section_get_crc(data) &&
+		entry->version_number == ((data[5] >> 1) & 0x1f);
+}
+
+/**
+ * ts_section_cache_update - Remember the CRC_32 and version_number of a section which has been parsed.
+ */
+static void ts_section_cache_update(const struct ts_header *header, const char *data,
+		struct ts_parser_context *ctx)
+{
+	ino_t key;
+	struct section_cache_entry *entry;
+
+	if (! ts_section_is_cacheable(data))
+		return;
+
+	key = TS_SECTION_KEY(header->pid, data);
+	entry = hashtable_get(ctx->section_cache, key);
+	if (! entry) {
+		entry = (struct section_cache_entry *) calloc(1, sizeof(struct section_cache_entry));
+		assert(entry);
+		if (! hashtable_add(ctx->section_cache, key, entry, free)) {
+			/* Could not grow the cache: this section will simply be parsed again next time */
+			free(entry);
+			return;
+		}
+	}
+	entry->crc32 = ts_section_get_crc(data);
+	entry->version_number = (data[5] >> 1) & 0x1f;
+}
+
+/**
+ * ts_dispatch_section - Hand a complete PSI section over to its parser, unless it
+ * repeats one which has been parsed already. Table parsers modify the filesystem
+ * tree, so they run with the tree lock held.
+ * @check_crc: false if the CRC_32 has been verified by the backend already
+ */
+static int ts_dispatch_section(const struct ts_header *header, struct ts_pid_state *state,
+		struct ts_parser_context *ctx, const char *data, uint32_t len, bool check_crc,
+		struct demuxfs_data *priv)
+{
+	uint8_t table_id = data[0];
+	parse_function_t parse_function;
+	int ret = 0;
+
+	if (ts_section_is_unchanged(header, data, ctx))
+		__atomic_fetch_add(&priv->stats->sections_skipped[table_id], 1, __ATOMIC_RELAXED);
+	else if (check_crc && ! crc32_check(data, len)) {
+		/* Drop the section without caching it, so that the next good copy gets parsed */
+		if (priv->options.verbose_mask & CRC_ERROR)
+			TS_WARNING("CRC error on PID %d(%#x), table_id %d(%#x)", 
+				header->pid, header->pid, table_id, table_id);
+	} else if ((parse_function = ts_get_psi_parser(header, table_id, state))) {
+		/* Invoke the PSI parser for this packet */
+		pthread_mutex_lock(&priv->tree_lock);
+		ret = parse_function(header, data, len, priv);
+		if (priv->options.lazy_tables)
+			fsutils_shrink_lazy(priv->options.lazy_budget);
+		if (priv->options.keep_versions || priv->options.version_budget)
+			fsutils_shrink_versions(priv->options.keep_versions, priv->options.version_budget);
+		/* Release what this and earlier table versions replaced, if no reader can see it anymore */
+		epoch_reclaim();
+		pthread_mutex_unlock(&priv->tree_lock);
+		__atomic_fetch_add(&priv->stats->sections_parsed[table_id], 1, __ATOMIC_RELAXED);
+		if (ret >= 0)
+			ts_section_cache_update(header, data, ctx);
+	}
+	return ret;
+}
+
+/**
+ * ts_parse_section - Parse a complete PSI section. Called for backends which 
+ * deliver sections rather than transport stream packets.
+ * @header: TS header with the PID the section has been received from
+ * @section: section data, starting at the table_id
+ * @len: section length, including the 3-byte section header
+ * @ctx: parsing context of the calling thread
+ * @priv: private data
+ */
+int ts_parse_section(const struct ts_header *header, const char *section, uint32_t len,
+		struct ts_parser_context *ctx, struct demuxfs_data *priv)
+{
+	struct ts_pid_state *state = &priv->pid_table[header->pid & (TS_MAX_PIDS-1)];
+	uint16_t section_length;
+
+	if (len < 3)
+		return -EBADMSG;
+	section_length = CONVERT_TO_16(section[1], section[2]) & 0x0fff;
+	if (section_length + 3 > len) {
+		TS_WARNING("truncated section on PID %#x: %d < %d", header->pid, len, section_length + 3);
+		return -ENOBUFS;
+	}
+	if (state->type != TS_PID_PSI)
+		return 0;
+	return ts_dispatch_section(header, state, ctx, section, section_length + 3, false, priv);
+}
+
+/* How often the parsers release retired dentries while the tables don't change (in ms) */
+#define TS_RECLAIM_INTERVAL 1000
+
 /**
- * ts_parse_packet - Parse a transport stream packet. Called by the backend's process() function.
+ * ts_reclaim_periodically - Release the retired dentries which the kernel has forgotten
+ * since the last table change. Only one parser thread does so per interval.
  */
-int ts_parse_packet(const struct ts_header *header, const char *payload, struct demuxfs_data *priv)
+static void ts_reclaim_periodically(struct demuxfs_data *priv)
+{
+	static uint64_t next_reclaim;
+	struct timespec now;
+	uint64_t now_ms, next;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ms = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	next = __atomic_load_n(&next_reclaim, __ATOMIC_RELAXED);
+	if (now_ms < next || ! __atomic_compare_exchange_n(&next_reclaim, &next, 
+			now_ms + TS_RECLAIM_INTERVAL, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+	fsutils_reclaim(priv);
+}
+
+/**
+ * ts_parse_batch - Parse every packet (or section) of a batch read from the backend.
+ * @vec: the batch
+ * @ctx: parsing context of the calling thread
+ * @priv: private data
+ *
+ * Returns a negative error code if parsing cannot go on.
+ */
+int ts_parse_batch(struct ts_packet_vec *vec, struct ts_parser_context *ctx, struct demuxfs_data *priv)
+{
+	int i, ret;
+
+	for (i=0; i<vec->count; ++i) {
+		if (vec->sections)
+			ret = ts_parse_section(&vec->headers[i], vec->payloads[i], vec->lengths[i], ctx, priv);
+		else
+			ret = ts_parse_packet(&vec->headers[i], vec->payloads[i], ctx, priv);
+		if (ret < 0 && ret != -ENOBUFS) {
+			dprintf("Error processing packet: %s", strerror(-ret));
+			return ret;
+		}
+	}
+	/* Repeated sections aren't parsed, so don't wait for a table change to reclaim */
+	ts_reclaim_periodically(priv);
+	return 0;
+}
+
+/**
+ * ts_parse_packet - Parse a transport stream packet.
+ * @header: decoded TS header
+ * @payload: packet data following the 4-byte header
+ * @ctx: parsing context of the calling thread
+ * @priv: private data
+ */
+int ts_parse_packet(const struct ts_header *header, const char *payload, 
+		struct ts_parser_context *ctx, struct demuxfs_data *priv)
 {
 	int ret = 0;
 	uint8_t pointer_field = 0;
@@ -229,13 +573,22 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 	//ts_dump_payload(payload, payload_end-payload_start);
 		
 	struct buffer *buffer = NULL;
+	struct ts_pid_state *pid_state = &priv->pid_table[header->pid];
+	struct ts_reassembly *state = &ctx->reassembly[header->pid];
+	uint8_t type = __atomic_load_n(&pid_state->type, __ATOMIC_ACQUIRE);
 
-	if (ts_is_psi_packet(header->pid, priv)) {
+	if (state->buffer && state->type != type) {
+		/* The reassembly buffer was created for another kind of payload */
+		buffer_destroy(state->buffer);
+		state->buffer = NULL;
+	}
+	state->type = type;
+
+	if (type == TS_PID_PSI) {
 		const char *start = payload_start;
 		const char *end = payload_end;
 		bool is_new_packet = false;
 		bool pusi = header->payload_unit_start_indicator;
-		uint8_t table_id;
 
 		if (pusi) {
 			/* The first byte of the payload carries the pointer_field */
@@ -257,14 +610,14 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 		}
 
 		while (start <= payload_end) {
-			buffer = hashtable_get(priv->packet_buffer, header->pid);
+			buffer = state->buffer;
 			if (! buffer && is_new_packet) {
 				buffer = buffer_create(header->pid, section_length + 3, false);
 				if (! buffer)
 					return 0;
-				buffer->continuity_counter = header->continuity_counter;
-				hashtable_add(priv->packet_buffer, header->pid, buffer, NULL);
-			} else if (buffer && ! continuity_counter_is_ok(header, buffer, true, priv)) {
+				state->continuity_counter = header->continuity_counter;
+				state->buffer = buffer;
+			} else if (buffer && ! continuity_counter_is_ok(header, state, true, priv)) {
 				return 0;
 			} else if (buffer && buffer->current_size == 0 && ! is_new_packet) {
 				/*
@@ -287,14 +640,7 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 			if (buffer) {
 				int ret = buffer_append(buffer, start, end - start + 1);
 				if (ret >= 0 && buffer_contains_full_psi_section(buffer)) {
-					table_id = buffer->data[0];
-					if (! crc32_check(buffer->data, buffer->current_size) && 
-						priv->options.verbose_mask & CRC_ERROR)
-						TS_WARNING("CRC error on PID %d(%#x), table_id %d(%#x)", 
-							header->pid, header->pid, table_id, table_id);
-					else if ((parse_function = ts_get_psi_parser(header, table_id, priv)))
-						/* Invoke the PSI parser for this packet */
-						ret = parse_function(header, buffer->data, buffer->current_size, priv);
+					ts_dispatch_section(header, pid_state, ctx, buffer->data, buffer->current_size, true, priv);
 					buffer_reset_size(buffer);
 				}
 			}
@@ -322,11 +668,11 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 			pusi = false;
 			is_new_packet = true;
 		}
-	} else if (ts_is_pes_packet(header->pid, priv)) {
+	} else if (type == TS_PID_PES) {
 		uint16_t size;
 		bool pusi = header->payload_unit_start_indicator;
 		
-		buffer = hashtable_get(priv->packet_buffer, header->pid);
+		buffer = state->buffer;
 		if (! buffer) {
 			if (! pusi || (payload_end - payload_start <= 6))
 				return 0;
@@ -334,9 +680,9 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 			buffer = buffer_create(header->pid, size, true);
 			if (! buffer)
 				return 0;
-			buffer->continuity_counter = header->continuity_counter;
-			hashtable_add(priv->packet_buffer, header->pid, buffer, NULL);
-		} else if (!continuity_counter_is_ok(header, buffer, false, priv) ||
+			state->continuity_counter = header->continuity_counter;
+			state->buffer = buffer;
+		} else if (!continuity_counter_is_ok(header, state, false, priv) ||
 			(buffer_get_current_size(buffer) == 0 && !buffer_is_unbounded(buffer) && 
 			 (!pusi || (payload_end - payload_start <= 6)))) {
 			return 0;
@@ -345,12 +691,16 @@ int ts_parse_packet(const struct ts_header *header, const char *payload, struct
 		buffer_append(buffer, payload_start, payload_end - payload_start + 1);
 		if (buffer_contains_full_pes_section(buffer)) {
 			/* Invoke the PES parser for this packet */
-			if ((parse_function = (parse_function_t) hashtable_get(priv->pes_parsers, header->pid)))
+			if ((parse_function = __atomic_load_n(&pid_state->parser, __ATOMIC_ACQUIRE))) {
+				/* PES parsers write to dentries which table parsers may replace meanwhile */
+				read_lock();
 				ret = parse_function(header, buffer->data, buffer->current_size, priv);
+				read_unlock();
+			}
 			buffer_reset_size(buffer);
 		}
 	}
 	if (buffer)
-		buffer->continuity_counter = header->continuity_counter;
+		state->continuity_counter = header->continuity_counter;
 	return ret;
 }
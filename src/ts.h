@@ -11,6 +11,9 @@
 #define TS_SYNC_BYTE             0x47
 #define TS_MAX_SECTION_LENGTH    0x03FD
 #define TS_LAST_TABLE_ID         0xBF
+#define TS_MAX_PIDS              0x2000
+#define TS_MAX_TABLE_IDS         0x100
+#define TS_SECTION_CACHE_SIZE    0x2000
 
 /* Known PIDs */
 #define TS_PAT_PID    0x00
@@ -100,14 +103,80 @@ struct psi_common_header;
 #define TS_PACKET_HASH_KEY(ts_header,packet_header) \
 	((((ts_header)->pid & 0xffff) << 8) | ((struct psi_common_header*)(packet_header))->table_id)
 
+typedef int (*parse_function_t)(const struct ts_header *header, const char *payload, uint32_t payload_len, 
+		struct demuxfs_data *priv);
+
+/* Forward declaration */
+struct buffer;
+
+/* How packets on a given PID are reassembled */
+enum ts_pid_type {
+	TS_PID_UNKNOWN = 0,
+	TS_PID_PSI,
+	TS_PID_PES,
+};
+
+/**
+ * Per-PID demultiplexing state. The PID table is indexed directly by the 
+ * 13-bit PID, so ts_parse_packet() needs a single array access to learn
+ * how to handle a packet.
+ */
+struct ts_pid_state {
+	/* One of enum ts_pid_type */
+	uint8_t type;
+	/* Whether the backend has been asked to deliver this PID */
+	uint8_t filtered;
+	/* PID-specific parser. PSI PIDs without one are dispatched by table_id */
+	parse_function_t parser;
+	/* Parser for the si_table_id table, which is only accepted on this PID (eg: PAT, NIT, SDT) */
+	uint8_t si_table_id;
+	parse_function_t si_parser;
+};
+
+/**
+ * Per-PID reassembly state. Every thread which runs ts_parse_packet() has its own
+ * table of these, so that different PIDs can be reassembled concurrently.
+ */
+struct ts_reassembly {
+	/* The kind of payload held by buffer (one of enum ts_pid_type) */
+	uint8_t type;
+	/* Last continuity counter seen while reassembling */
+	uint8_t continuity_counter;
+	/* Holds incomplete sections/PES packets, which cannot be parsed yet */
+	struct buffer *buffer;
+};
+
+/**
+ * Parsing context of a thread which runs ts_parse_packet().
+ */
+struct ts_parser_context {
+	/* Indexed by PID */
+	struct ts_reassembly *reassembly;
+	/* Holds the CRC32 and version of the last section parsed for each section identity */
+	struct hash_table *section_cache;
+};
+
+struct ts_packet_vec;
+
 /**
  * Function prototypes
  */
-int ts_parse_packet(const struct ts_header *header, const char *payload, struct demuxfs_data *priv);
+int ts_parse_packet(const struct ts_header *header, const char *payload, 
+		struct ts_parser_context *ctx, struct demuxfs_data *priv);
+int ts_parse_section(const struct ts_header *header, const char *section, uint32_t len,
+		struct ts_parser_context *ctx, struct demuxfs_data *priv);
+int ts_parse_batch(struct ts_packet_vec *vec, struct ts_parser_context *ctx, struct demuxfs_data *priv);
 void ts_dump_header(const struct ts_header *header);
 void ts_dump_psi_header(struct psi_common_header *header);
 
-typedef int (*parse_function_t)(const struct ts_header *header, const char *payload, uint32_t payload_len, 
+struct ts_parser_context *ts_parser_context_new(void);
+void ts_parser_context_destroy(struct ts_parser_context *ctx);
+struct ts_pid_state *ts_pid_table_new(void);
+void ts_pid_table_destroy(struct ts_pid_state *pid_table);
+parse_function_t ts_get_pid_parser(uint16_t pid, enum ts_pid_type type, struct demuxfs_data *priv);
+void ts_set_pid_parser(uint16_t pid, enum ts_pid_type type, parse_function_t parser,
 		struct demuxfs_data *priv);
+void ts_clear_pid_parser(uint16_t pid, struct demuxfs_data *priv);
+void ts_pid_table_add_filters(struct demuxfs_data *priv);
 
 #endif /* __ts_h */
@@ -28,23 +28,43 @@
  */
 #include "demuxfs.h"
 #include "xattr.h"
+#include "arena.h"
 
-void xattr_free(struct xattr *xattr)
+/* The format of numeric dentries follows from their type, so they don't carry it in their list */
+static struct xattr number_format = {
+	.name = XATTR_FORMAT,
+	.value = XATTR_FORMAT_NUMBER,
+	.size = sizeof(XATTR_FORMAT_NUMBER) - 1,
+};
+
+static bool xattr_release(void *data)
 {
-	if (! xattr)
-		return;
+	struct xattr *xattr = (struct xattr *) data;
+	if (xattr->arena)
+		return true;
 	if (xattr->putname) {
 		free(xattr->name);
 		free(xattr->value);
 	}
-	list_del(&xattr->list);
 	free(xattr);
+	return true;
+}
+
+void xattr_free(struct xattr *xattr)
+{
+	if (! xattr)
+		return;
+	list_del(&xattr->list);
+	xattr_release(xattr);
 }
 
 struct xattr *xattr_get(struct dentry *dentry, const char *name)
 {
 	struct xattr *xattr;
-	list_for_each_entry(xattr, &dentry->xattrs, list)
+	/* Numeric files have no list of their own */
+	if (DEMUXFS_IS_NUMBER(dentry))
+		return strcmp(name, XATTR_FORMAT) ? NULL : &number_format;
+	list_for_each_entry_rcu(xattr, &dentry->xattrs, list)
 		if (! strcmp(xattr->name, name))
 			return xattr;
 	return NULL;
@@ -52,18 +72,21 @@ struct xattr *xattr_get(struct dentry *dentry, const char *name)
 
 bool xattr_exists(struct dentry *dentry, const char *name)
 {
-	struct xattr *xattr;
-	list_for_each_entry(xattr, &dentry->xattrs, list)
-		if (! strcmp(xattr->name, name))
-			return true;
-	return false;
+	return xattr_get(dentry, name) != NULL;
 }
 
 int xattr_add(struct dentry *dentry, const char *name, const char *value, size_t size, bool putname)
 {
-	struct xattr *xattr = malloc(sizeof(struct xattr));
+	struct xattr *xattr;
+
+	/* Attributes set by the parsers, which build the tree, last as long as their dentry */
+	if (! putname && dentry->arena)
+		xattr = arena_alloc(dentry->arena, sizeof(struct xattr));
+	else
+		xattr = malloc(sizeof(struct xattr));
 	if (! xattr)
 		return -ENOMEM;
+	xattr->arena = ! putname && dentry->arena;
 
 	if (putname) {
 		xattr->name = strdup(name);
@@ -76,7 +99,7 @@ int xattr_add(struct dentry *dentry, const char *name, const char *value, size_t
 	xattr->size = size;
 	xattr->putname = putname;
 
-	list_add_tail(&xattr->list, &dentry->xattrs);
+	list_add_tail_rcu(&xattr->list, &dentry->xattrs);
 	return 0;
 }
 
@@ -86,15 +109,22 @@ int xattr_list(struct dentry *dentry, char *buf, size_t size)
 	struct xattr *xattr;
 	char zero = 0;
 
-	list_for_each_entry(xattr, &dentry->xattrs, list)
-		required += strlen(xattr->name) + 1;
+	if (DEMUXFS_IS_NUMBER(dentry))
+		required = strlen(number_format.name) + 1;
+	else
+		list_for_each_entry_rcu(xattr, &dentry->xattrs, list)
+			required += strlen(xattr->name) + 1;
 
 	if (size == 0)
 		return required;
 	else if (size < required)
 		return -ERANGE;
 
-	list_for_each_entry(xattr, &dentry->xattrs, list) {
+	if (DEMUXFS_IS_NUMBER(dentry)) {
+		memcpy(buf, number_format.name, required);
+		return required;
+	}
+	list_for_each_entry_rcu(xattr, &dentry->xattrs, list) {
 		memcpy(buf+copied, xattr->name, strlen(xattr->name));
 		copied += strlen(xattr->name);
 		memcpy(buf+copied, &zero, 1);
@@ -108,7 +138,11 @@ int xattr_remove(struct dentry *dentry, const char *name)
 	struct xattr *xattr, *aux;
 	list_for_each_entry_safe(xattr, aux, &dentry->xattrs, list)
 		if (! strcmp(xattr->name, name)) {
-			xattr_free(xattr);
+			/* Readers may be walking the list: release it after they're gone. Attributes
+			 * in an arena are released along with their dentry, which happens later still */
+			list_del_rcu(&xattr->list);
+			if (! xattr->arena)
+				epoch_retire(xattr, xattr_release);
 			return 0;
 		}
 	return -ENOENT;